@@ -29,16 +29,22 @@
                 "./vendor/pcre/pcre.gyp:pcre",
             ],
             "sources": [
+                "src/core/chunked-text.cc",
                 "src/core/encoding-conversion.cc",
+                "src/core/file-chunk-source.cc",
+                "src/core/line-index.cc",
                 "src/core/marker-index.cc",
                 "src/core/patch.cc",
                 "src/core/point.cc",
                 "src/core/range.cc",
                 "src/core/regex.cc",
+                "src/core/regex-cache.cc",
+                "src/core/search-session.cc",
                 "src/core/text.cc",
                 "src/core/text-buffer.cc",
                 "src/core/text-slice.cc",
                 "src/core/text-diff.cc",
+                "src/core/thread-pool.cc",
                 "src/core/libmba-diff.cc",
             ],
             "include_dirs": [
@@ -84,11 +90,20 @@
                 "sources": [
                     "test/native/test-helpers.cc",
                     "test/native/tests.cc",
+                    "test/native/chunked-text-test.cc",
                     "test/native/encoding-conversion-test.cc",
+                    "test/native/file-chunk-source-test.cc",
+                    "test/native/flat-set-test.cc",
+                    "test/native/line-index-test.cc",
+                    "test/native/marker-index-test.cc",
                     "test/native/patch-test.cc",
+                    "test/native/regex-cache-test.cc",
+                    "test/native/search-session-test.cc",
+                    "test/native/small-vector-test.cc",
                     "test/native/text-buffer-test.cc",
                     "test/native/text-test.cc",
                     "test/native/text-diff-test.cc",
+                    "test/native/thread-pool-test.cc",
                 ],
                 "include_dirs": [
                     "vendor",
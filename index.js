@@ -4,7 +4,7 @@ if (process.env.SUPERSTRING_USE_BROWSER_VERSION) {
   binding = require('./browser');
 
   const {TextBuffer, Patch} = binding
-  const {findSync, findAllSync, findAndMarkAllSync, findWordsWithSubsequenceInRange, getCharacterAtPosition} = TextBuffer.prototype
+  const {findSync, findAllSync, findAndMarkAllSync, findWordsWithSubsequenceInRange, getCharacterAtPosition, setTextInRanges} = TextBuffer.prototype
   const DEFAULT_RANGE = Object.freeze({start: {row: 0, column: 0}, end: {row: Infinity, column: Infinity}})
 
   TextBuffer.prototype.findInRangeSync = function (pattern, range) {
@@ -99,6 +99,18 @@ if (process.env.SUPERSTRING_USE_BROWSER_VERSION) {
     return String.fromCharCode(getCharacterAtPosition.call(this, position))
   }
 
+  TextBuffer.prototype.setTextInRanges = function (ranges, texts) {
+    if (!Array.isArray(ranges) || !Array.isArray(texts)) {
+      throw new TypeError('setTextInRanges requires an array of ranges and an array of strings')
+    }
+    if (ranges.length !== texts.length) {
+      throw new TypeError('setTextInRanges requires as many strings as ranges')
+    }
+    if (!setTextInRanges.call(this, ranges, texts)) {
+      throw new Error('setTextInRanges requires sorted, non-overlapping ranges')
+    }
+  }
+
   const {compose} = Patch
   const {splice} = Patch.prototype
 
@@ -127,7 +139,8 @@ if (process.env.SUPERSTRING_USE_BROWSER_VERSION) {
   const {TextBuffer, TextWriter, TextReader} = binding
   const {
     load, save, baseTextMatchesFile,
-    find, findAll, findSync, findAllSync, findWordsWithSubsequenceInRange
+    find, findAll, findSync, findAllSync, findWordsWithSubsequenceInRange,
+    createSearchSession
   } = TextBuffer.prototype
 
   TextBuffer.prototype.load = function (source, options, progressCallback) {
@@ -256,6 +269,33 @@ if (process.env.SUPERSTRING_USE_BROWSER_VERSION) {
     return interpretRangeArray(findAllSync.call(this, pattern, range))
   }
 
+  TextBuffer.prototype.createSearchSession = function (pattern) {
+    return new SearchSession(createSearchSession.call(this, pattern))
+  }
+
+  class SearchSession {
+    constructor (session) {
+      this.session = session
+    }
+
+    getMatches () {
+      return interpretRangeArray(this.session.getMatches())
+    }
+
+    getMatchesInRange (range) {
+      return interpretRangeArray(this.session.getMatchesInRange(range))
+    }
+
+    getMatchCount () {
+      return this.session.getMatchCount()
+    }
+
+    update () {
+      const {removed, added} = this.session.update()
+      return {removed: interpretRangeArray(removed), added: interpretRangeArray(added)}
+    }
+  }
+
   TextBuffer.prototype.findWordsWithSubsequence = function (query, extraWordCharacters, maxCount) {
     return this.findWordsWithSubsequenceInRange(query, extraWordCharacters, maxCount, {
       start: {row: 0, column: 0},
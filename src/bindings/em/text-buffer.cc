@@ -1,6 +1,7 @@
 #include "auto-wrap.h"
 #include "text-buffer.h"
 #include "marker-index.h"
+#include "regex-cache.h"
 #include <emscripten/bind.h>
 
 using std::string;
@@ -13,12 +14,12 @@ static TextBuffer *construct(const std::wstring &text) {
 static emscripten::val find_sync(TextBuffer &buffer, std::wstring js_pattern, bool ignore_case, bool unicode, Range range) {
   u16string pattern(js_pattern.begin(), js_pattern.end());
   u16string error_message;
-  Regex regex(pattern, &error_message, ignore_case, unicode);
-  if (!error_message.empty()) {
+  auto regex = RegexCache::shared().get(pattern, &error_message, ignore_case, unicode);
+  if (!regex) {
     return emscripten::val(string(error_message.begin(), error_message.end()));
   }
 
-  auto result = buffer.find(regex, range);
+  auto result = buffer.find(*regex, range);
   if (result) {
     return emscripten::val(*result);
   }
@@ -29,12 +30,12 @@ static emscripten::val find_sync(TextBuffer &buffer, std::wstring js_pattern, bo
 static emscripten::val find_all_sync(TextBuffer &buffer, std::wstring js_pattern, bool ignore_case, bool unicode, Range range) {
   u16string pattern(js_pattern.begin(), js_pattern.end());
   u16string error_message;
-  Regex regex(pattern, &error_message, ignore_case, unicode);
-  if (!error_message.empty()) {
+  auto regex = RegexCache::shared().get(pattern, &error_message, ignore_case, unicode);
+  if (!regex) {
     return emscripten::val(string(error_message.begin(), error_message.end()));
   }
 
-  return em_transmit(buffer.find_all(regex, range));
+  return em_transmit(buffer.find_all(*regex, range));
 }
 
 static emscripten::val find_and_mark_all_sync(TextBuffer &buffer, MarkerIndex &index, unsigned next_id,
@@ -42,12 +43,12 @@ static emscripten::val find_and_mark_all_sync(TextBuffer &buffer, MarkerIndex &i
                                               Range range) {
   u16string pattern(js_pattern.begin(), js_pattern.end());
   u16string error_message;
-  Regex regex(pattern, &error_message, ignore_case, unicode);
-  if (!error_message.empty()) {
+  auto regex = RegexCache::shared().get(pattern, &error_message, ignore_case, unicode);
+  if (!regex) {
     return emscripten::val(string(error_message.begin(), error_message.end()));
   }
 
-  return emscripten::val(buffer.find_and_mark_all(index, next_id, exclusive, regex, range));
+  return emscripten::val(buffer.find_and_mark_all(index, next_id, exclusive, *regex, range));
 }
 
 static emscripten::val line_ending_for_row(TextBuffer &buffer, uint32_t row) {
@@ -76,6 +77,19 @@ static Point position_for_character_index(TextBuffer &buffer, long index) {
     buffer.position_for_offset(static_cast<uint32_t>(index));
 }
 
+static bool set_text_in_ranges(TextBuffer &buffer, emscripten::val js_ranges, emscripten::val js_texts) {
+  unsigned length = js_ranges["length"].as<unsigned>();
+  if (js_texts["length"].as<unsigned>() != length) return false;
+
+  std::vector<TextBuffer::Edit> edits;
+  edits.reserve(length);
+  for (unsigned i = 0; i < length; i++) {
+    std::wstring text = js_texts[i].as<std::wstring>();
+    edits.push_back({js_ranges[i].as<Range>(), u16string(text.begin(), text.end())});
+  }
+  return buffer.set_text_in_ranges(std::move(edits));
+}
+
 EMSCRIPTEN_BINDINGS(TextBuffer) {
   emscripten::class_<TextBuffer>("TextBuffer")
     .constructor<>()
@@ -85,6 +99,7 @@ EMSCRIPTEN_BINDINGS(TextBuffer) {
     .function("getCharacterAtPosition", WRAP(&TextBuffer::character_at))
     .function("getTextInRange", WRAP(&TextBuffer::text_in_range))
     .function("setTextInRange", WRAP_OVERLOAD(&TextBuffer::set_text_in_range, void (TextBuffer::*)(Range, u16string &&)))
+    .function("setTextInRanges", set_text_in_ranges)
     .function("getLength", &TextBuffer::size)
     .function("getExtent", &TextBuffer::extent)
     .function("getLineCount", get_line_count)
@@ -1,4 +1,5 @@
 #include "marker-index-wrapper.h"
+#include <string.h>
 #include <unordered_map>
 #include "marker-index.h"
 #include "nan.h"
@@ -22,6 +23,10 @@ static Nan::Persistent<String> boundaries_string;
 static Nan::Persistent<String> position_string;
 static Nan::Persistent<String> starting_string;
 static Nan::Persistent<String> ending_string;
+static Nan::Persistent<String> id_string;
+static Nan::Persistent<String> exclusive_string;
+static Nan::Persistent<String> old_extent_string;
+static Nan::Persistent<String> new_extent_string;
 
 void MarkerIndexWrapper::init(Local<Object> exports) {
   Local<FunctionTemplate> constructor_template = Nan::New<FunctionTemplate>(construct);
@@ -34,16 +39,20 @@ void MarkerIndexWrapper::init(Local<Object> exports) {
   Nan::SetTemplate(prototype_template, Nan::New<String>("generateRandomNumber").ToLocalChecked(),
                           Nan::New<FunctionTemplate>(generate_random_number), None);
   Nan::SetTemplate(prototype_template, Nan::New<String>("insert").ToLocalChecked(), Nan::New<FunctionTemplate>(insert), None);
+  Nan::SetTemplate(prototype_template, Nan::New<String>("bulkInsert").ToLocalChecked(), Nan::New<FunctionTemplate>(bulk_insert), None);
   Nan::SetTemplate(prototype_template, Nan::New<String>("setExclusive").ToLocalChecked(), Nan::New<FunctionTemplate>(set_exclusive), None);
   Nan::SetTemplate(prototype_template, Nan::New<String>("remove").ToLocalChecked(), Nan::New<FunctionTemplate>(remove), None);
   Nan::SetTemplate(prototype_template, Nan::New<String>("has").ToLocalChecked(), Nan::New<FunctionTemplate>(has), None);
   Nan::SetTemplate(prototype_template, Nan::New<String>("splice").ToLocalChecked(), Nan::New<FunctionTemplate>(splice), None);
+  Nan::SetTemplate(prototype_template, Nan::New<String>("spliceMany").ToLocalChecked(), Nan::New<FunctionTemplate>(splice_many), None);
   Nan::SetTemplate(prototype_template, Nan::New<String>("getStart").ToLocalChecked(), Nan::New<FunctionTemplate>(get_start), None);
   Nan::SetTemplate(prototype_template, Nan::New<String>("getEnd").ToLocalChecked(), Nan::New<FunctionTemplate>(get_end), None);
   Nan::SetTemplate(prototype_template, Nan::New<String>("getRange").ToLocalChecked(), Nan::New<FunctionTemplate>(get_range), None);
   Nan::SetTemplate(prototype_template, Nan::New<String>("compare").ToLocalChecked(), Nan::New<FunctionTemplate>(compare), None);
   Nan::SetTemplate(prototype_template, Nan::New<String>("findIntersecting").ToLocalChecked(),
                           Nan::New<FunctionTemplate>(find_intersecting), None);
+  Nan::SetTemplate(prototype_template, Nan::New<String>("findIntersectingRanges").ToLocalChecked(),
+                          Nan::New<FunctionTemplate>(find_intersecting_ranges), None);
   Nan::SetTemplate(prototype_template, Nan::New<String>("findContaining").ToLocalChecked(),
                           Nan::New<FunctionTemplate>(find_containing), None);
   Nan::SetTemplate(prototype_template, Nan::New<String>("findContainedIn").ToLocalChecked(),
@@ -68,6 +77,10 @@ void MarkerIndexWrapper::init(Local<Object> exports) {
   position_string.Reset(Nan::Persistent<String>(Nan::New("position").ToLocalChecked()));
   starting_string.Reset(Nan::Persistent<String>(Nan::New("starting").ToLocalChecked()));
   ending_string.Reset(Nan::Persistent<String>(Nan::New("ending").ToLocalChecked()));
+  id_string.Reset(Nan::Persistent<String>(Nan::New("id").ToLocalChecked()));
+  exclusive_string.Reset(Nan::Persistent<String>(Nan::New("exclusive").ToLocalChecked()));
+  old_extent_string.Reset(Nan::Persistent<String>(Nan::New("oldExtent").ToLocalChecked()));
+  new_extent_string.Reset(Nan::Persistent<String>(Nan::New("newExtent").ToLocalChecked()));
 
   marker_index_constructor_template.Reset(constructor_template);
   Nan::Set(exports, Nan::New("MarkerIndex").ToLocalChecked(), Nan::GetFunction(constructor_template).ToLocalChecked());
@@ -118,6 +131,15 @@ Local<Array> MarkerIndexWrapper::marker_ids_vector_to_js(const std::vector<Marke
   return js_array;
 }
 
+Local<Object> MarkerIndexWrapper::splice_result_to_js(const MarkerIndex::SpliceResult &result) {
+  Local<Object> invalidated = Nan::New<Object>();
+  Nan::Set(invalidated, Nan::New(touch_string), marker_ids_set_to_js(result.touch));
+  Nan::Set(invalidated, Nan::New(inside_string), marker_ids_set_to_js(result.inside));
+  Nan::Set(invalidated, Nan::New(overlap_string), marker_ids_set_to_js(result.overlap));
+  Nan::Set(invalidated, Nan::New(surround_string), marker_ids_set_to_js(result.surround));
+  return invalidated;
+}
+
 Local<Object> MarkerIndexWrapper::snapshot_to_js(const unordered_map<MarkerIndex::MarkerId, Range> &snapshot) {
   Local<Object> result_object = Nan::New<Object>();
   Isolate *isolate = v8::Isolate::GetCurrent();
@@ -172,6 +194,40 @@ void MarkerIndexWrapper::insert(const Nan::FunctionCallbackInfo<Value> &info) {
   }
 }
 
+void MarkerIndexWrapper::bulk_insert(const Nan::FunctionCallbackInfo<Value> &info) {
+  MarkerIndexWrapper *wrapper = Nan::ObjectWrap::Unwrap<MarkerIndexWrapper>(info.This());
+
+  if (!info[0]->IsArray()) {
+    Nan::ThrowTypeError("Expected an array of markers");
+    return;
+  }
+
+  Local<Array> js_markers = Local<Array>::Cast(info[0]);
+  std::vector<MarkerIndex::Insertion> insertions;
+  insertions.reserve(js_markers->Length());
+  for (uint32_t i = 0, n = js_markers->Length(); i < n; i++) {
+    Local<Value> js_marker_value = Nan::Get(js_markers, i).ToLocalChecked();
+    if (!js_marker_value->IsObject()) {
+      Nan::ThrowTypeError("Expected an array of markers");
+      return;
+    }
+
+    Local<Object> js_marker = Local<Object>::Cast(js_marker_value);
+    optional<MarkerIndex::MarkerId> id = marker_id_from_js(Nan::Get(js_marker, Nan::New(id_string)).ToLocalChecked());
+    if (!id) return;
+    optional<Point> start = PointWrapper::point_from_js(Nan::Get(js_marker, Nan::New(start_string)).ToLocalChecked());
+    if (!start) return;
+    optional<Point> end = PointWrapper::point_from_js(Nan::Get(js_marker, Nan::New(end_string)).ToLocalChecked());
+    if (!end) return;
+    optional<bool> exclusive = bool_from_js(Nan::Get(js_marker, Nan::New(exclusive_string)).ToLocalChecked());
+    if (!exclusive) return;
+
+    insertions.push_back({*id, *start, *end, *exclusive});
+  }
+
+  wrapper->marker_index.bulk_insert(insertions);
+}
+
 void MarkerIndexWrapper::set_exclusive(const Nan::FunctionCallbackInfo<Value> &info) {
   MarkerIndexWrapper *wrapper = Nan::ObjectWrap::Unwrap<MarkerIndexWrapper>(info.This());
 
@@ -210,15 +266,46 @@ void MarkerIndexWrapper::splice(const Nan::FunctionCallbackInfo<Value> &info) {
   optional<Point> new_extent = PointWrapper::point_from_js(info[2]);
   if (start && old_extent && new_extent) {
     MarkerIndex::SpliceResult result = wrapper->marker_index.splice(*start, *old_extent, *new_extent);
+    info.GetReturnValue().Set(splice_result_to_js(result));
+  }
+}
+
+void MarkerIndexWrapper::splice_many(const Nan::FunctionCallbackInfo<Value> &info) {
+  MarkerIndexWrapper *wrapper = Nan::ObjectWrap::Unwrap<MarkerIndexWrapper>(info.This());
 
-    Local<Object> invalidated = Nan::New<Object>();
-    Nan::Set(invalidated, Nan::New(touch_string), marker_ids_set_to_js(result.touch));
-    Nan::Set(invalidated, Nan::New(inside_string), marker_ids_set_to_js(result.inside));
-    Nan::Set(invalidated, Nan::New(inside_string), marker_ids_set_to_js(result.inside));
-    Nan::Set(invalidated, Nan::New(overlap_string), marker_ids_set_to_js(result.overlap));
-    Nan::Set(invalidated, Nan::New(surround_string), marker_ids_set_to_js(result.surround));
-    info.GetReturnValue().Set(invalidated);
+  if (!info[0]->IsArray()) {
+    Nan::ThrowTypeError("Expected an array of splices");
+    return;
   }
+
+  Local<Array> js_splices = Local<Array>::Cast(info[0]);
+  std::vector<MarkerIndex::Splice> splices;
+  splices.reserve(js_splices->Length());
+  for (uint32_t i = 0, n = js_splices->Length(); i < n; i++) {
+    Local<Value> js_splice_value = Nan::Get(js_splices, i).ToLocalChecked();
+    if (!js_splice_value->IsObject()) {
+      Nan::ThrowTypeError("Expected an array of splices");
+      return;
+    }
+
+    Local<Object> js_splice = Local<Object>::Cast(js_splice_value);
+    optional<Point> start = PointWrapper::point_from_js(Nan::Get(js_splice, Nan::New(start_string)).ToLocalChecked());
+    if (!start) return;
+    optional<Point> old_extent = PointWrapper::point_from_js(Nan::Get(js_splice, Nan::New(old_extent_string)).ToLocalChecked());
+    if (!old_extent) return;
+    optional<Point> new_extent = PointWrapper::point_from_js(Nan::Get(js_splice, Nan::New(new_extent_string)).ToLocalChecked());
+    if (!new_extent) return;
+
+    if (!splices.empty() && *start <= splices.back().start.traverse(splices.back().old_extent)) {
+      Nan::ThrowError("Splices must be sorted and must not overlap or touch");
+      return;
+    }
+
+    splices.push_back({*start, *old_extent, *new_extent});
+  }
+
+  MarkerIndex::SpliceResult result = wrapper->marker_index.splice_many(splices);
+  info.GetReturnValue().Set(splice_result_to_js(result));
 }
 
 void MarkerIndexWrapper::get_start(const Nan::FunctionCallbackInfo<Value> &info) {
@@ -275,6 +362,25 @@ void MarkerIndexWrapper::find_intersecting(const Nan::FunctionCallbackInfo<Value
   }
 }
 
+void MarkerIndexWrapper::find_intersecting_ranges(const Nan::FunctionCallbackInfo<Value> &info) {
+  MarkerIndexWrapper *wrapper = Nan::ObjectWrap::Unwrap<MarkerIndexWrapper>(info.This());
+
+  optional<Point> start = PointWrapper::point_from_js(info[0]);
+  optional<Point> end = PointWrapper::point_from_js(info[1]);
+
+  if (start && end) {
+    // Each marker is encoded as its id followed by the rows and columns of
+    // its start and end, in one flat array.
+    static_assert(sizeof(MarkerIndex::MarkerRange) == 5 * sizeof(uint32_t), "Unexpected MarkerRange layout");
+    std::vector<MarkerIndex::MarkerRange> ranges = wrapper->marker_index.find_intersecting_ranges(*start, *end);
+    auto length = ranges.size() * 5;
+    auto buffer = v8::ArrayBuffer::New(v8::Isolate::GetCurrent(), length * sizeof(uint32_t));
+    auto result = v8::Uint32Array::New(buffer, 0, length);
+    memcpy(buffer->GetContents().Data(), ranges.data(), length * sizeof(uint32_t));
+    info.GetReturnValue().Set(result);
+  }
+}
+
 void MarkerIndexWrapper::find_containing(const Nan::FunctionCallbackInfo<Value> &info) {
   MarkerIndexWrapper *wrapper = Nan::ObjectWrap::Unwrap<MarkerIndexWrapper>(info.This());
 
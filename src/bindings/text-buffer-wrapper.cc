@@ -12,12 +12,16 @@
 #include "text-writer.h"
 #include "text-slice.h"
 #include "text-diff.h"
+#include "file-chunk-source.h"
+#include "regex-cache.h"
+#include "search-session.h"
 #include "noop.h"
 #include <sys/stat.h>
 
 using namespace v8;
 using std::move;
 using std::pair;
+using std::shared_ptr;
 using std::string;
 using std::u16string;
 using std::vector;
@@ -72,15 +76,20 @@ static FILE *open_file(const std::string &name, const char *flags) {
 
 static size_t CHUNK_SIZE = 10 * 1024;
 
+// UTF-8 files at least this large are decoded lazily when they are loaded
+// without computing a patch, so that opening them only takes a scan of the
+// file, and the parts that are never read are never kept in memory.
+static size_t MIN_LAZILY_LOADED_FILE_SIZE = 16 * 1024 * 1024;
+
 class RegexWrapper : public Nan::ObjectWrap {
  public:
-  Regex regex;
+  shared_ptr<const Regex> regex;
   static Nan::Persistent<Function> constructor;
   static void construct(const Nan::FunctionCallbackInfo<v8::Value> &info) {}
 
-  RegexWrapper(Regex &&regex) : regex{move(regex)} {}
+  RegexWrapper(shared_ptr<const Regex> regex) : regex{move(regex)} {}
 
-  static const Regex *regex_from_js(const Local<Value> &value) {
+  static shared_ptr<const Regex> regex_from_js(const Local<Value> &value) {
     Local<String> js_pattern;
     Local<RegExp> js_regex;
     Local<String> cache_key = Nan::New("__textBufferRegex").ToLocalChecked();
@@ -93,7 +102,7 @@ class RegexWrapper : public Nan::ObjectWrap {
       js_regex = Local<RegExp>::Cast(value);
       Local<Value> stored_regex = Nan::Get(js_regex, cache_key).ToLocalChecked();
       if (!stored_regex->IsUndefined()) {
-        return &Nan::ObjectWrap::Unwrap<RegexWrapper>(Nan::To<Object>(stored_regex).ToLocalChecked())->regex;
+        return Nan::ObjectWrap::Unwrap<RegexWrapper>(Nan::To<Object>(stored_regex).ToLocalChecked())->regex;
       }
       js_pattern = js_regex->GetSource();
       if (js_regex->GetFlags() & RegExp::kIgnoreCase) ignore_case = true;
@@ -105,22 +114,25 @@ class RegexWrapper : public Nan::ObjectWrap {
 
     u16string error_message;
     optional<u16string> pattern = string_conversion::string_from_js(js_pattern);
-    Regex regex(*pattern, &error_message, ignore_case, unicode);
-    if (!error_message.empty()) {
+    auto regex = RegexCache::shared().get(*pattern, &error_message, ignore_case, unicode);
+    if (!regex) {
       Nan::ThrowError(string_conversion::string_to_js(error_message));
       return nullptr;
     }
 
-    Local<Object> result;
-    if (!Nan::New(constructor)->NewInstance(Nan::GetCurrentContext()).ToLocal(&result)) {
-      Nan::ThrowError("Could not create regex wrapper");
-      return nullptr;
+    if (!js_regex.IsEmpty()) {
+      Local<Object> result;
+      if (!Nan::New(constructor)->NewInstance(Nan::GetCurrentContext()).ToLocal(&result)) {
+        Nan::ThrowError("Could not create regex wrapper");
+        return nullptr;
+      }
+
+      auto regex_wrapper = new RegexWrapper(regex);
+      regex_wrapper->Wrap(result);
+      Nan::Set(js_regex, cache_key, result);
     }
 
-    auto regex_wrapper = new RegexWrapper(move(regex));
-    regex_wrapper->Wrap(result);
-    if (!js_regex.IsEmpty()) Nan::Set(js_regex, cache_key, result);
-    return &regex_wrapper->regex;
+    return regex;
   }
 
   static void init() {
@@ -188,6 +200,73 @@ public:
 
 Nan::Persistent<Function> SubsequenceMatchWrapper::constructor;
 
+static Local<Value> encode_ranges(const vector<Range> &ranges);
+
+class SearchSessionWrapper : public Nan::ObjectWrap {
+public:
+  static Nan::Persistent<Function> constructor;
+
+  static void init() {
+    Local<FunctionTemplate> constructor_template = Nan::New<FunctionTemplate>();
+    constructor_template->SetClassName(Nan::New<String>("SearchSession").ToLocalChecked());
+    constructor_template->InstanceTemplate()->SetInternalFieldCount(1);
+    const auto &prototype_template = constructor_template->PrototypeTemplate();
+    Nan::SetTemplate(prototype_template, Nan::New("getMatches").ToLocalChecked(), Nan::New<FunctionTemplate>(get_matches), None);
+    Nan::SetTemplate(prototype_template, Nan::New("getMatchesInRange").ToLocalChecked(), Nan::New<FunctionTemplate>(get_matches_in_range), None);
+    Nan::SetTemplate(prototype_template, Nan::New("getMatchCount").ToLocalChecked(), Nan::New<FunctionTemplate>(get_match_count), None);
+    Nan::SetTemplate(prototype_template, Nan::New("update").ToLocalChecked(), Nan::New<FunctionTemplate>(update), None);
+    constructor.Reset(Nan::GetFunction(constructor_template).ToLocalChecked());
+  }
+
+  static Local<Value> new_instance(Local<Object> js_buffer, TextBuffer &buffer, shared_ptr<const Regex> regex) {
+    Local<Object> result;
+    if (Nan::NewInstance(Nan::New(constructor)).ToLocal(&result)) {
+      (new SearchSessionWrapper(js_buffer, buffer, move(regex)))->Wrap(result);
+      return result;
+    } else {
+      return Nan::Null();
+    }
+  }
+
+ private:
+  SearchSessionWrapper(Local<Object> js_buffer, TextBuffer &buffer, shared_ptr<const Regex> regex) :
+    session(buffer, move(regex)) {
+    this->js_buffer.Reset(js_buffer);
+  }
+
+  static void get_matches(const Nan::FunctionCallbackInfo<Value> &info) {
+    auto &session = Nan::ObjectWrap::Unwrap<SearchSessionWrapper>(info.This())->session;
+    info.GetReturnValue().Set(encode_ranges(session.get_matches()));
+  }
+
+  static void get_matches_in_range(const Nan::FunctionCallbackInfo<Value> &info) {
+    auto &session = Nan::ObjectWrap::Unwrap<SearchSessionWrapper>(info.This())->session;
+    auto range = RangeWrapper::range_from_js(info[0]);
+    if (range) {
+      info.GetReturnValue().Set(encode_ranges(session.get_matches_in_range(*range)));
+    }
+  }
+
+  static void get_match_count(const Nan::FunctionCallbackInfo<Value> &info) {
+    auto &session = Nan::ObjectWrap::Unwrap<SearchSessionWrapper>(info.This())->session;
+    info.GetReturnValue().Set(Nan::New<Number>(session.match_count()));
+  }
+
+  static void update(const Nan::FunctionCallbackInfo<Value> &info) {
+    auto &session = Nan::ObjectWrap::Unwrap<SearchSessionWrapper>(info.This())->session;
+    auto update = session.update();
+    Local<Object> result = Nan::New<Object>();
+    Nan::Set(result, Nan::New("removed").ToLocalChecked(), encode_ranges(update.removed));
+    Nan::Set(result, Nan::New("added").ToLocalChecked(), encode_ranges(update.added));
+    info.GetReturnValue().Set(result);
+  }
+
+  Nan::Persistent<Object> js_buffer;
+  SearchSession session;
+};
+
+Nan::Persistent<Function> SearchSessionWrapper::constructor;
+
 void TextBufferWrapper::init(Local<Object> exports) {
   Local<FunctionTemplate> constructor_template = Nan::New<FunctionTemplate>(construct);
   constructor_template->SetClassName(Nan::New<String>("TextBuffer").ToLocalChecked());
@@ -201,6 +280,7 @@ void TextBufferWrapper::init(Local<Object> exports) {
   Nan::SetTemplate(prototype_template, Nan::New("getCharacterAtPosition").ToLocalChecked(), Nan::New<FunctionTemplate>(get_character_at_position), None);
   Nan::SetTemplate(prototype_template, Nan::New("getTextInRange").ToLocalChecked(), Nan::New<FunctionTemplate>(get_text_in_range), None);
   Nan::SetTemplate(prototype_template, Nan::New("setTextInRange").ToLocalChecked(), Nan::New<FunctionTemplate>(set_text_in_range), None);
+  Nan::SetTemplate(prototype_template, Nan::New("setTextInRanges").ToLocalChecked(), Nan::New<FunctionTemplate>(set_text_in_ranges), None);
   Nan::SetTemplate(prototype_template, Nan::New("getText").ToLocalChecked(), Nan::New<FunctionTemplate>(get_text), None);
   Nan::SetTemplate(prototype_template, Nan::New("setText").ToLocalChecked(), Nan::New<FunctionTemplate>(set_text), None);
   Nan::SetTemplate(prototype_template, Nan::New("lineForRow").ToLocalChecked(), Nan::New<FunctionTemplate>(line_for_row), None);
@@ -217,17 +297,21 @@ void TextBufferWrapper::init(Local<Object> exports) {
   Nan::SetTemplate(prototype_template, Nan::New("serializeChanges").ToLocalChecked(), Nan::New<FunctionTemplate>(serialize_changes), None);
   Nan::SetTemplate(prototype_template, Nan::New("deserializeChanges").ToLocalChecked(), Nan::New<FunctionTemplate>(deserialize_changes), None);
   Nan::SetTemplate(prototype_template, Nan::New("reset").ToLocalChecked(), Nan::New<FunctionTemplate>(reset), None);
+  Nan::SetTemplate(prototype_template, Nan::New("setConsolidationPolicy").ToLocalChecked(), Nan::New<FunctionTemplate>(set_consolidation_policy), None);
   Nan::SetTemplate(prototype_template, Nan::New("baseTextDigest").ToLocalChecked(), Nan::New<FunctionTemplate>(base_text_digest), None);
   Nan::SetTemplate(prototype_template, Nan::New("find").ToLocalChecked(), Nan::New<FunctionTemplate>(find), None);
   Nan::SetTemplate(prototype_template, Nan::New("findSync").ToLocalChecked(), Nan::New<FunctionTemplate>(find_sync), None);
   Nan::SetTemplate(prototype_template, Nan::New("findAll").ToLocalChecked(), Nan::New<FunctionTemplate>(find_all), None);
   Nan::SetTemplate(prototype_template, Nan::New("findAllSync").ToLocalChecked(), Nan::New<FunctionTemplate>(find_all_sync), None);
   Nan::SetTemplate(prototype_template, Nan::New("findAndMarkAllSync").ToLocalChecked(), Nan::New<FunctionTemplate>(find_and_mark_all_sync), None);
+  Nan::SetTemplate(prototype_template, Nan::New("createSearchSession").ToLocalChecked(), Nan::New<FunctionTemplate>(create_search_session), None);
   Nan::SetTemplate(prototype_template, Nan::New("findWordsWithSubsequenceInRange").ToLocalChecked(), Nan::New<FunctionTemplate>(find_words_with_subsequence_in_range), None);
   Nan::SetTemplate(prototype_template, Nan::New("getDotGraph").ToLocalChecked(), Nan::New<FunctionTemplate>(dot_graph), None);
   Nan::SetTemplate(prototype_template, Nan::New("getSnapshot").ToLocalChecked(), Nan::New<FunctionTemplate>(get_snapshot), None);
+  Nan::SetTemplate(constructor_template, Nan::New("getRegexCacheStats").ToLocalChecked(), Nan::New<FunctionTemplate>(get_regex_cache_stats), None);
   RegexWrapper::init();
   SubsequenceMatchWrapper::init();
+  SearchSessionWrapper::init();
   Nan::Set(exports, Nan::New("TextBuffer").ToLocalChecked(), Nan::GetFunction(constructor_template).ToLocalChecked());
 }
 
@@ -299,6 +383,37 @@ void TextBufferWrapper::set_text_in_range(const Nan::FunctionCallbackInfo<Value>
   }
 }
 
+void TextBufferWrapper::set_text_in_ranges(const Nan::FunctionCallbackInfo<Value> &info) {
+  auto text_buffer_wrapper = Nan::ObjectWrap::Unwrap<TextBufferWrapper>(info.This());
+  auto &text_buffer = text_buffer_wrapper->text_buffer;
+  if (!info[0]->IsArray() || !info[1]->IsArray()) {
+    Nan::ThrowTypeError("setTextInRanges requires an array of ranges and an array of strings");
+    return;
+  }
+
+  Local<Array> js_ranges = Local<Array>::Cast(info[0]);
+  Local<Array> js_texts = Local<Array>::Cast(info[1]);
+  if (js_ranges->Length() != js_texts->Length()) {
+    Nan::ThrowTypeError("setTextInRanges requires as many strings as ranges");
+    return;
+  }
+
+  vector<TextBuffer::Edit> edits;
+  edits.reserve(js_ranges->Length());
+  for (uint32_t i = 0, n = js_ranges->Length(); i < n; i++) {
+    auto range = RangeWrapper::range_from_js(Nan::Get(js_ranges, i).ToLocalChecked());
+    if (!range) return;
+    auto text = string_conversion::string_from_js(Nan::Get(js_texts, i).ToLocalChecked());
+    if (!text) return;
+    edits.push_back({*range, move(*text)});
+  }
+
+  text_buffer_wrapper->cancel_queued_workers();
+  if (!text_buffer.set_text_in_ranges(move(edits))) {
+    Nan::ThrowError("setTextInRanges requires sorted, non-overlapping ranges");
+  }
+}
+
 void TextBufferWrapper::set_text(const Nan::FunctionCallbackInfo<Value> &info) {
   auto text_buffer_wrapper = Nan::ObjectWrap::Unwrap<TextBufferWrapper>(info.This());
   text_buffer_wrapper->cancel_queued_workers();
@@ -395,7 +510,7 @@ static Local<Value> encode_ranges(const vector<Range> &ranges) {
 template <bool single_result>
 class TextBufferSearcher : public Nan::AsyncWorker {
   const TextBuffer::Snapshot *snapshot;
-  const Regex *regex;
+  shared_ptr<const Regex> regex;
   Range search_range;
   vector<Range> matches;
   Nan::Persistent<Value> argument;
@@ -403,12 +518,12 @@ class TextBufferSearcher : public Nan::AsyncWorker {
 public:
   TextBufferSearcher(Nan::Callback *completion_callback,
                      const TextBuffer::Snapshot *snapshot,
-                     const Regex *regex,
+                     shared_ptr<const Regex> regex,
                      const Range &search_range,
                      Local<Value> arg) :
     AsyncWorker(completion_callback, "TextBuffer.find"),
     snapshot{snapshot},
-    regex{regex},
+    regex{move(regex)},
     search_range(search_range) {
     argument.Reset(arg);
   }
@@ -433,7 +548,7 @@ public:
 
 void TextBufferWrapper::find_sync(const Nan::FunctionCallbackInfo<Value> &info) {
   auto &text_buffer = Nan::ObjectWrap::Unwrap<TextBufferWrapper>(info.This())->text_buffer;
-  const Regex *regex = RegexWrapper::regex_from_js(info[0]);
+  auto regex = RegexWrapper::regex_from_js(info[0]);
   if (regex) {
     optional<Range> search_range;
     if (info[1]->IsObject()) {
@@ -454,7 +569,7 @@ void TextBufferWrapper::find_sync(const Nan::FunctionCallbackInfo<Value> &info)
 
 void TextBufferWrapper::find_all_sync(const Nan::FunctionCallbackInfo<Value> &info) {
   auto &text_buffer = Nan::ObjectWrap::Unwrap<TextBufferWrapper>(info.This())->text_buffer;
-  const Regex *regex = RegexWrapper::regex_from_js(info[0]);
+  auto regex = RegexWrapper::regex_from_js(info[0]);
   if (regex) {
     optional<Range> search_range;
     if (info[1]->IsObject()) {
@@ -480,7 +595,7 @@ void TextBufferWrapper::find_and_mark_all_sync(const Nan::FunctionCallbackInfo<V
   if (!info[2]->IsBoolean()) return;
   bool exclusive = Nan::To<bool>(info[2]).FromMaybe(false);
 
-  const Regex *regex = RegexWrapper::regex_from_js(info[3]);
+  auto regex = RegexWrapper::regex_from_js(info[3]);
   if (regex) {
     optional<Range> search_range;
     if (info[4]->IsObject()) {
@@ -503,7 +618,7 @@ void TextBufferWrapper::find_and_mark_all_sync(const Nan::FunctionCallbackInfo<V
 void TextBufferWrapper::find(const Nan::FunctionCallbackInfo<Value> &info) {
   auto &text_buffer = Nan::ObjectWrap::Unwrap<TextBufferWrapper>(info.This())->text_buffer;
   auto callback = new Nan::Callback(info[1].As<Function>());
-  const Regex *regex = RegexWrapper::regex_from_js(info[0]);
+  auto regex = RegexWrapper::regex_from_js(info[0]);
   if (regex) {
     optional<Range> search_range;
     if (info[2]->IsObject()) {
@@ -523,7 +638,7 @@ void TextBufferWrapper::find(const Nan::FunctionCallbackInfo<Value> &info) {
 void TextBufferWrapper::find_all(const Nan::FunctionCallbackInfo<Value> &info) {
   auto &text_buffer = Nan::ObjectWrap::Unwrap<TextBufferWrapper>(info.This())->text_buffer;
   auto callback = new Nan::Callback(info[1].As<Function>());
-  const Regex *regex = RegexWrapper::regex_from_js(info[0]);
+  auto regex = RegexWrapper::regex_from_js(info[0]);
   if (regex) {
     optional<Range> search_range;
     if (info[2]->IsObject()) {
@@ -540,6 +655,24 @@ void TextBufferWrapper::find_all(const Nan::FunctionCallbackInfo<Value> &info) {
   }
 }
 
+void TextBufferWrapper::create_search_session(const Nan::FunctionCallbackInfo<Value> &info) {
+  auto &text_buffer = Nan::ObjectWrap::Unwrap<TextBufferWrapper>(info.This())->text_buffer;
+  auto regex = RegexWrapper::regex_from_js(info[0]);
+  if (regex) {
+    info.GetReturnValue().Set(SearchSessionWrapper::new_instance(info.This(), text_buffer, regex));
+  }
+}
+
+void TextBufferWrapper::get_regex_cache_stats(const Nan::FunctionCallbackInfo<Value> &info) {
+  auto stats = RegexCache::shared().stats();
+  Local<Object> result = Nan::New<Object>();
+  Nan::Set(result, Nan::New("hits").ToLocalChecked(), Nan::New<Number>(stats.hits));
+  Nan::Set(result, Nan::New("misses").ToLocalChecked(), Nan::New<Number>(stats.misses));
+  Nan::Set(result, Nan::New("entryCount").ToLocalChecked(), Nan::New<Number>(stats.entry_count));
+  Nan::Set(result, Nan::New("size").ToLocalChecked(), Nan::New<Number>(stats.size));
+  info.GetReturnValue().Set(result);
+}
+
 void TextBufferWrapper::find_words_with_subsequence_in_range(const Nan::FunctionCallbackInfo<v8::Value> &info) {
   class FindWordsWithSubsequenceInRangeWorker : public Nan::AsyncWorker, public CancellableWorker {
     Nan::Persistent<Object> buffer;
@@ -726,6 +859,77 @@ static u16string load_file(
   return loaded_string;
 }
 
+// Returns an empty optional without reading the file if it is too small or
+// uses an encoding that can't be decoded lazily.
+template <typename Callback>
+static optional<ChunkedText> load_file_lazily(
+  const string &file_name,
+  const string &encoding_name,
+  optional<Error> *error,
+  const Callback &callback
+) {
+  if (encoding_name != "UTF-8") return optional<ChunkedText>{};
+
+  FILE *file = open_file(file_name, "rb");
+  if (!file) {
+    *error = Error{errno, "open"};
+    return optional<ChunkedText>{};
+  }
+
+  size_t file_size = get_file_size(file);
+  if (file_size == static_cast<size_t>(-1)) {
+    *error = Error{errno, "stat"};
+    fclose(file);
+    return optional<ChunkedText>{};
+  }
+
+  if (file_size < MIN_LAZILY_LOADED_FILE_SIZE) {
+    fclose(file);
+    return optional<ChunkedText>{};
+  }
+
+  auto result = FileChunkSource::load(file, [&callback, file_size](size_t bytes_read) {
+    callback(100 * bytes_read / file_size);
+  });
+  if (!result) *error = Error{errno, "read"};
+  return result;
+}
+
+static bool file_matches_text(
+  const string &file_name,
+  const string &encoding_name,
+  const ChunkedText &text,
+  optional<Error> *error
+) {
+  auto conversion = transcoding_from(encoding_name.c_str());
+  if (!conversion) {
+    *error = Error{INVALID_ENCODING, nullptr};
+    return false;
+  }
+
+  FILE *file = open_file(file_name, "rb");
+  if (!file) {
+    *error = Error{errno, "open"};
+    return false;
+  }
+
+  size_t file_size = get_file_size(file);
+  if (file_size == static_cast<size_t>(-1)) {
+    *error = Error{errno, "stat"};
+    fclose(file);
+    return false;
+  }
+
+  bool result;
+  vector<char> input_buffer(CHUNK_SIZE);
+  if (!conversion->decode_and_compare(text, file, file_size, input_buffer, &result)) {
+    *error = Error{errno, "read"};
+  }
+
+  fclose(file);
+  return result;
+}
+
 class Loader {
   Nan::Callback *progress_callback;
   Nan::AsyncResource *async_resource;
@@ -734,6 +938,7 @@ class Loader {
   string file_name;
   string encoding_name;
   optional<Text> loaded_text;
+  optional<ChunkedText> lazily_loaded_text;
   optional<Error> error;
   Patch patch;
   bool force;
@@ -772,8 +977,13 @@ class Loader {
 
   template <typename Callback>
   void Execute(const Callback &callback) {
-    if (!loaded_text) loaded_text = Text{load_file(file_name, encoding_name, &error, callback)};
-    if (!error && compute_patch) patch = text_diff(snapshot->base_text(), *loaded_text);
+    if (!loaded_text && !compute_patch) {
+      lazily_loaded_text = load_file_lazily(file_name, encoding_name, &error, callback);
+    }
+    if (!loaded_text && !lazily_loaded_text && !error) {
+      loaded_text = Text{load_file(file_name, encoding_name, &error, callback)};
+    }
+    if (!error && compute_patch) patch = text_diff(snapshot->base_text().text(), *loaded_text);
   }
 
   pair<Local<Value>, Local<Value>> Finish(Nan::AsyncResource* caller_async_resource = nullptr) {
@@ -819,7 +1029,9 @@ class Loader {
       }
     }
 
-    if (has_changed) {
+    if (has_changed && lazily_loaded_text) {
+      buffer->reset(move(*lazily_loaded_text));
+    } else if (has_changed) {
       buffer->reset(move(*loaded_text));
     } else {
       buffer->flush_changes();
@@ -999,8 +1211,7 @@ class BaseTextComparisonWorker : public Nan::AsyncWorker {
     result{false} {}
 
   void Execute() {
-    u16string file_contents = load_file(file_name, encoding_name, &error, [](size_t progress) {});
-    result = std::equal(file_contents.begin(), file_contents.end(), snapshot->base_text().begin());
+    result = file_matches_text(file_name, encoding_name, snapshot->base_text(), &error);
   }
 
   void HandleOKCallback() {
@@ -1036,7 +1247,8 @@ void TextBufferWrapper::base_text_matches_file(const Nan::FunctionCallbackInfo<V
     ));
   } else {
     auto file_contents = Nan::ObjectWrap::Unwrap<TextWriter>(Nan::To<Object>(info[1]).ToLocalChecked())->get_text();
-    bool result = std::equal(file_contents.begin(), file_contents.end(), text_buffer.base_text().begin());
+    Text file_text{move(file_contents)};
+    bool result = text_buffer.base_text() == file_text;
     Local<Value> argv[] = {Nan::Null(), Nan::New<Boolean>(result)};
     auto callback = info[0].As<Function>();
     Nan::Call(callback, callback->CreationContext()->Global(), 2, argv);
@@ -1047,6 +1259,7 @@ class SaveWorker : public Nan::AsyncWorker {
   TextBuffer::Snapshot *snapshot;
   string file_name;
   string encoding_name;
+  optional<ChunkedText> flushed_text;
   optional<Error> error;
 
  public:
@@ -1064,6 +1277,21 @@ class SaveWorker : public Nan::AsyncWorker {
       return;
     }
 
+    // Build the text that the buffer will be flushed to here, rather than
+    // when the save finishes, so that the main thread only needs to swap it in.
+    flushed_text = snapshot->build_flushed_text();
+    vector<TextSlice> chunks = flushed_text ?
+      flushed_text->chunks() :
+      snapshot->chunks();
+
+    // Collecting the chunks reads any parts of a lazily loaded file that were
+    // not read yet, which must happen before the file is overwritten. If the
+    // file had changed since it was loaded, those parts can't be saved.
+    if (snapshot->has_read_error()) {
+      error = Error{EIO, "read"};
+      return;
+    }
+
     FILE *file = open_file(file_name, "wb+");
     if (!file) {
       error = Error{errno, "open"};
@@ -1071,7 +1299,7 @@ class SaveWorker : public Nan::AsyncWorker {
     }
 
     vector<char> output_buffer(CHUNK_SIZE);
-    for (TextSlice &chunk : snapshot->chunks()) {
+    for (TextSlice &chunk : chunks) {
       if (!conversion->encode(
         chunk.text->content,
         chunk.start_offset(),
@@ -1093,7 +1321,7 @@ class SaveWorker : public Nan::AsyncWorker {
       delete snapshot;
       return error_to_js(*error, encoding_name, file_name);
     } else {
-      snapshot->flush_preceding_changes();
+      snapshot->flush_preceding_changes(move(flushed_text));
       delete snapshot;
       return Nan::Null();
     }
@@ -1157,6 +1385,38 @@ void TextBufferWrapper::reset(const Nan::FunctionCallbackInfo<Value> &info) {
   }
 }
 
+// Reads one limit of a consolidation policy. Missing limits and limits of
+// Infinity never trigger consolidation.
+static optional<size_t> consolidation_limit_from_js(Local<Object> js_policy, const char *name) {
+  Local<Value> js_limit = Nan::Get(js_policy, Nan::New(name).ToLocalChecked()).ToLocalChecked();
+  if (js_limit->IsUndefined()) return SIZE_MAX;
+
+  auto limit = number_conversion::number_from_js<double>(js_limit);
+  if (!limit || !(*limit >= 0)) {
+    Nan::ThrowTypeError("Consolidation policy limits must be non-negative numbers");
+    return optional<size_t>{};
+  }
+  return *limit >= SIZE_MAX ? SIZE_MAX : static_cast<size_t>(*limit);
+}
+
+void TextBufferWrapper::set_consolidation_policy(const Nan::FunctionCallbackInfo<Value> &info) {
+  auto &text_buffer = Nan::ObjectWrap::Unwrap<TextBufferWrapper>(info.This())->text_buffer;
+  if (!info[0]->IsObject()) {
+    Nan::ThrowTypeError("setConsolidationPolicy requires an object");
+    return;
+  }
+
+  Local<Object> js_policy = Local<Object>::Cast(info[0]);
+  auto max_layer_count = consolidation_limit_from_js(js_policy, "maxLayerCount");
+  if (!max_layer_count) return;
+  auto max_change_count = consolidation_limit_from_js(js_policy, "maxChangeCount");
+  if (!max_change_count) return;
+  auto max_change_bytes = consolidation_limit_from_js(js_policy, "maxChangeBytes");
+  if (!max_change_bytes) return;
+
+  text_buffer.set_consolidation_policy({*max_layer_count, *max_change_count, *max_change_bytes});
+}
+
 void TextBufferWrapper::base_text_digest(const Nan::FunctionCallbackInfo<Value> &info) {
   auto &text_buffer = Nan::ObjectWrap::Unwrap<TextBufferWrapper>(info.This())->text_buffer;
   std::stringstream stream;
@@ -27,6 +27,7 @@ private:
   static void get_text_in_range(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void set_text(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void set_text_in_range(const Nan::FunctionCallbackInfo<v8::Value> &info);
+  static void set_text_in_ranges(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void line_for_row(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void line_length_for_row(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void line_ending_for_row(const Nan::FunctionCallbackInfo<v8::Value> &info);
@@ -38,6 +39,8 @@ private:
   static void find_all(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void find_all_sync(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void find_and_mark_all_sync(const Nan::FunctionCallbackInfo<v8::Value> &info);
+  static void create_search_session(const Nan::FunctionCallbackInfo<v8::Value> &info);
+  static void get_regex_cache_stats(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void find_words_with_subsequence_in_range(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void is_modified(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void load(const Nan::FunctionCallbackInfo<v8::Value> &info);
@@ -48,6 +51,7 @@ private:
   static void serialize_changes(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void deserialize_changes(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void reset(const Nan::FunctionCallbackInfo<v8::Value> &info);
+  static void set_consolidation_policy(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void base_text_digest(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void get_snapshot(const Nan::FunctionCallbackInfo<v8::Value> &info);
   static void dot_graph(const Nan::FunctionCallbackInfo<v8::Value> &info);
@@ -0,0 +1,456 @@
+#include "chunked-text.h"
+#include <algorithm>
+
+using std::move;
+using std::ostream;
+using std::pair;
+using std::u16string;
+using std::vector;
+
+uint32_t ChunkedText::MAX_CHUNK_SIZE = 64 * 1024;
+
+ChunkedText::Source::~Source() {}
+
+struct ChunkedText::LazyChunk {
+  std::shared_ptr<Source> source;
+  size_t index;
+  uint32_t size;
+  Point extent;
+  std::mutex mutex;
+  std::atomic<const Text *> text;
+  std::atomic<bool> failed;
+
+  LazyChunk(std::shared_ptr<Source> source, size_t index, uint32_t size, Point extent) :
+    source{move(source)}, index{index}, size{size}, extent{extent}, text{nullptr}, failed{false} {}
+
+  ~LazyChunk() {
+    delete text.load();
+  }
+
+  const Text &get_text() {
+    const Text *result = text.load();
+    if (result) return *result;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    result = text.load();
+    if (result) return *result;
+
+    Text loaded_text;
+    if (!source->read_chunk(index, loaded_text) ||
+        loaded_text.size() != size || loaded_text.extent() != extent) {
+      u16string content(size - extent.row - extent.column, 0xFFFD);
+      content.append(extent.row, '\n');
+      content.append(extent.column, 0xFFFD);
+      loaded_text = Text{move(content)};
+      failed = true;
+    }
+
+    // Once the chunk is read, it no longer keeps its source alive.
+    source.reset();
+    result = new Text(move(loaded_text));
+    text.store(result);
+    return *result;
+  }
+};
+
+const Text &ChunkedText::Chunk::get_text() const {
+  return text ? *text : lazy_chunk->get_text();
+}
+
+uint32_t ChunkedText::Chunk::size() const {
+  return text ? text->size() : lazy_chunk->size;
+}
+
+Point ChunkedText::Chunk::extent() const {
+  return text ? text->extent() : lazy_chunk->extent;
+}
+
+ChunkedText::ChunkedText() : size_{0}, has_read_error_{false} {}
+
+ChunkedText::ChunkedText(Text &&text) : size_{0}, has_read_error_{false} {
+  append_chunks(move(text));
+}
+
+ChunkedText::ChunkedText(const ChunkedText &other) :
+  chunks_{other.chunks_},
+  size_{other.size_},
+  extent_{other.extent_},
+  has_read_error_{other.has_read_error_} {
+  std::lock_guard<std::mutex> lock(other.digest_mutex);
+  digest_states = other.digest_states;
+}
+
+ChunkedText::ChunkedText(ChunkedText &&other) :
+  chunks_{move(other.chunks_)},
+  size_{other.size_},
+  extent_{other.extent_},
+  has_read_error_{other.has_read_error_},
+  digest_states{move(other.digest_states)} {
+  other.chunks_.clear();
+  other.size_ = 0;
+  other.extent_ = Point();
+  other.has_read_error_ = false;
+  other.digest_states.clear();
+}
+
+ChunkedText &ChunkedText::operator=(const ChunkedText &other) {
+  if (this != &other) {
+    chunks_ = other.chunks_;
+    size_ = other.size_;
+    extent_ = other.extent_;
+    has_read_error_ = other.has_read_error_;
+    std::lock_guard<std::mutex> lock(other.digest_mutex);
+    digest_states = other.digest_states;
+  }
+  return *this;
+}
+
+ChunkedText &ChunkedText::operator=(ChunkedText &&other) {
+  if (this != &other) {
+    chunks_ = move(other.chunks_);
+    size_ = other.size_;
+    extent_ = other.extent_;
+    has_read_error_ = other.has_read_error_;
+    digest_states = move(other.digest_states);
+    other.chunks_.clear();
+    other.size_ = 0;
+    other.extent_ = Point();
+    other.has_read_error_ = false;
+    other.digest_states.clear();
+  }
+  return *this;
+}
+
+size_t ChunkedText::chunk_index_for_position(Point position) const {
+  auto iter = std::upper_bound(
+    chunks_.begin(), chunks_.end(), position,
+    [](Point position, const Chunk &chunk) { return position < chunk.start_position; }
+  );
+  return iter == chunks_.begin() ? 0 : iter - chunks_.begin() - 1;
+}
+
+size_t ChunkedText::chunk_index_for_offset(uint32_t offset) const {
+  auto iter = std::upper_bound(
+    chunks_.begin(), chunks_.end(), offset,
+    [](uint32_t offset, const Chunk &chunk) { return offset < chunk.start_offset; }
+  );
+  return iter == chunks_.begin() ? 0 : iter - chunks_.begin() - 1;
+}
+
+void ChunkedText::append_chunk(std::shared_ptr<const Text> text) {
+  append_chunk(Chunk{move(text), nullptr, 0, Point()});
+}
+
+void ChunkedText::append_chunk(const Chunk &chunk) {
+  chunks_.push_back({chunk.text, chunk.lazy_chunk, size_, extent_});
+  size_ += chunk.size();
+  extent_ = extent_.traverse(chunk.extent());
+}
+
+void ChunkedText::append_lazy_chunk(std::shared_ptr<Source> source, size_t index,
+                                    uint32_t size, Point extent) {
+  append_chunk(Chunk{
+    nullptr,
+    std::make_shared<LazyChunk>(move(source), index, size, extent),
+    0,
+    Point()
+  });
+}
+
+// Divides the text into chunks of roughly equal size. The chunks are made one
+// character shorter than the maximum, so that a chunk boundary falling inside
+// a CRLF line ending can be moved past the '\n'.
+void ChunkedText::append_chunks(Text &&text) {
+  uint32_t size = text.size();
+  if (size == 0) return;
+  if (size <= MAX_CHUNK_SIZE) {
+    append_chunk(std::make_shared<const Text>(move(text)));
+    return;
+  }
+
+  uint32_t target_chunk_size = std::max<uint32_t>(MAX_CHUNK_SIZE - 1, 1);
+  uint32_t chunk_count = (static_cast<uint64_t>(size) + target_chunk_size - 1) / target_chunk_size;
+  uint32_t start = 0;
+  Point start_position;
+  for (uint32_t index = 1; index <= chunk_count; index++) {
+    uint32_t end = static_cast<uint64_t>(size) * index / chunk_count;
+    if (end < size && text.at(end - 1) == '\r' && text.at(end) == '\n') end++;
+    if (end <= start) continue;
+    Point end_position = text.position_for_offset(end, 0, false);
+    append_chunk(std::make_shared<const Text>(TextSlice(&text, start_position, end_position)));
+    start = end;
+    start_position = end_position;
+  }
+}
+
+void ChunkedText::append_range(Text &result, uint32_t start_offset, uint32_t end_offset) const {
+  if (start_offset >= end_offset) return;
+  for (size_t index = chunk_index_for_offset(start_offset); start_offset < end_offset; index++) {
+    const Chunk &chunk = chunks_[index];
+    const Text &text = chunk.get_text();
+    uint32_t slice_end_offset = std::min(end_offset, chunk.start_offset + text.size());
+    result.append(TextSlice(
+      &text,
+      text.position_for_offset(start_offset - chunk.start_offset, 0, false),
+      text.position_for_offset(slice_end_offset - chunk.start_offset, 0, false)
+    ));
+    start_offset = slice_end_offset;
+  }
+}
+
+void ChunkedText::splice(Point start, Point deletion_extent, TextSlice inserted_slice) {
+  splice(vector<Splice>{{start, start.traverse(deletion_extent), inserted_slice}});
+}
+
+void ChunkedText::splice(const vector<Splice> &splices) {
+  if (splices.empty()) return;
+
+  vector<pair<uint32_t, uint32_t>> splice_offsets;
+  splice_offsets.reserve(splices.size());
+  for (const Splice &splice : splices) {
+    splice_offsets.push_back({offset_for_position(splice.old_start), offset_for_position(splice.old_end)});
+  }
+
+  // Each splice replaces the chunks containing the characters on either side
+  // of it. Those characters are unchanged, so the boundaries of the new chunks
+  // can't fall inside a CRLF line ending. Splices that replace the same
+  // chunks are applied together, and replacements that would leave a chunk
+  // much shorter than the maximum absorb a neighboring chunk.
+  auto first_chunk_index_for_splice = [this](uint32_t start_offset) {
+    return start_offset > 0 ? chunk_index_for_offset(start_offset - 1) : 0;
+  };
+  auto end_chunk_index_for_splice = [this](uint32_t end_offset) {
+    return end_offset < size_ ? chunk_index_for_offset(end_offset) + 1 : chunks_.size();
+  };
+  auto chunk_start_offset = [this](size_t index) {
+    return index < chunks_.size() ? chunks_[index].start_offset : size_;
+  };
+
+  ChunkedText result;
+  result.chunks_.reserve(chunks_.size() + 1);
+  size_t next_chunk_index = 0;
+  size_t first_replaced_chunk_index = chunks_.size();
+  size_t splice_index = 0;
+  while (splice_index < splices.size()) {
+    size_t start_chunk_index = first_chunk_index_for_splice(splice_offsets[splice_index].first);
+    size_t end_chunk_index = end_chunk_index_for_splice(splice_offsets[splice_index].second);
+    size_t end_splice_index = splice_index;
+    int64_t size_delta = 0;
+    for (;;) {
+      while (end_splice_index < splices.size() &&
+             (end_splice_index == splice_index ||
+              first_chunk_index_for_splice(splice_offsets[end_splice_index].first) < end_chunk_index)) {
+        const auto &offsets = splice_offsets[end_splice_index];
+        end_chunk_index = std::max(end_chunk_index, end_chunk_index_for_splice(offsets.second));
+        size_delta += static_cast<int64_t>(splices[end_splice_index].new_text.size()) -
+          (offsets.second - offsets.first);
+        end_splice_index++;
+      }
+
+      int64_t new_size = chunk_start_offset(end_chunk_index) -
+        chunk_start_offset(start_chunk_index) + size_delta;
+      if (new_size >= MAX_CHUNK_SIZE / 4) break;
+      if (end_chunk_index < chunks_.size()) {
+        end_chunk_index++;
+      } else if (start_chunk_index > next_chunk_index) {
+        start_chunk_index--;
+      } else {
+        break;
+      }
+    }
+
+    for (; next_chunk_index < start_chunk_index; next_chunk_index++) {
+      result.append_chunk(chunks_[next_chunk_index]);
+    }
+    if (first_replaced_chunk_index == chunks_.size()) {
+      first_replaced_chunk_index = start_chunk_index;
+    }
+
+    Text replacement;
+    uint32_t offset = chunk_start_offset(start_chunk_index);
+    for (; splice_index < end_splice_index; splice_index++) {
+      append_range(replacement, offset, splice_offsets[splice_index].first);
+      replacement.append(splices[splice_index].new_text);
+      offset = splice_offsets[splice_index].second;
+    }
+    append_range(replacement, offset, chunk_start_offset(end_chunk_index));
+    result.append_chunks(move(replacement));
+    for (size_t index = start_chunk_index; index < end_chunk_index; index++) {
+      const Chunk &chunk = chunks_[index];
+      if (chunk.lazy_chunk && chunk.lazy_chunk->failed) result.has_read_error_ = true;
+    }
+    next_chunk_index = end_chunk_index;
+  }
+
+  for (; next_chunk_index < chunks_.size(); next_chunk_index++) {
+    result.append_chunk(chunks_[next_chunk_index]);
+  }
+
+  chunks_ = move(result.chunks_);
+  size_ = result.size_;
+  extent_ = result.extent_;
+  if (result.has_read_error_) has_read_error_ = true;
+
+  std::lock_guard<std::mutex> lock(digest_mutex);
+  if (digest_states.size() > first_replaced_chunk_index) {
+    digest_states.resize(first_replaced_chunk_index);
+  }
+}
+
+uint16_t ChunkedText::at(Point position) const {
+  if (chunks_.empty()) return 0;
+  const Chunk &chunk = chunks_[chunk_index_for_position(position)];
+  return chunk.get_text().at(position.traversal(chunk.start_position));
+}
+
+uint16_t ChunkedText::at(uint32_t offset) const {
+  if (chunks_.empty()) return 0;
+  const Chunk &chunk = chunks_[chunk_index_for_offset(offset)];
+  return chunk.get_text().at(offset - chunk.start_offset);
+}
+
+ClipResult ChunkedText::clip_position(Point position) const {
+  if (chunks_.empty()) return {Point(), 0};
+  const Chunk &chunk = chunks_[chunk_index_for_position(position)];
+  ClipResult result = chunk.get_text().clip_position(position.traversal(chunk.start_position));
+  return {
+    chunk.start_position.traverse(result.position),
+    chunk.start_offset + result.offset
+  };
+}
+
+uint32_t ChunkedText::offset_for_position(Point position) const {
+  return clip_position(position).offset;
+}
+
+Point ChunkedText::position_for_offset(uint32_t offset) const {
+  if (chunks_.empty()) return Point();
+  const Chunk &chunk = chunks_[chunk_index_for_offset(offset)];
+  return chunk.start_position.traverse(
+    chunk.get_text().position_for_offset(offset - chunk.start_offset)
+  );
+}
+
+uint32_t ChunkedText::line_length_for_row(uint32_t row) const {
+  return clip_position(Point{row, UINT32_MAX}).position.column;
+}
+
+Point ChunkedText::extent() const {
+  return extent_;
+}
+
+uint32_t ChunkedText::size() const {
+  return size_;
+}
+
+bool ChunkedText::empty() const {
+  return size_ == 0;
+}
+
+size_t ChunkedText::chunk_count() const {
+  return chunks_.size();
+}
+
+vector<TextSlice> ChunkedText::chunks() const {
+  vector<TextSlice> result;
+  result.reserve(chunks_.size());
+  for (const Chunk &chunk : chunks_) {
+    result.push_back(TextSlice(chunk.get_text()));
+  }
+  return result;
+}
+
+Text ChunkedText::text_in_range(Range range) const {
+  Text result;
+  for_each_chunk_in_range(
+    clip_position(range.start).position,
+    clip_position(range.end).position,
+    [&result](TextSlice slice) {
+      result.append(slice);
+      return false;
+    }
+  );
+  return result;
+}
+
+Text ChunkedText::text() const {
+  Text result;
+  result.reserve(size_, extent_.row + 1);
+  for (const Chunk &chunk : chunks_) {
+    result.append(TextSlice(chunk.get_text()));
+  }
+  return result;
+}
+
+size_t ChunkedText::digest() const {
+  std::lock_guard<std::mutex> lock(digest_mutex);
+  size_t result = digest_states.empty() ? 0 : digest_states.back();
+  for (size_t index = digest_states.size(); index < chunks_.size(); index++) {
+    result = Text::extend_digest(result, TextSlice(chunks_[index].get_text()));
+    digest_states.push_back(result);
+  }
+  return result;
+}
+
+bool ChunkedText::matches(uint32_t offset, TextSlice slice) const {
+  uint32_t slice_size = slice.size();
+  if (offset > size_ || slice_size > size_ - offset) return false;
+
+  uint32_t compared_size = 0;
+  for (size_t index = chunk_index_for_offset(offset); compared_size < slice_size; index++) {
+    const Chunk &chunk = chunks_[index];
+    uint32_t chunk_offset = offset + compared_size - chunk.start_offset;
+    const Text &text = chunk.get_text();
+    uint32_t count = std::min(text.size() - chunk_offset, slice_size - compared_size);
+    if (slice.text != &text || slice.start_offset() + compared_size != chunk_offset) {
+      auto slice_begin = slice.begin() + compared_size;
+      if (!std::equal(slice_begin, slice_begin + count, text.begin() + chunk_offset)) {
+        return false;
+      }
+    }
+    compared_size += count;
+  }
+  return true;
+}
+
+bool ChunkedText::has_read_error() const {
+  if (has_read_error_) return true;
+  for (const Chunk &chunk : chunks_) {
+    if (chunk.lazy_chunk && chunk.lazy_chunk->failed) return true;
+  }
+  return false;
+}
+
+bool ChunkedText::operator==(const ChunkedText &other) const {
+  if (size_ != other.size_) return false;
+  for (const Chunk &chunk : chunks_) {
+    if (!other.matches(chunk.start_offset, TextSlice(chunk.get_text()))) return false;
+  }
+  return true;
+}
+
+bool ChunkedText::operator!=(const ChunkedText &other) const {
+  return !(*this == other);
+}
+
+bool ChunkedText::operator==(const Text &other) const {
+  if (size_ != other.size()) return false;
+  for (const Chunk &chunk : chunks_) {
+    const Text &text = chunk.get_text();
+    if (!std::equal(text.begin(), text.end(), other.begin() + chunk.start_offset)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ChunkedText::operator!=(const Text &other) const {
+  return !(*this == other);
+}
+
+ostream &operator<<(ostream &stream, const ChunkedText &text) {
+  for (const auto &chunk : text.chunks_) {
+    stream << chunk.get_text();
+  }
+  return stream;
+}
@@ -0,0 +1,146 @@
+#ifndef SUPERSTRING_CHUNKED_TEXT_H
+#define SUPERSTRING_CHUNKED_TEXT_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include "point.h"
+#include "range.h"
+#include "text.h"
+#include "text-slice.h"
+
+// A text stored as a sequence of immutable chunks, each holding at most
+// MAX_CHUNK_SIZE characters. Positions and offsets are found by a binary
+// search over the chunks' starting points, and splicing rebuilds only the
+// chunks around each change. Copies of a text share all of their chunks, so
+// a large text never needs to be allocated, copied or moved in one piece.
+//
+// A chunk never ends between the '\r' and '\n' of a CRLF line ending, so
+// every line ending can be found within a single chunk.
+//
+// Chunks can also be appended lazily, with only their size and extent known
+// up front. Their characters are requested from a Source the first time they
+// are needed, so the parts of a text that are never read are never decoded.
+class ChunkedText {
+ public:
+  static uint32_t MAX_CHUNK_SIZE;
+
+  class Source {
+   public:
+    virtual ~Source();
+
+    // Reads the characters of the lazily appended chunk with the given index.
+    // Returns false if they can no longer be read as they were when the chunk
+    // was appended. May be called from several threads at once.
+    virtual bool read_chunk(size_t index, Text &result) = 0;
+  };
+
+  struct Splice {
+    Point old_start;
+    Point old_end;
+    TextSlice new_text;
+  };
+
+  ChunkedText();
+  explicit ChunkedText(Text &&);
+  ChunkedText(const ChunkedText &);
+  ChunkedText(ChunkedText &&);
+  ChunkedText &operator=(const ChunkedText &);
+  ChunkedText &operator=(ChunkedText &&);
+
+  void splice(Point start, Point deletion_extent, TextSlice inserted_slice);
+
+  // Applies several splices in one pass. The splices must be sorted and
+  // must not overlap, and their positions refer to the text before any of
+  // them is applied.
+  void splice(const std::vector<Splice> &);
+
+  // Appends a chunk whose characters are read from the source when they are
+  // first needed. The chunk must be non-empty, must hold at most
+  // MAX_CHUNK_SIZE characters and must not end with a '\r' unless it is the
+  // last chunk. If the source fails to produce characters of the given size
+  // and extent, the chunk is filled with replacement characters instead.
+  void append_lazy_chunk(std::shared_ptr<Source>, size_t index, uint32_t size, Point extent);
+
+  // Checks whether any chunk of this text, or any chunk that a splice has
+  // combined into it, was replaced because its source failed to read it.
+  bool has_read_error() const;
+
+  uint16_t at(Point position) const;
+  uint16_t at(uint32_t offset) const;
+  ClipResult clip_position(Point) const;
+  uint32_t offset_for_position(Point) const;
+  Point position_for_offset(uint32_t offset) const;
+  uint32_t line_length_for_row(uint32_t row) const;
+  Point extent() const;
+  uint32_t size() const;
+  bool empty() const;
+  size_t chunk_count() const;
+  std::vector<TextSlice> chunks() const;
+  Text text_in_range(Range) const;
+  Text text() const;
+  size_t digest() const;
+
+  // Checks whether the characters starting at the given offset match the
+  // slice, without comparing them if the slice refers to those characters.
+  bool matches(uint32_t offset, TextSlice) const;
+
+  // Calls the callback with a slice of each chunk that overlaps the given
+  // range, until it returns true. Returns whether the callback returned true.
+  template <typename Callback>
+  bool for_each_chunk_in_range(Point start, Point end, const Callback &callback) const {
+    if (!(start < end)) return false;
+    for (size_t index = chunk_index_for_position(start); index < chunks_.size(); index++) {
+      const Chunk &chunk = chunks_[index];
+      if (end <= chunk.start_position) break;
+      TextSlice slice = TextSlice(chunk.get_text()).slice({
+        chunk.start_position < start ? start.traversal(chunk.start_position) : Point(),
+        end.traversal(chunk.start_position)
+      });
+      if (!slice.empty() && callback(slice)) return true;
+    }
+    return false;
+  }
+
+  bool operator==(const ChunkedText &) const;
+  bool operator!=(const ChunkedText &) const;
+  bool operator==(const Text &) const;
+  bool operator!=(const Text &) const;
+
+  friend std::ostream &operator<<(std::ostream &, const ChunkedText &);
+
+ private:
+  struct LazyChunk;
+
+  struct Chunk {
+    std::shared_ptr<const Text> text;
+    std::shared_ptr<LazyChunk> lazy_chunk;
+    uint32_t start_offset;
+    Point start_position;
+
+    const Text &get_text() const;
+    uint32_t size() const;
+    Point extent() const;
+  };
+
+  std::vector<Chunk> chunks_;
+  uint32_t size_;
+  Point extent_;
+  bool has_read_error_;
+
+  // The state of the digest at the end of each of the leading chunks. A
+  // splice discards only the states following the first chunk it replaces.
+  mutable std::mutex digest_mutex;
+  mutable std::vector<size_t> digest_states;
+
+  size_t chunk_index_for_position(Point) const;
+  size_t chunk_index_for_offset(uint32_t) const;
+  void append_chunk(std::shared_ptr<const Text>);
+  void append_chunk(const Chunk &);
+  void append_chunks(Text &&);
+  void append_range(Text &, uint32_t start_offset, uint32_t end_offset) const;
+};
+
+#endif  // SUPERSTRING_CHUNKED_TEXT_H
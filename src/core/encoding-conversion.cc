@@ -1,8 +1,14 @@
 #include "encoding-conversion.h"
+#include "text-slice.h"
 #include "utf8-conversions.h"
+#include <algorithm>
 #include <iconv.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using std::function;
 using std::u16string;
 using std::vector;
@@ -64,53 +70,134 @@ EncodingConversion::~EncodingConversion() {
   if (data) iconv_close(data);
 }
 
+// Copies the longest run of ASCII characters at the start of the input that
+// fits in the output, widening or narrowing each one, and returns its length.
+static size_t copy_ascii(const uint8_t *input, size_t input_length,
+                         uint16_t *output, size_t output_length) {
+  size_t count = input_length < output_length ? input_length : output_length;
+  size_t i = 0;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i));
+    if (_mm_movemask_epi8(bytes) != 0) break;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i), _mm_unpacklo_epi8(bytes, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i + 8), _mm_unpackhi_epi8(bytes, zero));
+  }
+#endif
+
+  for (; i < count && input[i] < 0x80; i++) output[i] = input[i];
+  return i;
+}
+
+static size_t copy_ascii(const uint16_t *input, size_t input_length,
+                         uint8_t *output, size_t output_length) {
+  size_t count = input_length < output_length ? input_length : output_length;
+  size_t i = 0;
+
+#ifdef __SSE2__
+  const __m128i non_ascii_bits = _mm_set1_epi16(static_cast<short>(0xFF80));
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16) {
+    __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i));
+    __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i + 8));
+    __m128i non_ascii = _mm_and_si128(_mm_or_si128(low, high), non_ascii_bits);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(non_ascii, zero)) != 0xFFFF) break;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i), _mm_packus_epi16(low, high));
+  }
+#endif
+
+  for (; i < count && input[i] < 0x80; i++) output[i] = static_cast<uint8_t>(input[i]);
+  return i;
+}
+
+// Both transcoders below copy ASCII runs directly and hand everything else to
+// the libc++ routines. Each call to those routines is limited to the non-ASCII
+// run plus enough input to complete the longest sequence that can start inside
+// it, so that they report errors and incomplete sequences exactly as they would
+// if given the whole input.
+static int convert_utf8_to_utf16(const uint8_t *&input, const uint8_t *input_end,
+                                 uint16_t *&output, uint16_t *output_end) {
+  const size_t max_sequence_length = 4;
+
+  for (;;) {
+    size_t ascii_length = copy_ascii(input, input_end - input, output, output_end - output);
+    input += ascii_length;
+    output += ascii_length;
+    if (input == input_end) return Ok;
+    if (output == output_end) return InvalidTrailing;
+
+    const uint8_t *run_end = input;
+    while (run_end < input_end && *run_end >= 0x80) run_end++;
+    const uint8_t *window_end = static_cast<size_t>(input_end - run_end) > max_sequence_length - 1 ?
+      run_end + max_sequence_length - 1 :
+      input_end;
+
+    const uint8_t *window_start = input;
+    int result = utf8_to_utf16(input, window_end, input, output, output_end, output);
+    if (result == transcode_result::error) return Invalid;
+    if (result == transcode_result::partial && (window_end == input_end || input == window_start)) {
+      return (input == input_end) ? Partial : InvalidTrailing;
+    }
+  }
+}
+
+static int convert_utf16_to_utf8(const uint16_t *&input, const uint16_t *input_end,
+                                 uint8_t *&output, uint8_t *output_end) {
+  const size_t max_sequence_length = 2;
+
+  for (;;) {
+    size_t ascii_length = copy_ascii(input, input_end - input, output, output_end - output);
+    input += ascii_length;
+    output += ascii_length;
+    if (input == input_end) return Ok;
+    if (output == output_end) return InvalidTrailing;
+
+    const uint16_t *run_end = input;
+    while (run_end < input_end && *run_end >= 0x80) run_end++;
+    const uint16_t *window_end = static_cast<size_t>(input_end - run_end) > max_sequence_length - 1 ?
+      run_end + max_sequence_length - 1 :
+      input_end;
+
+    const uint16_t *window_start = input;
+    int result = utf16_to_utf8(input, window_end, input, output, output_end, output);
+    if (result == transcode_result::error) return Invalid;
+    if (result == transcode_result::partial && (window_end == input_end || input == window_start)) {
+      return (input == input_end) ? Partial : InvalidTrailing;
+    }
+  }
+}
+
 int EncodingConversion::convert(
   const char **input, const char *input_end, char **output, char *output_end) const {
   switch (mode) {
     case UTF8_TO_UTF16: {
-      const uint8_t *next_input;
-      uint16_t *next_output;
-      int result = utf8_to_utf16(
-        reinterpret_cast<const uint8_t *>(*input),
-        reinterpret_cast<const uint8_t *>(input_end),
+      auto next_input = reinterpret_cast<const uint8_t *>(*input);
+      auto next_output = reinterpret_cast<uint16_t *>(*output);
+      int result = convert_utf8_to_utf16(
         next_input,
-        reinterpret_cast<uint16_t *>(*output),
-        reinterpret_cast<uint16_t *>(output_end),
-        next_output
+        reinterpret_cast<const uint8_t *>(input_end),
+        next_output,
+        reinterpret_cast<uint16_t *>(output_end)
       );
       *input = reinterpret_cast<const char *>(next_input);
       *output = reinterpret_cast<char *>(next_output);
-      switch (result) {
-        case transcode_result::ok:
-          return Ok;
-        case transcode_result::partial:
-          return (*input == input_end) ? Partial : InvalidTrailing;
-        case transcode_result::error:
-          return Invalid;
-      }
+      return result;
     }
 
     case UTF16_TO_UTF8: {
-      const uint16_t *next_input;
-      uint8_t *next_output;
-      int result = utf16_to_utf8(
-        reinterpret_cast<const uint16_t *>(*input),
-        reinterpret_cast<const uint16_t *>(input_end),
+      auto next_input = reinterpret_cast<const uint16_t *>(*input);
+      auto next_output = reinterpret_cast<uint8_t *>(*output);
+      int result = convert_utf16_to_utf8(
         next_input,
-        reinterpret_cast<uint8_t *>(*output),
-        reinterpret_cast<uint8_t *>(output_end),
-        next_output
+        reinterpret_cast<const uint16_t *>(input_end),
+        next_output,
+        reinterpret_cast<uint8_t *>(output_end)
       );
       *input = reinterpret_cast<const char *>(next_input);
       *output = reinterpret_cast<char *>(next_output);
-      switch (result) {
-        case transcode_result::ok:
-          return Ok;
-        case transcode_result::partial:
-          return (*input == input_end) ? Partial : InvalidTrailing;
-        case transcode_result::error:
-          return Invalid;
-      }
+      return result;
     }
 
     default: {
@@ -237,6 +324,85 @@ size_t EncodingConversion::decode(u16string &string, const char *input_start,
   return input_pointer - input_start;
 }
 
+// Decodes the stream one buffer at a time, comparing each decoded chunk with
+// the corresponding part of the given string, so that a mismatch can be
+// detected without decoding the rest of the stream. Sets `result` to whether
+// the stream's decoded content equals the string, and returns false if the
+// stream could not be read.
+bool EncodingConversion::decode_and_compare(const u16string &string, FILE *stream,
+                                            size_t stream_size, vector<char> &input_vector,
+                                            bool *result) {
+  return decode_and_compare(
+    string.size(),
+    [&string](size_t offset, const u16string &decoded_chunk) {
+      return std::equal(decoded_chunk.begin(), decoded_chunk.end(), string.begin() + offset);
+    },
+    stream, stream_size, input_vector, result
+  );
+}
+
+bool EncodingConversion::decode_and_compare(const ChunkedText &text, FILE *stream,
+                                            size_t stream_size, vector<char> &input_vector,
+                                            bool *result) {
+  return decode_and_compare(
+    text.size(),
+    [&text](size_t offset, const u16string &decoded_chunk) {
+      Text decoded_text{decoded_chunk};
+      return text.matches(offset, TextSlice(decoded_text));
+    },
+    stream, stream_size, input_vector, result
+  );
+}
+
+bool EncodingConversion::decode_and_compare(size_t size, const CompareCallback &matches,
+                                            FILE *stream, size_t stream_size,
+                                            vector<char> &input_vector, bool *result) {
+  *result = false;
+
+  // Each UTF-16 code unit decoded from UTF-8 takes between one and three
+  // bytes, so many mismatches can be detected from the size alone.
+  if (mode == UTF8_TO_UTF16 &&
+      (size > stream_size || size * 3 < stream_size)) {
+    return true;
+  }
+
+  u16string decoded_chunk;
+  char *input_buffer = input_vector.data();
+  size_t bytes_left_over = 0;
+  size_t characters_compared = 0;
+
+  for (;;) {
+    size_t bytes_to_read = input_vector.size() - bytes_left_over;
+    size_t bytes_read = fread(input_buffer + bytes_left_over, 1, bytes_to_read, stream);
+    if (bytes_read < bytes_to_read && ferror(stream)) return false;
+    size_t bytes_to_append = bytes_left_over + bytes_read;
+    if (bytes_to_append == 0) break;
+
+    decoded_chunk.clear();
+    size_t bytes_appended = decode(
+      decoded_chunk,
+      input_buffer,
+      bytes_to_append,
+      bytes_read == 0
+    );
+
+    if (decoded_chunk.size() > size - characters_compared ||
+        !matches(characters_compared, decoded_chunk)) {
+      return true;
+    }
+    characters_compared += decoded_chunk.size();
+
+    if (bytes_appended < bytes_to_append) {
+      std::copy(input_buffer + bytes_appended, input_buffer + bytes_to_append, input_buffer);
+    }
+
+    bytes_left_over = bytes_to_append - bytes_appended;
+  }
+
+  *result = characters_compared == size;
+  return true;
+}
+
 bool EncodingConversion::encode(const u16string &string, size_t start_offset,
                                 size_t end_offset, FILE *stream,
                                 vector<char> &output_vector) {
@@ -1,6 +1,7 @@
 #ifndef SUPERSTRING_ENCODING_CONVERSION_H_
 #define SUPERSTRING_ENCODING_CONVERSION_H_
 
+#include "chunked-text.h"
 #include "optional.h"
 #include "text.h"
 #include <stdio.h>
@@ -12,6 +13,10 @@ class EncodingConversion {
   EncodingConversion(int, void *);
   int convert(const char **, const char *, char **, char *) const;
 
+  using CompareCallback = std::function<bool(size_t, const std::u16string &)>;
+  bool decode_and_compare(size_t size, const CompareCallback &, FILE *stream,
+                          size_t stream_size, std::vector<char> &buffer, bool *result);
+
  public:
   EncodingConversion(EncodingConversion &&);
   EncodingConversion();
@@ -25,6 +30,10 @@ class EncodingConversion {
               std::function<void(size_t)> progress_callback);
   size_t decode(std::u16string &, const char *buffer, size_t buffer_size,
                 bool is_last = false);
+  bool decode_and_compare(const std::u16string &, FILE *stream, size_t stream_size,
+                          std::vector<char> &buffer, bool *result);
+  bool decode_and_compare(const ChunkedText &, FILE *stream, size_t stream_size,
+                          std::vector<char> &buffer, bool *result);
 
   friend optional<EncodingConversion> transcoding_to(const char *);
   friend optional<EncodingConversion> transcoding_from(const char *);
@@ -0,0 +1,112 @@
+#include "file-chunk-source.h"
+#include <string.h>
+
+using std::function;
+using std::move;
+using std::u16string;
+
+static int seek(FILE *file, int64_t offset) {
+#ifdef WIN32
+  return _fseeki64(file, offset, SEEK_SET);
+#else
+  return fseeko(file, offset, SEEK_SET);
+#endif
+}
+
+// A fast hash of a chunk's bytes, used to detect whether the file has changed
+// since it was scanned.
+static uint64_t checksum(const char *data, size_t size) {
+  uint64_t result = 0xcbf29ce484222325;
+  size_t index = 0;
+  for (; index + sizeof(uint64_t) <= size; index += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + index, sizeof(uint64_t));
+    result = (result ^ word) * 0x100000001b3;
+  }
+  for (; index < size; index++) {
+    result = (result ^ static_cast<uint8_t>(data[index])) * 0x100000001b3;
+  }
+  return result;
+}
+
+optional<ChunkedText> FileChunkSource::load(FILE *file, const function<void(size_t)> &progress_callback) {
+  auto source = std::make_shared<FileChunkSource>(file, move(*transcoding_from("UTF-8")));
+  ChunkedText result;
+  u16string decoded;
+  size_t block_size = ChunkedText::MAX_CHUNK_SIZE;
+  int64_t start = 0;
+
+  for (;;) {
+    size_t bytes_read;
+    if (!source->read_bytes(start, block_size, &bytes_read)) return optional<ChunkedText>{};
+    if (bytes_read == 0) break;
+
+    ChunkLocation location{
+      start,
+      static_cast<uint32_t>(bytes_read),
+      bytes_read < block_size,
+      checksum(source->buffer.data(), bytes_read)
+    };
+    decoded.clear();
+    size_t byte_count = source->decode_block(location, decoded);
+    source->chunk_locations.push_back(location);
+    result.append_lazy_chunk(source, source->chunk_locations.size() - 1, decoded.size(), Text::extent(decoded));
+
+    start += byte_count;
+    progress_callback(start);
+  }
+
+  return result;
+}
+
+FileChunkSource::FileChunkSource(FILE *file, EncodingConversion &&conversion) :
+  file{file}, conversion{move(conversion)}, read_chunk_count{0} {}
+
+FileChunkSource::~FileChunkSource() {
+  if (file) fclose(file);
+}
+
+bool FileChunkSource::read_bytes(int64_t start, size_t byte_count, size_t *bytes_read) {
+  if (!file || seek(file, start) != 0) return false;
+  buffer.resize(byte_count);
+  *bytes_read = fread(buffer.data(), 1, byte_count, file);
+  return *bytes_read == byte_count || !ferror(file);
+}
+
+// Decodes the complete characters at the start of the block, which has been
+// read into the buffer, returning the number of bytes they take up. How the
+// block's last few bytes are decoded can depend on the bytes that follow, so
+// a chunk is always decoded from the same block as when the file was scanned.
+size_t FileChunkSource::decode_block(const ChunkLocation &location, u16string &result) {
+  size_t byte_count = conversion.decode(result, buffer.data(), location.byte_count, location.is_last);
+
+  // Leave a trailing '\r' for the next chunk, in case it begins a CRLF.
+  if (!location.is_last && result.size() > 1 && result.back() == '\r') {
+    result.pop_back();
+    byte_count--;
+  }
+  return byte_count;
+}
+
+bool FileChunkSource::read_chunk(size_t index, Text &result) {
+  std::lock_guard<std::mutex> lock(mutex);
+  const ChunkLocation &location = chunk_locations[index];
+
+  size_t bytes_read;
+  u16string decoded;
+  bool succeeded =
+    read_bytes(location.start, location.byte_count, &bytes_read) &&
+    bytes_read == location.byte_count &&
+    checksum(buffer.data(), bytes_read) == location.checksum;
+  if (succeeded) decode_block(location, decoded);
+
+  // Each chunk is read at most once, so the file can be closed after the last.
+  if (++read_chunk_count == chunk_locations.size()) {
+    fclose(file);
+    file = nullptr;
+    buffer = std::vector<char>();
+  }
+
+  if (succeeded) result = Text{move(decoded)};
+  return succeeded;
+}
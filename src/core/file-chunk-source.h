@@ -0,0 +1,52 @@
+#ifndef SUPERSTRING_FILE_CHUNK_SOURCE_H
+#define SUPERSTRING_FILE_CHUNK_SOURCE_H
+
+#include <functional>
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+#include "chunked-text.h"
+#include "encoding-conversion.h"
+#include "optional.h"
+
+// Reads the chunks of a lazily loaded UTF-8 file. Loading scans the file once,
+// decoding it to find each chunk's size and extent but keeping none of the
+// decoded characters. A chunk is decoded again from the file when it is first
+// read, and the read fails if the chunk's bytes have changed since the scan,
+// in which case the text shows replacement characters and reports a read
+// error instead of showing the file's new contents.
+class FileChunkSource : public ChunkedText::Source {
+ public:
+  // Takes ownership of the file, which is closed once every chunk has been
+  // read or the returned text no longer refers to it. Returns an empty
+  // optional if the file couldn't be read.
+  static optional<ChunkedText> load(FILE *, const std::function<void(size_t)> &progress_callback);
+
+  FileChunkSource(FILE *, EncodingConversion &&);
+  FileChunkSource(const FileChunkSource &) = delete;
+  ~FileChunkSource();
+
+  bool read_chunk(size_t index, Text &result) override;
+
+ private:
+  // The block of bytes that a chunk was decoded from. It may end with bytes
+  // that belong to the next chunk.
+  struct ChunkLocation {
+    int64_t start;
+    uint32_t byte_count;
+    bool is_last;
+    uint64_t checksum;
+  };
+
+  std::mutex mutex;
+  FILE *file;
+  EncodingConversion conversion;
+  std::vector<ChunkLocation> chunk_locations;
+  std::vector<char> buffer;
+  size_t read_chunk_count;
+
+  bool read_bytes(int64_t start, size_t byte_count, size_t *bytes_read);
+  size_t decode_block(const ChunkLocation &, std::u16string &);
+};
+
+#endif  // SUPERSTRING_FILE_CHUNK_SOURCE_H
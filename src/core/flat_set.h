@@ -3,19 +3,114 @@
 
 #include <vector>
 #include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
 
-template <typename T> class flat_set {
-  typedef std::vector<T> contents_type;
-  contents_type contents;
+// A sorted set stored in a contiguous array. Sets with up to `N` elements are
+// stored inline, so that the many small sets kept by the nodes of a
+// MarkerIndex don't each need a heap allocation.
+template <typename T, size_t N = 4> class flat_set {
+  static_assert(std::is_trivial<T>::value, "flat_set elements must be trivial types");
+
+  union {
+    T inline_values[N];
+    T *heap_values;
+  };
+  uint32_t length;
+  uint32_t capacity;
+
+  bool is_inline() const {
+    return capacity == N;
+  }
+
+  T *data() {
+    return is_inline() ? inline_values : heap_values;
+  }
+
+  const T *data() const {
+    return is_inline() ? inline_values : heap_values;
+  }
+
+  void reserve(size_t new_capacity) {
+    if (new_capacity <= capacity) return;
+    new_capacity = std::max<size_t>(new_capacity, capacity * 2);
+    T *new_values = new T[new_capacity];
+    std::copy(data(), data() + length, new_values);
+    adopt(new_values, new_capacity);
+  }
+
+  void adopt(T *new_values, size_t new_capacity) {
+    if (!is_inline()) delete[] heap_values;
+    heap_values = new_values;
+    capacity = new_capacity;
+  }
+
+  void move_inline() {
+    T *values = heap_values;
+    std::copy(values, values + length, inline_values);
+    delete[] values;
+    capacity = N;
+  }
+
+  void take(flat_set &other) {
+    length = other.length;
+    capacity = other.capacity;
+    if (other.is_inline()) {
+      std::copy(other.inline_values, other.inline_values + other.length, inline_values);
+    } else {
+      heap_values = other.heap_values;
+      other.capacity = N;
+    }
+    other.length = 0;
+  }
 
 public:
-  typedef typename contents_type::iterator iterator;
-  typedef typename contents_type::const_iterator const_iterator;
+  typedef T *iterator;
+  typedef const T *const_iterator;
+
+  flat_set() : length{0}, capacity{N} {}
+
+  flat_set(const flat_set &other) : length{0}, capacity{N} {
+    reserve(other.length);
+    std::copy(other.begin(), other.end(), data());
+    length = other.length;
+  }
+
+  flat_set(flat_set &&other) {
+    take(other);
+  }
+
+  ~flat_set() {
+    if (!is_inline()) delete[] heap_values;
+  }
+
+  flat_set &operator=(const flat_set &other) {
+    if (this != &other) {
+      length = 0;
+      reserve(other.length);
+      std::copy(other.begin(), other.end(), data());
+      length = other.length;
+    }
+    return *this;
+  }
+
+  flat_set &operator=(flat_set &&other) {
+    if (this != &other) {
+      if (!is_inline()) delete[] heap_values;
+      take(other);
+    }
+    return *this;
+  }
 
   void insert(T value) {
-    auto iter = std::lower_bound(contents.begin(), contents.end(), value);
-    if (iter == contents.end() || *iter != value) {
-      contents.insert(iter, value);
+    auto iter = std::lower_bound(begin(), end(), value);
+    if (iter == end() || *iter != value) {
+      size_t index = iter - begin();
+      reserve(length + 1);
+      std::copy_backward(begin() + index, end(), end() + 1);
+      data()[index] = value;
+      length++;
     }
   }
 
@@ -25,8 +120,49 @@ public:
     }
   }
 
+  // Inserts a range of values that is already sorted and free of duplicates,
+  // by merging it with this set's values rather than inserting each value
+  // separately.
+  template <typename Iterator>
+  void insert_sorted(Iterator start, Iterator end) {
+    if (start == end) return;
+
+    size_t count = std::distance(start, end);
+    if (length == 0 || data()[length - 1] < *start) {
+      reserve(length + count);
+      std::copy(start, end, data() + length);
+      length += count;
+      return;
+    }
+
+    size_t merged_capacity = length + count;
+    T *merged_values = new T[merged_capacity];
+    T *merged_end = std::set_union(begin(), this->end(), start, end, merged_values);
+    length = merged_end - merged_values;
+    if (length <= N) {
+      if (!is_inline()) delete[] heap_values;
+      capacity = N;
+      std::copy(merged_values, merged_end, inline_values);
+      delete[] merged_values;
+    } else {
+      adopt(merged_values, merged_capacity);
+    }
+  }
+
+  void insert(const flat_set &other) {
+    insert_sorted(other.begin(), other.end());
+  }
+
   iterator erase(const iterator &iter) {
-    return contents.erase(iter);
+    size_t index = iter - begin();
+    std::copy(iter + 1, end(), iter);
+    length--;
+
+    // Return to inline storage once the set has shrunk well below its
+    // inline capacity, so that sets which briefly grow don't keep their
+    // allocation, without reallocating repeatedly around the threshold.
+    if (!is_inline() && length <= N / 2) move_inline();
+    return begin() + index;
   }
 
   void erase(T value) {
@@ -38,27 +174,27 @@ public:
   }
 
   iterator begin() {
-    return contents.begin();
+    return data();
   }
 
   const_iterator begin() const {
-    return contents.begin();
+    return data();
   }
 
   iterator end() {
-    return contents.end();
+    return data() + length;
   }
 
   const_iterator end() const {
-    return contents.end();
+    return data() + length;
   }
 
   size_t count(T value) const {
-    return std::binary_search(contents.begin(), contents.end(), value) ? 1 : 0;
+    return std::binary_search(begin(), end(), value) ? 1 : 0;
   }
 
   size_t size() const {
-    return contents.size();
+    return length;
   }
 };
 
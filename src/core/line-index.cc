@@ -0,0 +1,196 @@
+#include "line-index.h"
+#include <algorithm>
+
+using std::vector;
+using Line = LineIndex::Line;
+
+struct LineIndex::Node {
+  Node *left;
+  Node *right;
+  uint32_t priority;
+  Line line;
+  uint32_t subtree_row_count;
+  uint32_t subtree_length;
+
+  Node(Line line, uint32_t priority) :
+    left{nullptr},
+    right{nullptr},
+    priority{priority},
+    line(line),
+    subtree_row_count{1},
+    subtree_length{line.length} {}
+
+  uint32_t left_row_count() const {
+    return left ? left->subtree_row_count : 0;
+  }
+
+  uint32_t left_length() const {
+    return left ? left->subtree_length : 0;
+  }
+
+  void compute_subtree_totals() {
+    subtree_row_count = 1;
+    subtree_length = line.length;
+    if (left) {
+      subtree_row_count += left->subtree_row_count;
+      subtree_length += left->subtree_length;
+    }
+    if (right) {
+      subtree_row_count += right->subtree_row_count;
+      subtree_length += right->subtree_length;
+    }
+  }
+
+  void compute_subtree_totals_recursively() {
+    if (left) left->compute_subtree_totals_recursively();
+    if (right) right->compute_subtree_totals_recursively();
+    compute_subtree_totals();
+  }
+};
+
+LineIndex::LineIndex(const vector<Line> &lines) : root{build_tree(lines)} {}
+
+LineIndex::~LineIndex() {
+  delete_tree(root);
+}
+
+LineIndex::Node *LineIndex::build_tree(const vector<Line> &lines) {
+  // The lines are already in order, so the treap can be built in linear
+  // time by keeping track of the nodes along its right edge.
+  vector<Node *> right_edge;
+  for (const Line &line : lines) {
+    Node *node = new Node(line, static_cast<uint32_t>(random_engine()));
+    Node *left_child = nullptr;
+    while (!right_edge.empty() && right_edge.back()->priority < node->priority) {
+      left_child = right_edge.back();
+      right_edge.pop_back();
+    }
+    node->left = left_child;
+    if (!right_edge.empty()) right_edge.back()->right = node;
+    right_edge.push_back(node);
+  }
+
+  if (right_edge.empty()) return nullptr;
+  right_edge.front()->compute_subtree_totals_recursively();
+  return right_edge.front();
+}
+
+void LineIndex::delete_tree(Node *node) {
+  if (!node) return;
+  delete_tree(node->left);
+  delete_tree(node->right);
+  delete node;
+}
+
+void LineIndex::split(Node *node, uint32_t row_count, Node **left, Node **right) {
+  if (!node) {
+    *left = nullptr;
+    *right = nullptr;
+    return;
+  }
+
+  if (row_count <= node->left_row_count()) {
+    split(node->left, row_count, left, &node->left);
+    *right = node;
+  } else {
+    split(node->right, row_count - node->left_row_count() - 1, &node->right, right);
+    *left = node;
+  }
+  node->compute_subtree_totals();
+}
+
+LineIndex::Node *LineIndex::merge(Node *left, Node *right) {
+  if (!left) return right;
+  if (!right) return left;
+
+  if (left->priority > right->priority) {
+    left->right = merge(left->right, right);
+    left->compute_subtree_totals();
+    return left;
+  } else {
+    right->left = merge(left, right->left);
+    right->compute_subtree_totals();
+    return right;
+  }
+}
+
+void LineIndex::splice(uint32_t start_row, uint32_t deleted_row_count,
+                       const vector<Line> &inserted_lines) {
+  Node *preceding_lines, *remaining_lines, *deleted_lines, *following_lines;
+  split(root, start_row, &preceding_lines, &remaining_lines);
+  split(remaining_lines, deleted_row_count, &deleted_lines, &following_lines);
+  delete_tree(deleted_lines);
+  root = merge(merge(preceding_lines, build_tree(inserted_lines)), following_lines);
+}
+
+const LineIndex::Node *LineIndex::find_row(uint32_t row, uint32_t *row_offset) const {
+  const Node *node = root;
+  uint32_t offset = 0;
+  while (node) {
+    if (row < node->left_row_count()) {
+      node = node->left;
+    } else if (row == node->left_row_count()) {
+      *row_offset = offset + node->left_length();
+      return node;
+    } else {
+      row -= node->left_row_count() + 1;
+      offset += node->left_length() + node->line.length;
+      node = node->right;
+    }
+  }
+  return nullptr;
+}
+
+Line LineIndex::line_for_row(uint32_t row) const {
+  uint32_t row_offset;
+  const Node *node = find_row(row, &row_offset);
+  return node ? node->line : Line{0, 0};
+}
+
+ClipResult LineIndex::clip_position(Point position) const {
+  uint32_t row_offset;
+  const Node *node = find_row(position.row, &row_offset);
+  if (!node) return {extent(), size()};
+  uint32_t column = std::min(position.column, node->line.content_length);
+  return {Point(position.row, column), row_offset + column};
+}
+
+Point LineIndex::position_for_offset(uint32_t offset) const {
+  if (offset > size()) offset = size();
+
+  const Node *node = root;
+  uint32_t row = 0;
+  for (;;) {
+    if (offset < node->left_length()) {
+      node = node->left;
+      continue;
+    }
+
+    offset -= node->left_length();
+    row += node->left_row_count();
+    if (offset < node->line.length || !node->right) break;
+    offset -= node->line.length;
+    row++;
+    node = node->right;
+  }
+
+  // Like Text::position_for_offset, an offset between a CR and an LF is
+  // clipped to the start of the line ending.
+  uint32_t column = offset;
+  if (column == node->line.content_length + 1 &&
+      node->line.length == node->line.content_length + 2) {
+    column--;
+  }
+  return Point(row, column);
+}
+
+uint32_t LineIndex::size() const {
+  return root ? root->subtree_length : 0;
+}
+
+Point LineIndex::extent() const {
+  if (!root) return Point();
+  const Node *node = root;
+  while (node->right) node = node->right;
+  return Point(root->subtree_row_count - 1, node->line.length);
+}
@@ -0,0 +1,49 @@
+#ifndef SUPERSTRING_LINE_INDEX_H
+#define SUPERSTRING_LINE_INDEX_H
+
+#include <random>
+#include <vector>
+#include "point.h"
+#include "text.h"
+
+// Converts between positions and offsets in a text in logarithmic time,
+// using only the lengths of the text's lines. The lines are kept in a treap
+// ordered by row, where every node also stores the number of rows and
+// characters in its subtree, so that runs of lines can be replaced cheaply
+// as the text changes.
+class LineIndex {
+ public:
+  struct Line {
+    // The length of the line, including its line ending.
+    uint32_t length;
+
+    // The length of the line, excluding its line ending.
+    uint32_t content_length;
+  };
+
+  explicit LineIndex(const std::vector<Line> &lines);
+  LineIndex(const LineIndex &) = delete;
+  ~LineIndex();
+
+  void splice(uint32_t start_row, uint32_t deleted_row_count,
+              const std::vector<Line> &inserted_lines);
+  Line line_for_row(uint32_t row) const;
+  ClipResult clip_position(Point position) const;
+  Point position_for_offset(uint32_t offset) const;
+  uint32_t size() const;
+  Point extent() const;
+
+ private:
+  struct Node;
+
+  Node *build_tree(const std::vector<Line> &lines);
+  void delete_tree(Node *node);
+  const Node *find_row(uint32_t row, uint32_t *row_offset) const;
+  static void split(Node *node, uint32_t row_count, Node **left, Node **right);
+  static Node *merge(Node *left, Node *right);
+
+  std::default_random_engine random_engine;
+  Node *root;
+};
+
+#endif  // SUPERSTRING_LINE_INDEX_H
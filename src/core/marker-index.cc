@@ -1,4 +1,6 @@
 #include "marker-index.h"
+#include <algorithm>
+#include <cassert>
 #include <climits>
 #include <iterator>
 #include <random>
@@ -7,18 +9,81 @@
 
 using std::default_random_engine;
 using std::unordered_map;
+using std::vector;
 
 MarkerIndex::Node::Node(Node *parent, Point left_extent) :
   parent{parent},
   left{nullptr},
   right{nullptr},
   left_extent{left_extent},
-  priority{0} {}
+  priority{0},
+  cached_position_generation{0} {}
 
 bool MarkerIndex::Node::is_marker_endpoint() {
   return (start_marker_ids.size() + end_marker_ids.size()) > 0;
 }
 
+MarkerIndex::EndpointTable::EndpointTable() : count{0} {}
+
+MarkerIndex::Endpoints *MarkerIndex::EndpointTable::find(MarkerId id) {
+  if (id < slots.size()) {
+    return slots[id].start ? &slots[id] : nullptr;
+  }
+  if (overflow.empty()) return nullptr;
+  auto entry = overflow.find(id);
+  return entry == overflow.end() ? nullptr : &entry->second;
+}
+
+const MarkerIndex::Endpoints *MarkerIndex::EndpointTable::find(MarkerId id) const {
+  return const_cast<EndpointTable *>(this)->find(id);
+}
+
+void MarkerIndex::EndpointTable::insert(MarkerId id, Node *start_node, Node *end_node) {
+  count++;
+  if (id >= slots.size() && id < 2 * count + 64) {
+    size_t new_size = std::max<size_t>(static_cast<size_t>(id) + 1, slots.size() * 2);
+    slots.resize(new_size, Endpoints{nullptr, nullptr});
+    for (auto iter = overflow.begin(); iter != overflow.end();) {
+      if (iter->first < new_size) {
+        slots[iter->first] = iter->second;
+        iter = overflow.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+  }
+
+  if (id < slots.size()) {
+    slots[id] = Endpoints{start_node, end_node};
+  } else {
+    overflow.insert({id, Endpoints{start_node, end_node}});
+  }
+}
+
+void MarkerIndex::EndpointTable::erase(MarkerId id) {
+  if (id < slots.size()) {
+    if (!slots[id].start) return;
+    slots[id] = Endpoints{nullptr, nullptr};
+  } else if (!overflow.erase(id)) {
+    return;
+  }
+  count--;
+}
+
+void MarkerIndex::EndpointTable::clear() {
+  slots.clear();
+  overflow.clear();
+  count = 0;
+}
+
+void MarkerIndex::EndpointTable::reserve(size_t count) {
+  slots.reserve(count);
+}
+
+size_t MarkerIndex::EndpointTable::size() const {
+  return count;
+}
+
 MarkerIndex::Iterator::Iterator(MarkerIndex *marker_index) :
   marker_index{marker_index},
   current_node{nullptr} {}
@@ -173,7 +238,7 @@ void MarkerIndex::Iterator::find_contained_in(const Point &start, const Point &e
 
   MarkerIdSet started;
   while (current_node && current_node_position <= end) {
-    started.insert(current_node->start_marker_ids.begin(), current_node->start_marker_ids.end());
+    started.insert(current_node->start_marker_ids);
     for (MarkerId id : current_node->end_marker_ids) {
       if (started.count(id) > 0) result->insert(id);
     }
@@ -190,7 +255,7 @@ void MarkerIndex::Iterator::find_starting_in(const Point &start, const Point &en
   seek_to_first_node_greater_than_or_equal_to(start);
 
   while (current_node && current_node_position <= end) {
-    result->insert(current_node->start_marker_ids.begin(), current_node->start_marker_ids.end());
+    result->insert(current_node->start_marker_ids);
     cache_node_position();
     move_to_successor();
   }
@@ -204,7 +269,7 @@ void MarkerIndex::Iterator::find_ending_in(const Point &start, const Point &end,
   seek_to_first_node_greater_than_or_equal_to(start);
 
   while (current_node && current_node_position <= end) {
-    result->insert(current_node->end_marker_ids.begin(), current_node->end_marker_ids.end());
+    result->insert(current_node->end_marker_ids);
     cache_node_position();
     move_to_successor();
   }
@@ -400,28 +465,31 @@ MarkerIndex::Node *MarkerIndex::Iterator::insert_right_child(const Point &positi
 
 void MarkerIndex::Iterator::check_intersection(const Point &start, const Point &end, MarkerIdSet *result) {
   if (left_ancestor_position <= end && start <= current_node_position) {
-    result->insert(current_node->left_marker_ids.begin(), current_node->left_marker_ids.end());
+    result->insert(current_node->left_marker_ids);
   }
 
   if (start <= current_node_position && current_node_position <= end) {
-    result->insert(current_node->start_marker_ids.begin(), current_node->start_marker_ids.end());
-    result->insert(current_node->end_marker_ids.begin(), current_node->end_marker_ids.end());
+    result->insert(current_node->start_marker_ids);
+    result->insert(current_node->end_marker_ids);
   }
 
   if (current_node_position <= end && start <= right_ancestor_position) {
-    result->insert(current_node->right_marker_ids.begin(), current_node->right_marker_ids.end());
+    result->insert(current_node->right_marker_ids);
   }
 }
 
 void MarkerIndex::Iterator::cache_node_position() const {
-  marker_index->node_position_cache.insert({current_node, current_node_position});
+  if (!current_node) return;
+  current_node->cached_position = current_node_position;
+  current_node->cached_position_generation = marker_index->position_cache_generation;
 }
 
 MarkerIndex::MarkerIndex(unsigned seed)
   : random_engine{static_cast<default_random_engine::result_type>(seed)},
     random_distribution{1, INT_MAX - 1},
     root{nullptr},
-    iterator{this} {}
+    iterator{this},
+    position_cache_generation{1} {}
 
 MarkerIndex::~MarkerIndex() {
   if (root) delete_subtree(root);
@@ -435,8 +503,10 @@ void MarkerIndex::insert(MarkerId id, Point start, Point end) {
   Node *start_node = iterator.insert_marker_start(id, start, end);
   Node *end_node = iterator.insert_marker_end(id, start, end);
 
-  node_position_cache.insert({start_node, start});
-  node_position_cache.insert({end_node, end});
+  start_node->cached_position = start;
+  start_node->cached_position_generation = position_cache_generation;
+  end_node->cached_position = end;
+  end_node->cached_position_generation = position_cache_generation;
 
   start_node->start_marker_ids.insert(id);
   end_node->end_marker_ids.insert(id);
@@ -451,8 +521,63 @@ void MarkerIndex::insert(MarkerId id, Point start, Point end) {
     bubble_node_up(end_node);
   }
 
-  start_nodes_by_id.insert({id, start_node});
-  end_nodes_by_id.insert({id, end_node});
+  endpoints_by_id.insert(id, start_node, end_node);
+}
+
+// Inserting many markers one at a time performs a descent and a series of
+// rotations for each endpoint. When the batch is at least as large as the
+// index, it's cheaper to rebuild the tree: all of the distinct endpoints are
+// sorted and built into a treap in one pass, and then each marker is
+// recorded along the paths to its endpoints, which already exist.
+void MarkerIndex::bulk_insert(const vector<Insertion> &insertions) {
+  if (insertions.size() < endpoints_by_id.size()) {
+    for (const Insertion &insertion : insertions) {
+      insert(insertion.id, insertion.start, insertion.end);
+      set_exclusive(insertion.id, insertion.exclusive);
+    }
+    return;
+  }
+
+  vector<Insertion> markers;
+  markers.reserve(endpoints_by_id.size() + insertions.size());
+  for (const auto &entry : dump()) {
+    markers.push_back({
+      entry.first,
+      entry.second.start,
+      entry.second.end,
+      exclusive_marker_ids.count(entry.first) > 0
+    });
+  }
+  markers.insert(markers.end(), insertions.begin(), insertions.end());
+
+  // Visiting the markers in order of their ids keeps the insertions into
+  // each node's id sets at the ends of those sets.
+  std::sort(markers.begin(), markers.end(), [](const Insertion &a, const Insertion &b) {
+    return a.id < b.id;
+  });
+
+  vector<Point> positions;
+  positions.reserve(markers.size() * 2);
+  for (const Insertion &marker : markers) {
+    positions.push_back(marker.start);
+    positions.push_back(marker.end);
+  }
+  std::sort(positions.begin(), positions.end());
+  positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+  if (root) delete_subtree(root);
+  endpoints_by_id.clear();
+  endpoints_by_id.reserve(markers.size());
+  build_tree(positions);
+
+  for (const Insertion &marker : markers) {
+    Node *start_node = iterator.insert_marker_start(marker.id, marker.start, marker.end);
+    Node *end_node = iterator.insert_marker_end(marker.id, marker.start, marker.end);
+    start_node->start_marker_ids.insert(marker.id);
+    end_node->end_marker_ids.insert(marker.id);
+    endpoints_by_id.insert(marker.id, start_node, end_node);
+    set_exclusive(marker.id, marker.exclusive);
+  }
 }
 
 void MarkerIndex::set_exclusive(MarkerId id, bool exclusive) {
@@ -464,8 +589,9 @@ void MarkerIndex::set_exclusive(MarkerId id, bool exclusive) {
 }
 
 void MarkerIndex::remove(MarkerId id) {
-  Node *start_node = start_nodes_by_id.find(id)->second;
-  Node *end_node = end_nodes_by_id.find(id)->second;
+  Endpoints *endpoints = endpoints_by_id.find(id);
+  Node *start_node = endpoints->start;
+  Node *end_node = endpoints->end;
 
   Node *node = start_node;
   while (node) {
@@ -490,16 +616,21 @@ void MarkerIndex::remove(MarkerId id) {
     delete_node(end_node);
   }
 
-  start_nodes_by_id.erase(id);
-  end_nodes_by_id.erase(id);
+  endpoints_by_id.erase(id);
 }
 
 bool MarkerIndex::has(MarkerId id) {
-  return start_nodes_by_id.count(id) > 0;
+  return endpoints_by_id.find(id) != nullptr;
+}
+
+static void insert_sorted_ids(flat_set<MarkerIndex::MarkerId> *set, vector<MarkerIndex::MarkerId> *ids) {
+  std::sort(ids->begin(), ids->end());
+  ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+  set->insert_sorted(ids->begin(), ids->end());
 }
 
 MarkerIndex::SpliceResult MarkerIndex::splice(Point start, Point old_extent, Point new_extent) {
-  node_position_cache.clear();
+  position_cache_generation++;
 
   SpliceResult invalidated;
 
@@ -524,7 +655,7 @@ MarkerIndex::SpliceResult MarkerIndex::splice(Point start, Point old_extent, Poi
         iter = start_node->start_marker_ids.erase(iter);
         start_node->right_marker_ids.erase(id);
         end_node->start_marker_ids.insert(id);
-        start_nodes_by_id[id] = end_node;
+        endpoints_by_id.find(id)->start = end_node;
       } else {
         ++iter;
       }
@@ -537,20 +668,23 @@ MarkerIndex::SpliceResult MarkerIndex::splice(Point start, Point old_extent, Poi
           start_node->right_marker_ids.insert(id);
         }
         end_node->end_marker_ids.insert(id);
-        end_nodes_by_id[id] = end_node;
+        endpoints_by_id.find(id)->end = end_node;
       } else {
         ++iter;
       }
     }
   } else {
-    get_starting_and_ending_markers_within_subtree(start_node->right, &starting_inside_splice, &ending_inside_splice);
+    vector<MarkerId> starting_ids, ending_ids;
+    get_starting_and_ending_markers_within_subtree(start_node->right, &starting_ids, &ending_ids);
+    insert_sorted_ids(&starting_inside_splice, &starting_ids);
+    insert_sorted_ids(&ending_inside_splice, &ending_ids);
 
     for (MarkerId id : ending_inside_splice) {
       end_node->end_marker_ids.insert(id);
       if (!starting_inside_splice.count(id)) {
         start_node->right_marker_ids.insert(id);
       }
-      end_nodes_by_id[id] = end_node;
+      endpoints_by_id.find(id)->end = end_node;
     }
 
     for (MarkerId id : end_node->end_marker_ids) {
@@ -561,7 +695,7 @@ MarkerIndex::SpliceResult MarkerIndex::splice(Point start, Point old_extent, Poi
 
     for (MarkerId id : starting_inside_splice) {
       end_node->start_marker_ids.insert(id);
-      start_nodes_by_id[id] = end_node;
+      endpoints_by_id.find(id)->start = end_node;
     }
 
     for (auto iter = start_node->start_marker_ids.begin(); iter != start_node->start_marker_ids.end();) {
@@ -570,7 +704,7 @@ MarkerIndex::SpliceResult MarkerIndex::splice(Point start, Point old_extent, Poi
         iter = start_node->start_marker_ids.erase(iter);
         start_node->right_marker_ids.erase(id);
         end_node->start_marker_ids.insert(id);
-        start_nodes_by_id[id] = end_node;
+        endpoints_by_id.find(id)->start = end_node;
         starting_inside_splice.insert(id);
       } else {
         ++iter;
@@ -591,7 +725,7 @@ MarkerIndex::SpliceResult MarkerIndex::splice(Point start, Point old_extent, Poi
     for (MarkerId id : end_node->start_marker_ids) {
       start_node->start_marker_ids.insert(id);
       start_node->right_marker_ids.insert(id);
-      start_nodes_by_id[id] = start_node;
+      endpoints_by_id.find(id)->start = start_node;
     }
 
     for (MarkerId id : end_node->end_marker_ids) {
@@ -600,7 +734,7 @@ MarkerIndex::SpliceResult MarkerIndex::splice(Point start, Point old_extent, Poi
         start_node->left_marker_ids.insert(id);
         end_node->left_marker_ids.erase(id);
       }
-      end_nodes_by_id[id] = start_node;
+      endpoints_by_id.find(id)->end = start_node;
     }
     delete_node(end_node);
   } else if (end_node->is_marker_endpoint()) {
@@ -620,20 +754,50 @@ MarkerIndex::SpliceResult MarkerIndex::splice(Point start, Point old_extent, Poi
   return invalidated;
 }
 
+// Applies several splices, which must be sorted and separated from each
+// other, with each one expressed in the coordinates that precede all of them.
+// Applying them from last to first leaves the positions of the earlier
+// splices unchanged. Splices that touch are rejected, because a marker
+// endpoint between them would end up on a different side of the second
+// splice than it would if they were applied from first to last. The
+// invalidated ids are gathered unsorted and only sorted once, rather than
+// being inserted into the result's sets after every splice.
+MarkerIndex::SpliceResult MarkerIndex::splice_many(const vector<Splice> &splices) {
+  for (size_t i = 1; i < splices.size(); i++) {
+    assert(splices[i - 1].start.traverse(splices[i - 1].old_extent) < splices[i].start);
+  }
+
+  vector<MarkerId> touch, inside, overlap, surround;
+  for (auto iter = splices.rbegin(); iter != splices.rend(); ++iter) {
+    SpliceResult result = splice(iter->start, iter->old_extent, iter->new_extent);
+    touch.insert(touch.end(), result.touch.begin(), result.touch.end());
+    inside.insert(inside.end(), result.inside.begin(), result.inside.end());
+    overlap.insert(overlap.end(), result.overlap.begin(), result.overlap.end());
+    surround.insert(surround.end(), result.surround.begin(), result.surround.end());
+  }
+
+  SpliceResult invalidated;
+  insert_sorted_ids(&invalidated.touch, &touch);
+  insert_sorted_ids(&invalidated.inside, &inside);
+  insert_sorted_ids(&invalidated.overlap, &overlap);
+  insert_sorted_ids(&invalidated.surround, &surround);
+  return invalidated;
+}
+
 Point MarkerIndex::get_start(MarkerId id) const {
-  auto result = start_nodes_by_id.find(id);
-  if (result == start_nodes_by_id.end())
+  const Endpoints *endpoints = endpoints_by_id.find(id);
+  if (!endpoints)
     return Point();
   else
-    return get_node_position(result->second);
+    return get_node_position(endpoints->start);
 }
 
 Point MarkerIndex::get_end(MarkerId id) const {
-  auto result = end_nodes_by_id.find(id);
-  if (result == end_nodes_by_id.end())
+  const Endpoints *endpoints = endpoints_by_id.find(id);
+  if (!endpoints)
     return Point();
   else
-    return get_node_position(result->second);
+    return get_node_position(endpoints->end);
 }
 
 Range MarkerIndex::get_range(MarkerId id) const {
@@ -657,6 +821,30 @@ flat_set<MarkerIndex::MarkerId> MarkerIndex::find_intersecting(Point start, Poin
   return result;
 }
 
+// Returns the ranges of the markers intersecting the given range, ordered
+// like `compare`, so that a renderer can consume them without looking up
+// each marker separately. The traversal that finds the markers caches the
+// positions of the nodes it visits, so most of the endpoints are resolved
+// without walking up the tree.
+vector<MarkerIndex::MarkerRange> MarkerIndex::find_intersecting_ranges(Point start, Point end) {
+  MarkerIdSet ids;
+  iterator.find_intersecting(start, end, &ids);
+
+  vector<MarkerRange> result;
+  result.reserve(ids.size());
+  for (MarkerId id : ids) {
+    const Endpoints *endpoints = endpoints_by_id.find(id);
+    result.push_back({id, get_node_position(endpoints->start), get_node_position(endpoints->end)});
+  }
+
+  std::sort(result.begin(), result.end(), [](const MarkerRange &a, const MarkerRange &b) {
+    if (a.start != b.start) return a.start < b.start;
+    if (a.end != b.end) return a.end > b.end;
+    return a.id < b.id;
+  });
+  return result;
+}
+
 flat_set<MarkerIndex::MarkerId> MarkerIndex::find_containing(Point start, Point end) {
   MarkerIdSet containing_start;
   iterator.find_intersecting(start, start, &containing_start);
@@ -712,26 +900,25 @@ unordered_map<MarkerIndex::MarkerId, Range> MarkerIndex::dump() {
 }
 
 Point MarkerIndex::get_node_position(const Node *node) const {
-  auto cache_entry = node_position_cache.find(node);
-  if (cache_entry == node_position_cache.end()) {
-    Point position = node->left_extent;
-    const Node *current_node = node;
-    while (current_node->parent) {
-      if (current_node->parent->right == current_node) {
-        position = current_node->parent->left_extent.traverse(position);
-      }
+  if (node->cached_position_generation == position_cache_generation) {
+    return node->cached_position;
+  }
 
-      current_node = current_node->parent;
+  Point position = node->left_extent;
+  const Node *current_node = node;
+  while (current_node->parent) {
+    if (current_node->parent->right == current_node) {
+      position = current_node->parent->left_extent.traverse(position);
     }
-    node_position_cache.insert({node, position});
-    return position;
-  } else {
-    return cache_entry->second;
+
+    current_node = current_node->parent;
   }
+  node->cached_position = position;
+  node->cached_position_generation = position_cache_generation;
+  return position;
 }
 
 void MarkerIndex::delete_node(Node *node) {
-  node_position_cache.erase(node);
   node->priority = INT_MAX;
 
   bubble_node_down(node);
@@ -755,6 +942,42 @@ void MarkerIndex::delete_subtree(Node *node) {
   delete node;
 }
 
+// Builds a treap from the given sorted positions in linear time, by keeping
+// track of the nodes along its right edge.
+void MarkerIndex::build_tree(const vector<Point> &positions) {
+  vector<Node *> right_edge;
+  for (const Point &position : positions) {
+    // Until the tree is complete, each node's left extent holds its absolute
+    // position.
+    Node *node = new Node(nullptr, position);
+    node->priority = generate_random_number();
+
+    Node *left_child = nullptr;
+    while (!right_edge.empty() && right_edge.back()->priority > node->priority) {
+      left_child = right_edge.back();
+      right_edge.pop_back();
+    }
+
+    node->left = left_child;
+    if (left_child) left_child->parent = node;
+    if (!right_edge.empty()) {
+      right_edge.back()->right = node;
+      node->parent = right_edge.back();
+    }
+    right_edge.push_back(node);
+  }
+
+  root = right_edge.empty() ? nullptr : right_edge.front();
+  if (root) assign_left_extents(root, Point());
+}
+
+void MarkerIndex::assign_left_extents(Node *node, Point left_ancestor_position) {
+  Point position = node->left_extent;
+  if (node->left) assign_left_extents(node->left, left_ancestor_position);
+  if (node->right) assign_left_extents(node->right, position);
+  node->left_extent = position.traversal(left_ancestor_position);
+}
+
 void MarkerIndex::bubble_node_up(Node *node) {
   while (node->parent && node->priority < node->parent->priority) {
     if (node == node->parent->left) {
@@ -804,7 +1027,7 @@ void MarkerIndex::rotate_node_left(Node *rotation_pivot) {
 
   rotation_pivot->left_extent = rotation_root->left_extent.traverse(rotation_pivot->left_extent);
 
-  rotation_pivot->right_marker_ids.insert(rotation_root->right_marker_ids.begin(), rotation_root->right_marker_ids.end());
+  rotation_pivot->right_marker_ids.insert(rotation_root->right_marker_ids);
 
   for (auto it = rotation_pivot->left_marker_ids.begin(); it != rotation_pivot->left_marker_ids.end();) {
     if (rotation_root->left_marker_ids.count(*it)) {
@@ -858,20 +1081,20 @@ void MarkerIndex::rotate_node_right(Node *rotation_pivot) {
   }
 }
 
-void MarkerIndex::get_starting_and_ending_markers_within_subtree(const Node *node, MarkerIdSet *starting, MarkerIdSet *ending) {
+void MarkerIndex::get_starting_and_ending_markers_within_subtree(const Node *node, vector<MarkerId> *starting, vector<MarkerId> *ending) {
   if (node == nullptr) {
     return;
   }
 
   get_starting_and_ending_markers_within_subtree(node->left, starting, ending);
-  starting->insert(node->start_marker_ids.begin(), node->start_marker_ids.end());
-  ending->insert(node->end_marker_ids.begin(), node->end_marker_ids.end());
+  starting->insert(starting->end(), node->start_marker_ids.begin(), node->start_marker_ids.end());
+  ending->insert(ending->end(), node->end_marker_ids.begin(), node->end_marker_ids.end());
   get_starting_and_ending_markers_within_subtree(node->right, starting, ending);
 }
 
 void MarkerIndex::populate_splice_invalidation_sets(SpliceResult *invalidated, const Node *start_node, const Node *end_node, const MarkerIdSet &starting_inside_splice, const MarkerIdSet &ending_inside_splice) {
-  invalidated->touch.insert(start_node->end_marker_ids.begin(), start_node->end_marker_ids.end());
-  invalidated->touch.insert(end_node->start_marker_ids.begin(), end_node->start_marker_ids.end());
+  invalidated->touch.insert(start_node->end_marker_ids);
+  invalidated->touch.insert(end_node->start_marker_ids);
 
   for (MarkerId id : start_node->right_marker_ids) {
     invalidated->touch.insert(id);
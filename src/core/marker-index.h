@@ -30,20 +30,42 @@ public:
     std::vector<Boundary> boundaries;
   };
 
+  struct MarkerRange {
+    MarkerId id;
+    Point start;
+    Point end;
+  };
+
+  struct Splice {
+    Point start;
+    Point old_extent;
+    Point new_extent;
+  };
+
+  struct Insertion {
+    MarkerId id;
+    Point start;
+    Point end;
+    bool exclusive;
+  };
+
   MarkerIndex(unsigned seed = 0u);
   ~MarkerIndex();
   int generate_random_number();
   void insert(MarkerId id, Point start, Point end);
+  void bulk_insert(const std::vector<Insertion> &insertions);
   void set_exclusive(MarkerId id, bool exclusive);
   void remove(MarkerId id);
   bool has(MarkerId id);
   SpliceResult splice(Point start, Point old_extent, Point new_extent);
+  SpliceResult splice_many(const std::vector<Splice> &splices);
   Point get_start(MarkerId id) const;
   Point get_end(MarkerId id) const;
   Range get_range(MarkerId id) const;
 
   int compare(MarkerId id1, MarkerId id2) const;
   flat_set<MarkerId> find_intersecting(Point start, Point end);
+  std::vector<MarkerRange> find_intersecting_ranges(Point start, Point end);
   flat_set<MarkerId> find_containing(Point start, Point end);
   flat_set<MarkerId> find_contained_in(Point start, Point end);
   flat_set<MarkerId> find_starting_in(Point start, Point end);
@@ -67,11 +89,40 @@ private:
     flat_set<MarkerId> start_marker_ids;
     flat_set<MarkerId> end_marker_ids;
     int priority;
+    mutable Point cached_position;
+    mutable uint64_t cached_position_generation;
 
     Node(Node *parent, Point left_extent);
     bool is_marker_endpoint();
   };
 
+  struct Endpoints {
+    Node *start;
+    Node *end;
+  };
+
+  // Maps marker ids to their endpoint nodes. Callers allocate ids densely,
+  // so most ids index directly into a vector, and a removed marker's slot is
+  // reused when its id is. Ids that are far beyond the number of markers are
+  // kept in a hash map instead, so that a few large ids can't make the
+  // vector grow without bound.
+  class EndpointTable {
+  public:
+    EndpointTable();
+    Endpoints *find(MarkerId id);
+    const Endpoints *find(MarkerId id) const;
+    void insert(MarkerId id, Node *start_node, Node *end_node);
+    void erase(MarkerId id);
+    void clear();
+    void reserve(size_t count);
+    size_t size() const;
+
+  private:
+    std::vector<Endpoints> slots;
+    std::unordered_map<MarkerId, Endpoints> overflow;
+    size_t count;
+  };
+
   class Iterator {
   public:
     Iterator(MarkerIndex *marker_index);
@@ -111,21 +162,26 @@ private:
   Point get_node_position(const Node *node) const;
   void delete_node(Node *node);
   void delete_subtree(Node *node);
+  void build_tree(const std::vector<Point> &positions);
+  void assign_left_extents(Node *node, Point left_ancestor_position);
   void bubble_node_up(Node *node);
   void bubble_node_down(Node *node);
   void rotate_node_left(Node *pivot);
   void rotate_node_right(Node *pivot);
-  void get_starting_and_ending_markers_within_subtree(const Node *node, flat_set<MarkerId> *starting, flat_set<MarkerId> *ending);
+  void get_starting_and_ending_markers_within_subtree(const Node *node, std::vector<MarkerId> *starting, std::vector<MarkerId> *ending);
   void populate_splice_invalidation_sets(SpliceResult *invalidated, const Node *start_node, const Node *end_node, const flat_set<MarkerId> &starting_inside_splice, const flat_set<MarkerId> &ending_inside_splice);
 
   std::default_random_engine random_engine;
   std::uniform_int_distribution<int> random_distribution;
   Node *root;
-  std::unordered_map<MarkerId, Node*> start_nodes_by_id;
-  std::unordered_map<MarkerId, Node*> end_nodes_by_id;
+  EndpointTable endpoints_by_id;
   Iterator iterator;
   flat_set<MarkerId> exclusive_marker_ids;
-  mutable std::unordered_map<const Node*, Point> node_position_cache;
+
+  // Nodes whose cached position was computed in an earlier generation must
+  // recompute it, so splicing invalidates every cached position at once by
+  // starting a new generation.
+  uint64_t position_cache_generation;
 };
 
 #endif // MARKER_INDEX_H_
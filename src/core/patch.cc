@@ -3,10 +3,13 @@
 #include "text.h"
 #include "text-slice.h"
 #include <assert.h>
+#include <algorithm>
 #include <cmath>
 #include <memory>
 #include <stdio.h>
+#include <new>
 #include <sstream>
+#include <type_traits>
 #include <vector>
 
 using std::function;
@@ -144,39 +147,8 @@ struct Patch::Node {
     }
   }
 
-  Node *copy() {
-    auto result = new Node{
-      left,
-      right,
-      old_extent,
-      new_extent,
-      old_distance_from_left_ancestor,
-      new_distance_from_left_ancestor,
-      old_text ? unique_ptr<Text>(new Text(*old_text)) : nullptr,
-      new_text ? unique_ptr<Text>(new Text(*new_text)) : nullptr,
-      old_text_size_,
-    };
-    result->old_subtree_text_size = old_subtree_text_size;
-    result->new_subtree_text_size = new_subtree_text_size;
-    return result;
-  }
-
-  Node *invert() {
-    auto result = new Node{
-      left,
-      right,
-      new_extent,
-      old_extent,
-      new_distance_from_left_ancestor,
-      old_distance_from_left_ancestor,
-      new_text ? unique_ptr<Text>(new Text(*new_text)) : nullptr,
-      old_text ? unique_ptr<Text>(new Text(*old_text)) : nullptr,
-      new_text ? new_text->size() : 0
-    };
-    result->old_subtree_text_size = new_subtree_text_size;
-    result->new_subtree_text_size = old_subtree_text_size;
-    return result;
-  }
+  Node *copy(NodePool &) const;
+  Node *invert(NodePool &) const;
 
   void serialize(Serializer &output) const {
     old_extent.serialize(output);
@@ -313,27 +285,114 @@ struct Patch::NewCoordinates {
   static Point choose(Point old, Point new_) { return new_; }
 };
 
+// Allocates nodes in slabs of increasing size, and recycles the nodes that
+// the patch deletes, so that most splices don't need to allocate any nodes.
+// Slabs are only released when the patch is cleared or destroyed.
+class Patch::NodePool {
+  using Storage = std::aligned_storage<sizeof(Node), alignof(Node)>::type;
+
+  struct FreeNode {
+    FreeNode *next;
+  };
+
+  static const uint32_t MIN_SLAB_SIZE = 8;
+  static const uint32_t MAX_SLAB_SIZE = 1024;
+
+  vector<unique_ptr<Storage[]>> slabs;
+  uint32_t slab_size;
+  uint32_t slab_used_count;
+  FreeNode *free_nodes;
+
+ public:
+  NodePool() : slab_size{0}, slab_used_count{0}, free_nodes{nullptr} {}
+
+  template <typename... Args>
+  Node *allocate(Args &&... args) {
+    void *memory;
+    if (free_nodes) {
+      memory = free_nodes;
+      free_nodes = free_nodes->next;
+    } else {
+      if (slab_used_count == slab_size) {
+        slab_size = slab_size == 0 ? MIN_SLAB_SIZE : std::min(slab_size * 2, MAX_SLAB_SIZE);
+        slabs.emplace_back(new Storage[slab_size]);
+        slab_used_count = 0;
+      }
+      memory = &slabs.back()[slab_used_count++];
+    }
+    return new (memory) Node(std::forward<Args>(args)...);
+  }
+
+  void free(Node *node) {
+    node->~Node();
+    FreeNode *free_node = reinterpret_cast<FreeNode *>(node);
+    free_node->next = free_nodes;
+    free_nodes = free_node;
+  }
+};
+
+const uint32_t Patch::NodePool::MIN_SLAB_SIZE;
+const uint32_t Patch::NodePool::MAX_SLAB_SIZE;
+
+template <typename... Args>
+Patch::Node *Patch::allocate_node(Args &&... args) {
+  if (!node_pool) node_pool.reset(new NodePool());
+  return node_pool->allocate(std::forward<Args>(args)...);
+}
+
+Patch::Node *Patch::Node::copy(NodePool &pool) const {
+  auto result = pool.allocate(
+    left,
+    right,
+    old_extent,
+    new_extent,
+    old_distance_from_left_ancestor,
+    new_distance_from_left_ancestor,
+    old_text ? unique_ptr<Text>(new Text(*old_text)) : nullptr,
+    new_text ? unique_ptr<Text>(new Text(*new_text)) : nullptr,
+    old_text_size_
+  );
+  result->old_subtree_text_size = old_subtree_text_size;
+  result->new_subtree_text_size = new_subtree_text_size;
+  return result;
+}
+
+Patch::Node *Patch::Node::invert(NodePool &pool) const {
+  auto result = pool.allocate(
+    left,
+    right,
+    new_extent,
+    old_extent,
+    new_distance_from_left_ancestor,
+    old_distance_from_left_ancestor,
+    new_text ? unique_ptr<Text>(new Text(*new_text)) : nullptr,
+    old_text ? unique_ptr<Text>(new Text(*old_text)) : nullptr,
+    new_text ? new_text->size() : 0
+  );
+  result->old_subtree_text_size = new_subtree_text_size;
+  result->new_subtree_text_size = old_subtree_text_size;
+  return result;
+}
+
 // Construction and destruction
 
 Patch::Patch(bool merges_adjacent_changes)
-  : root{nullptr}, change_count{0}, merges_adjacent_changes{merges_adjacent_changes} {}
+  : root{nullptr}, change_count{0}, merges_adjacent_changes{merges_adjacent_changes},
+    is_frozen{false} {}
 
 Patch::Patch(Patch &&other)
   : root{nullptr}, change_count{other.change_count},
-    merges_adjacent_changes{other.merges_adjacent_changes} {
+    merges_adjacent_changes{other.merges_adjacent_changes}, is_frozen{false} {
   *this = move(other);
 }
 
-Patch::Patch(Node *root, uint32_t change_count, bool merges_adjacent_changes)
-  : root{root}, change_count{change_count},
-    merges_adjacent_changes{merges_adjacent_changes} {}
-
 enum Transition : uint32_t { None, Left, Right, Up };
 
 Patch::Patch(Deserializer &input) :
   root{nullptr},
   change_count{0},
-  merges_adjacent_changes{true} {
+  merges_adjacent_changes{true},
+  is_frozen{false} {
   uint32_t serialization_version = input.read<uint32_t>();
   if (serialization_version != SERIALIZATION_VERSION) return;
 
@@ -341,20 +400,20 @@ Patch::Patch(Deserializer &input) :
   if (change_count == 0) return;
 
   node_stack.reserve(change_count);
-  root = new Node(input);
+  root = allocate_node(input);
   Node *node = root, *next_node = nullptr;
 
   for (uint32_t i = 1; i < change_count;) {
     switch (input.read<uint32_t>()) {
     case Left:
-      next_node = new Node(input);
+      next_node = allocate_node(input);
       node->left = next_node;
       node_stack.push_back(node);
       node = next_node;
       i++;
       break;
     case Right:
-      next_node = new Node(input);
+      next_node = allocate_node(input);
       node->right = next_node;
       node_stack.push_back(node);
       node = next_node;
@@ -366,7 +425,8 @@ Patch::Patch(Deserializer &input) :
       node_stack.pop_back();
       break;
     default:
-      delete root;
+      delete_node(&root);
+      change_count = 0;
       return;
     }
   }
@@ -379,9 +439,12 @@ Patch::Patch(Deserializer &input) :
 
 Patch &Patch::operator=(Patch &&other) {
   std::swap(root, other.root);
+  std::swap(node_pool, other.node_pool);
   std::swap(left_ancestor_stack, other.left_ancestor_stack);
   std::swap(node_stack, other.node_stack);
   std::swap(change_count, other.change_count);
+  std::swap(is_frozen, other.is_frozen);
+  std::swap(frozen_changes, other.frozen_changes);
   merges_adjacent_changes = other.merges_adjacent_changes;
   return *this;
 }
@@ -427,51 +490,55 @@ void Patch::serialize(Serializer &output) {
 }
 
 Patch Patch::copy() {
-  Node *new_root = nullptr;
+  Patch result{merges_adjacent_changes};
   if (root) {
-    new_root = root->copy();
+    result.node_pool.reset(new NodePool());
+    result.root = root->copy(*result.node_pool);
+    result.change_count = change_count;
     node_stack.clear();
-    node_stack.push_back(new_root);
+    node_stack.push_back(result.root);
 
     while (!node_stack.empty()) {
       Node *node = node_stack.back();
       node_stack.pop_back();
       if (node->left) {
-        node->left = node->left->copy();
+        node->left = node->left->copy(*result.node_pool);
         node_stack.push_back(node->left);
       }
       if (node->right) {
-        node->right = node->right->copy();
+        node->right = node->right->copy(*result.node_pool);
         node_stack.push_back(node->right);
       }
     }
   }
 
-  return Patch{new_root, change_count, merges_adjacent_changes};
+  return result;
 }
 
 Patch Patch::invert() {
-  Node *inverted_root = nullptr;
+  Patch result{merges_adjacent_changes};
   if (root) {
-    inverted_root = root->invert();
+    result.node_pool.reset(new NodePool());
+    result.root = root->invert(*result.node_pool);
+    result.change_count = change_count;
     node_stack.clear();
-    node_stack.push_back(inverted_root);
+    node_stack.push_back(result.root);
 
     while (!node_stack.empty()) {
       Node *node = node_stack.back();
       node_stack.pop_back();
       if (node->left) {
-        node->left = node->left->invert();
+        node->left = node->left->invert(*result.node_pool);
         node_stack.push_back(node->left);
       }
       if (node->right) {
-        node->right = node->right->invert();
+        node->right = node->right->invert(*result.node_pool);
         node_stack.push_back(node->right);
       }
     }
   }
 
-  return Patch{inverted_root, change_count, merges_adjacent_changes};
+  return result;
 }
 
 // Mutations
@@ -481,6 +548,7 @@ bool Patch::splice(Point new_splice_start,
                    optional<Text> &&deleted_text, optional<Text> &&inserted_text,
                    uint32_t deleted_text_size) {
   if (new_deletion_extent.is_zero() && new_insertion_extent.is_zero()) return true;
+  thaw();
 
   if (!root) {
     root = build_node(nullptr, nullptr, new_splice_start, new_splice_start,
@@ -779,6 +847,7 @@ bool Patch::splice(Point new_splice_start,
 void Patch::splice_old(Point old_splice_start, Point old_deletion_extent,
                       Point old_insertion_extent) {
   if (!root) return;
+  thaw();
 
   Point old_deletion_end = old_splice_start.traverse(old_deletion_extent);
   Point old_insertion_end = old_splice_start.traverse(old_insertion_extent);
@@ -878,6 +947,226 @@ void Patch::splice_old(Point old_splice_start, Point old_deletion_extent,
   if (upper_bound) upper_bound->compute_subtree_text_sizes();
 }
 
+// Applies several splices, which must be sorted and must not overlap, with
+// each one expressed in the new coordinates that precede all of them. Rather
+// than splaying the tree once per splice, this walks the existing changes and
+// the splices together, merging each run of splices with the changes they
+// overlap or touch, and then rebuilds a balanced tree from the result. The
+// texts of changes that no splice touches are moved into the new tree, so
+// this takes time linear in the number of changes and splices, plus the size
+// of the merged texts. Returns the merged changes, in their final positions.
+vector<Change> Patch::splice_many(vector<Splice> &&splices) {
+  assert(merges_adjacent_changes);
+  thaw();
+
+  splices.erase(std::remove_if(splices.begin(), splices.end(), [](const Splice &splice) {
+    return splice.deletion_extent.is_zero() && splice.inserted_text.empty();
+  }), splices.end());
+  if (splices.empty()) return vector<Change>{};
+
+  struct ExistingChange {
+    Node *node;
+    Point old_start, old_end, new_start, new_end;
+  };
+
+  struct BuiltChange {
+    Point old_start, old_end, new_start, new_end;
+    unique_ptr<Text> old_text, new_text;
+    uint32_t old_text_size;
+  };
+
+  // Collect the existing changes in order, along with their positions.
+  vector<ExistingChange> existing_changes;
+  existing_changes.reserve(change_count);
+  {
+    struct Frame {
+      Node *node;
+      Point old_left_ancestor_end, new_left_ancestor_end;
+    };
+    vector<Frame> stack;
+    Node *node = root;
+    Point old_left_ancestor_end, new_left_ancestor_end;
+    while (node || !stack.empty()) {
+      while (node) {
+        stack.push_back({node, old_left_ancestor_end, new_left_ancestor_end});
+        node = node->left;
+      }
+      Frame frame = stack.back();
+      stack.pop_back();
+      node = frame.node;
+      Point old_start = frame.old_left_ancestor_end.traverse(node->old_distance_from_left_ancestor);
+      Point new_start = frame.new_left_ancestor_end.traverse(node->new_distance_from_left_ancestor);
+      old_left_ancestor_end = old_start.traverse(node->old_extent);
+      new_left_ancestor_end = new_start.traverse(node->new_extent);
+      existing_changes.push_back({node, old_start, old_left_ancestor_end, new_start, new_left_ancestor_end});
+      node = node->right;
+    }
+  }
+
+  vector<BuiltChange> built_changes;
+  vector<size_t> merged_change_indices;
+  built_changes.reserve(existing_changes.size() + splices.size());
+
+  // Positions at or after the end of the last merged change are shifted by
+  // the same amount, and positions at or after the end of the last existing
+  // change are unchanged relative to the old coordinates.
+  Point splice_anchor, built_anchor;
+  Point old_anchor, new_anchor;
+  auto built_position = [&](Point position) {
+    return built_anchor.traverse(position.traversal(splice_anchor));
+  };
+
+  size_t change_index = 0, splice_index = 0;
+  size_t existing_change_count = existing_changes.size(), splice_count = splices.size();
+  while (change_index < existing_change_count || splice_index < splice_count) {
+    if (change_index < existing_change_count &&
+        (splice_index == splice_count ||
+         existing_changes[change_index].new_end < splices[splice_index].start)) {
+      ExistingChange &change = existing_changes[change_index++];
+      built_changes.push_back({
+        change.old_start,
+        change.old_end,
+        built_position(change.new_start),
+        built_position(change.new_end),
+        move(change.node->old_text),
+        move(change.node->new_text),
+        change.node->old_text_size_
+      });
+      old_anchor = change.old_end;
+      new_anchor = change.new_end;
+      continue;
+    }
+
+    // Gather the splices and changes that overlap or touch each other. The
+    // range they cover contains no unchanged text, so the merged text
+    // consists of the splices' inserted texts and the parts of the changes'
+    // new texts that the splices don't delete.
+    size_t first_change_index = change_index;
+    Point group_start = splices[splice_index].start;
+    Point old_start = old_anchor.traverse(group_start.traversal(new_anchor));
+    if (change_index < existing_change_count && existing_changes[change_index].new_start <= group_start) {
+      group_start = existing_changes[change_index].new_start;
+      old_start = existing_changes[change_index].old_start;
+    }
+
+    Text new_text;
+    uint32_t preserved_text_size = 0, deleted_text_size = 0;
+    uint32_t changes_old_text_size = 0, changes_new_text_size = 0;
+    Point group_end = group_start, text_end = group_start;
+    size_t text_change_index = first_change_index;
+
+    auto append_changed_text = [&](Point start, Point end) {
+      while (text_change_index < change_index &&
+             existing_changes[text_change_index].new_end <= start) {
+        text_change_index++;
+      }
+      for (size_t i = text_change_index; i < change_index; i++) {
+        const ExistingChange &change = existing_changes[i];
+        if (change.new_start >= end) break;
+        assert(change.node->new_text);
+        Point slice_start = Point::max(start, change.new_start).traversal(change.new_start);
+        Point slice_end = Point::min(end, change.new_end).traversal(change.new_start);
+        TextSlice slice = TextSlice(*change.node->new_text).slice({slice_start, slice_end});
+        new_text.append(slice);
+        preserved_text_size += slice.size();
+      }
+    };
+
+    for (;;) {
+      if (change_index < existing_change_count && existing_changes[change_index].new_start <= group_end) {
+        const ExistingChange &change = existing_changes[change_index++];
+        assert(!change.node->old_text);
+        changes_old_text_size += change.node->old_text_size();
+        changes_new_text_size += change.node->new_text_size();
+        group_end = Point::max(group_end, change.new_end);
+      } else if (splice_index < splice_count && splices[splice_index].start <= group_end) {
+        Splice &splice = splices[splice_index++];
+        Point deletion_end = splice.start.traverse(splice.deletion_extent);
+        append_changed_text(text_end, splice.start);
+        new_text.append(splice.inserted_text);
+        deleted_text_size += splice.deleted_text_size;
+        text_end = deletion_end;
+        group_end = Point::max(group_end, deletion_end);
+      } else {
+        break;
+      }
+    }
+    append_changed_text(text_end, group_end);
+
+    if (change_index > first_change_index) {
+      old_anchor = existing_changes[change_index - 1].old_end;
+      new_anchor = existing_changes[change_index - 1].new_end;
+    }
+    Point old_end = old_anchor.traverse(group_end.traversal(new_anchor));
+    uint32_t old_text_size =
+      changes_old_text_size + preserved_text_size + deleted_text_size - changes_new_text_size;
+
+    Point new_start = built_position(group_start);
+    Point new_end = new_start.traverse(new_text.extent());
+    splice_anchor = group_end;
+    built_anchor = new_end;
+
+    if (old_start == old_end && new_text.empty()) continue;
+    merged_change_indices.push_back(built_changes.size());
+    built_changes.push_back({
+      old_start,
+      old_end,
+      new_start,
+      new_end,
+      nullptr,
+      unique_ptr<Text>{new Text(move(new_text))},
+      old_text_size
+    });
+  }
+
+  vector<Change> result;
+  result.reserve(merged_change_indices.size());
+  uint32_t preceding_old_text_size = 0, preceding_new_text_size = 0;
+  for (size_t i = 0, j = 0; i < built_changes.size(); i++) {
+    const BuiltChange &change = built_changes[i];
+    uint32_t old_text_size = change.old_text ? change.old_text->size() : change.old_text_size;
+    uint32_t new_text_size = change.new_text ? change.new_text->size() : 0;
+    if (j < merged_change_indices.size() && merged_change_indices[j] == i) {
+      result.push_back(Change{
+        change.old_start, change.old_end,
+        change.new_start, change.new_end,
+        nullptr, change.new_text.get(),
+        preceding_old_text_size, preceding_new_text_size,
+        old_text_size
+      });
+      j++;
+    }
+    preceding_old_text_size += old_text_size;
+    preceding_new_text_size += new_text_size;
+  }
+
+  if (root) delete_node(&root);
+
+  function<Node *(size_t, size_t, Point, Point)> build_subtree =
+    [&](size_t begin, size_t end, Point old_left_ancestor_end, Point new_left_ancestor_end) -> Node * {
+      if (begin == end) return nullptr;
+      size_t middle = begin + (end - begin) / 2;
+      BuiltChange &change = built_changes[middle];
+      Node *left = build_subtree(begin, middle, old_left_ancestor_end, new_left_ancestor_end);
+      Node *right = build_subtree(middle + 1, end, change.old_end, change.new_end);
+      change_count++;
+      return allocate_node(
+        left,
+        right,
+        change.old_end.traversal(change.old_start),
+        change.new_end.traversal(change.new_start),
+        change.old_start.traversal(old_left_ancestor_end),
+        change.new_start.traversal(new_left_ancestor_end),
+        move(change.old_text),
+        move(change.new_text),
+        change.old_text_size
+      );
+    };
+  root = build_subtree(0, built_changes.size(), Point(), Point());
+
+  return result;
+}
+
 bool Patch::combine(const Patch &other, bool left_to_right) {
   auto changes = other.get_changes();
   if (left_to_right) {
@@ -904,7 +1193,27 @@ bool Patch::combine(const Patch &other, bool left_to_right) {
 }
 
 void Patch::clear() {
+  thaw();
   if (root) delete_node(&root);
+  node_pool.reset();
+}
+
+// While a patch is shared with snapshots that may be read on other threads,
+// its changes can't be modified, and reads can't splay its tree. Freezing
+// the patch copies its changes into a sorted array, so that these reads can
+// use binary search rather than walking a possibly unbalanced tree. Any
+// mutation thaws the patch again.
+void Patch::freeze() {
+  if (is_frozen) return;
+  frozen_changes = get_changes();
+  is_frozen = true;
+}
+
+void Patch::thaw() {
+  if (!is_frozen) return;
+  is_frozen = false;
+  frozen_changes.clear();
+  frozen_changes.shrink_to_fit();
 }
 
 void Patch::rebalance() {
@@ -938,6 +1247,7 @@ void Patch::rebalance() {
 // Non-splaying reads
 
 vector<Change> Patch::get_changes() const {
+  if (is_frozen) return frozen_changes;
   return get_changes_in_range<NewCoordinates>(
     Point(),
     Point(UINT32_MAX, UINT32_MAX),
@@ -947,6 +1257,10 @@ vector<Change> Patch::get_changes() const {
 
 size_t Patch::get_change_count() const { return change_count; }
 
+uint32_t Patch::get_new_text_size() const {
+  return root ? root->new_subtree_text_size : 0;
+}
+
 optional<Change> Patch::get_bounds() const {
   if (!root) return optional<Change>{};
 
@@ -979,6 +1293,16 @@ vector<Change> Patch::get_changes_in_old_range(Point start, Point end) const {
 }
 
 vector<Change> Patch::get_changes_in_new_range(Point start, Point end) const {
+  if (is_frozen) {
+    auto begin = std::upper_bound(
+      frozen_changes.begin(), frozen_changes.end(), start,
+      [](Point position, const Change &change) { return position < change.new_end; }
+    );
+    auto end_iter = begin;
+    while (end_iter != frozen_changes.end() && end_iter->new_start < end) ++end_iter;
+    return vector<Change>(begin, end_iter);
+  }
+
   return get_changes_in_range<NewCoordinates>(start, end, false);
 }
 
@@ -987,6 +1311,15 @@ optional<Change> Patch::get_change_starting_before_old_position(Point target) co
 }
 
 optional<Change> Patch::get_change_starting_before_new_position(Point target) const {
+  if (is_frozen) {
+    auto iter = std::upper_bound(
+      frozen_changes.begin(), frozen_changes.end(), target,
+      [](Point position, const Change &change) { return position < change.new_start; }
+    );
+    if (iter == frozen_changes.begin()) return optional<Change>{};
+    return *(iter - 1);
+  }
+
   return get_change_starting_before_position<NewCoordinates>(target);
 }
 
@@ -1306,19 +1639,20 @@ Patch::Node *Patch::build_node(Node *left, Node *right,
                        optional<Text> &&old_text, optional<Text> &&new_text,
                        uint32_t old_text_size) {
   change_count++;
-  return new Node{
+  return allocate_node(
     left,
     right,
     old_extent,
     new_extent,
     old_distance_from_left_ancestor,
     new_distance_from_left_ancestor,
-    old_text ? unique_ptr<Text>{new Text(*old_text)} : nullptr,
-    new_text ? unique_ptr<Text>{new Text(*new_text)} : nullptr,
+    old_text ? unique_ptr<Text>{new Text(move(*old_text))} : nullptr,
+    new_text ? unique_ptr<Text>{new Text(move(*new_text))} : nullptr,
     old_text_size
-  };
+  );
 }
 
+
 void Patch::delete_node(Node **node_to_delete) {
   if (*node_to_delete) {
     node_stack.clear();
@@ -1331,7 +1665,7 @@ void Patch::delete_node(Node **node_to_delete) {
         node_stack.push_back(node->left);
       if (node->right)
         node_stack.push_back(node->right);
-      delete node;
+      node_pool->free(node);
       change_count--;
     }
 
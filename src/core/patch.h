@@ -11,15 +11,18 @@
 
 class Patch {
   struct Node;
+  class NodePool;
   struct OldCoordinates;
   struct NewCoordinates;
   struct PositionStackEntry;
 
   Node *root;
+  std::unique_ptr<NodePool> node_pool;
   std::vector<Node *> node_stack;
   std::vector<PositionStackEntry> left_ancestor_stack;
   uint32_t change_count;
   bool merges_adjacent_changes;
+  bool is_frozen;
 
 public:
   struct Change {
@@ -34,6 +37,13 @@ public:
     uint32_t old_text_size;
   };
 
+  struct Splice {
+    Point start;
+    Point deletion_extent;
+    Text inserted_text;
+    uint32_t deleted_text_size;
+  };
+
   // Construction and destruction
   Patch(bool merges_adjacent_changes = true);
   Patch(Patch &&);
@@ -52,13 +62,19 @@ public:
               optional<Text> &&inserted_text = optional<Text>{},
               uint32_t deleted_text_size = 0);
   void splice_old(Point start, Point deletion_extent, Point insertion_extent);
+  std::vector<Change> splice_many(std::vector<Splice> &&);
   bool combine(const Patch &other, bool left_to_right = true);
   void clear();
   void rebalance();
 
+  // Read-only form
+  void freeze();
+  void thaw();
+
   // Non-splaying reads
   std::vector<Change> get_changes() const;
   size_t get_change_count() const;
+  uint32_t get_new_text_size() const;
   std::vector<Change> get_changes_in_old_range(Point start, Point end) const;
   std::vector<Change> get_changes_in_new_range(Point start, Point end) const;
   optional<Change> get_change_starting_before_old_position(Point position) const;
@@ -81,7 +97,7 @@ public:
   std::string get_json() const;
 
 private:
-  Patch(Node *root, uint32_t change_count, bool merges_adjacent_changes);
+  std::vector<Change> frozen_changes;
 
   template <typename CoordinateSpace>
   std::vector<Change> get_changes_in_range(Point, Point, bool inclusive) const;
@@ -120,6 +136,8 @@ private:
   void rotate_node_left(Node *, Node *, Node *);
   void delete_root();
   void perform_rebalancing_rotations(uint32_t);
+  template <typename... Args>
+  Node *allocate_node(Args &&...);
   Node *build_node(Node *, Node *, Point, Point, Point, Point,
                   optional<Text> &&, optional<Text> &&, uint32_t old_text_size);
   void delete_node(Node **);
@@ -0,0 +1,92 @@
+#include "regex-cache.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
+using std::u16string;
+
+static const size_t DEFAULT_MAX_SIZE = 4 * 1024 * 1024;
+
+RegexCache &RegexCache::shared() {
+  static RegexCache cache(DEFAULT_MAX_SIZE);
+  return cache;
+}
+
+RegexCache::RegexCache(size_t max_size) :
+  max_size{max_size}, size{0}, hits{0}, misses{0} {}
+
+bool RegexCache::Key::operator==(const Key &other) const {
+  return
+    pattern == other.pattern &&
+    ignore_case == other.ignore_case &&
+    unicode == other.unicode;
+}
+
+size_t RegexCache::KeyHash::operator()(const Key &key) const {
+  return std::hash<u16string>()(key.pattern) ^ (key.ignore_case << 1) ^ key.unicode;
+}
+
+shared_ptr<const Regex> RegexCache::get(const u16string &pattern, u16string *error_message,
+                                        bool ignore_case, bool unicode) {
+  // Callers may reuse the same string across lookups, and compile errors are
+  // detected below by whether the regex constructor set a message.
+  error_message->clear();
+  Key key{pattern, ignore_case, unicode};
+
+  {
+    lock_guard<mutex> lock(entries_mutex);
+    auto iter = entries_by_key.find(key);
+    if (iter != entries_by_key.end()) {
+      hits++;
+      entries.splice(entries.begin(), entries, iter->second);
+      return iter->second->regex;
+    }
+    misses++;
+  }
+
+  // Compile without holding the lock so that a slow pattern does not block
+  // lookups of other patterns. Patterns that fail to compile are not cached.
+  shared_ptr<const Regex> regex = std::make_shared<Regex>(pattern, error_message, ignore_case, unicode);
+  if (!error_message->empty()) return nullptr;
+
+  size_t entry_size = regex->compiled_size() + pattern.size() * sizeof(char16_t);
+  if (entry_size > max_size) return regex;
+
+  lock_guard<mutex> lock(entries_mutex);
+
+  // Another thread may have compiled the same pattern in the meantime.
+  auto iter = entries_by_key.find(key);
+  if (iter != entries_by_key.end()) {
+    entries.splice(entries.begin(), entries, iter->second);
+    return iter->second->regex;
+  }
+
+  entries.push_front(Entry{key, regex, entry_size});
+  entries_by_key.insert({std::move(key), entries.begin()});
+  size += entry_size;
+  evict();
+  return regex;
+}
+
+void RegexCache::evict() {
+  while (size > max_size) {
+    const Entry &entry = entries.back();
+    size -= entry.size;
+    entries_by_key.erase(entry.key);
+    entries.pop_back();
+  }
+}
+
+RegexCache::Stats RegexCache::stats() const {
+  lock_guard<mutex> lock(entries_mutex);
+  return Stats{hits, misses, entries.size(), size};
+}
+
+void RegexCache::clear() {
+  lock_guard<mutex> lock(entries_mutex);
+  entries_by_key.clear();
+  entries.clear();
+  size = 0;
+  hits = 0;
+  misses = 0;
+}
@@ -0,0 +1,63 @@
+#ifndef SUPERSTRING_REGEX_CACHE_H
+#define SUPERSTRING_REGEX_CACHE_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "regex.h"
+
+// A least-recently-used cache of compiled regexes, keyed by the pattern
+// source and the flags it was compiled with. Compiled regexes are immutable,
+// so the returned pointers can be shared freely between buffers and threads,
+// and they remain valid after being evicted.
+class RegexCache {
+ public:
+  struct Stats {
+    size_t hits;
+    size_t misses;
+    size_t entry_count;
+    size_t size;
+  };
+
+  static RegexCache &shared();
+
+  explicit RegexCache(size_t max_size);
+
+  std::shared_ptr<const Regex> get(const std::u16string &pattern, std::u16string *error_message,
+                                   bool ignore_case = false, bool unicode = false);
+  Stats stats() const;
+  void clear();
+
+ private:
+  struct Key {
+    std::u16string pattern;
+    bool ignore_case;
+    bool unicode;
+
+    bool operator==(const Key &other) const;
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const;
+  };
+
+  struct Entry {
+    Key key;
+    std::shared_ptr<const Regex> regex;
+    size_t size;
+  };
+
+  void evict();
+
+  mutable std::mutex entries_mutex;
+  std::list<Entry> entries;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries_by_key;
+  size_t max_size;
+  size_t size;
+  size_t hits;
+  size_t misses;
+};
+
+#endif  // SUPERSTRING_REGEX_CACHE_H
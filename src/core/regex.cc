@@ -1,13 +1,21 @@
 #include "regex.h"
 #include <stdlib.h>
+#include <ctype.h>
+#include <algorithm>
 #include "pcre2.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using std::u16string;
 using MatchResult = Regex::MatchResult;
 
 const char16_t EMPTY_PATTERN[] = u".{0}";
+static const size_t JIT_STACK_START_SIZE = 32 * 1024;
+static const size_t JIT_STACK_MAX_SIZE = 4 * 1024 * 1024;
 
-Regex::Regex() : code{nullptr} {}
+Regex::Regex() : code{nullptr}, is_literal{false}, ignore_case{false}, may_match_newlines{true}, reach{UINT32_MAX} {}
 
 static u16string preprocess_pattern(const char16_t *pattern, uint32_t length) {
   u16string result;
@@ -46,14 +54,425 @@ static u16string preprocess_pattern(const char16_t *pattern, uint32_t length) {
   return result;
 }
 
+static bool is_ascii_letter(char16_t c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static char16_t fold_case(char16_t c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Extracts the literal characters that every match of the given pattern must
+// begin with, and returns whether the pattern consists entirely of them. This
+// is conservative: any construct that is not a plain or escaped punctuation
+// character ends the prefix, and the prefix is discarded entirely if the
+// rest of the pattern might contain a top-level alternation.
+static bool get_literal_prefix(const u16string &pattern, u16string *prefix) {
+  static const u16string META_CHARACTERS = u"\\^$.|?*+()[]{}";
+  static const u16string QUANTIFIERS = u"?*+{";
+
+  size_t i = 0;
+  while (i < pattern.size()) {
+    char16_t c = pattern[i];
+    size_t next = i + 1;
+    if (c == '\\') {
+      if (next == pattern.size()) break;
+      c = pattern[next];
+      if (c > 127 || isalnum(c)) break;
+      next++;
+    } else if (META_CHARACTERS.find(c) != u16string::npos) {
+      break;
+    }
+    if (next < pattern.size() && QUANTIFIERS.find(pattern[next]) != u16string::npos) break;
+    *prefix += c;
+    i = next;
+  }
+
+  if (i == pattern.size()) return true;
+
+  unsigned depth = 0;
+  for (; i < pattern.size(); i++) {
+    switch (pattern[i]) {
+      case '\\':
+        // Quoted sequences can contain unbalanced parentheses.
+        if (i + 1 < pattern.size() && pattern[i + 1] == 'Q') depth = UINT32_MAX;
+        i++;
+        break;
+      case '[':
+        i++;
+        if (i < pattern.size() && pattern[i] == '^') i++;
+        if (i < pattern.size() && pattern[i] == ']') i++;
+        while (i < pattern.size() && pattern[i] != ']') {
+          if (pattern[i] == '\\') i++;
+          i++;
+        }
+        break;
+      case '(':
+        depth++;
+        break;
+      case ')':
+        if (depth > 0) depth--;
+        break;
+      case '#':
+        // Comments can contain unbalanced parentheses.
+        depth = UINT32_MAX;
+        break;
+      case '|':
+        if (depth == 0) prefix->clear();
+        break;
+    }
+    if (depth == UINT32_MAX) {
+      prefix->clear();
+      break;
+    }
+  }
+
+  return false;
+}
+
+static bool is_single_line_escape(char16_t c) {
+  static const u16string SINGLE_LINE_ESCAPES = u"bBdwShNVtefa";
+  return c > 127 || !isalnum(c) || SINGLE_LINE_ESCAPES.find(c) != u16string::npos;
+}
+
+// Returns false only if no match of the given pattern can contain a newline,
+// or look past one. This errs on the side of returning true: any escape,
+// option or class that might match a newline counts, even if it is negated
+// or only used inside a lookaround.
+static bool may_match_newlines(const u16string &pattern) {
+  for (size_t i = 0; i < pattern.size(); i++) {
+    switch (pattern[i]) {
+      case '\n':
+        return true;
+      case '\\':
+        i++;
+        if (i < pattern.size() && !is_single_line_escape(pattern[i])) return true;
+        break;
+      case '[': {
+        i++;
+        if (i < pattern.size() && (pattern[i] == '^' || pattern[i] == ':')) return true;
+        if (i < pattern.size() && pattern[i] == ']') i++;
 
-Regex::Regex(const char16_t *pattern, uint32_t pattern_length, u16string *error_message, bool ignore_case, bool unicode) {
+        // Ranges such as '\t-~' contain the newline character.
+        bool previous_item_may_precede_newline = false;
+        for (; i < pattern.size() && pattern[i] != ']'; i++) {
+          char16_t c = pattern[i];
+          if (c == '\n') return true;
+          if (c == '[' && i + 1 < pattern.size() && pattern[i + 1] == ':') return true;
+          if (c == '-' && previous_item_may_precede_newline) return true;
+          if (c == '\\') {
+            i++;
+            if (i < pattern.size() && !is_single_line_escape(pattern[i])) return true;
+            previous_item_may_precede_newline = true;
+          } else {
+            previous_item_may_precede_newline = c < '\n';
+          }
+        }
+        break;
+      }
+      case '(':
+        if (i + 1 < pattern.size() && pattern[i + 1] == '*') return true;
+        if (i + 1 < pattern.size() && pattern[i + 1] == '?') {
+          for (size_t j = i + 2; j < pattern.size(); j++) {
+            char16_t c = pattern[j];
+            if (c == 's') return true;
+            if (!is_ascii_letter(c) && c != '-' && c != '^') break;
+          }
+        }
+        break;
+    }
+  }
+
+  return false;
+}
+
+// Bounds how far past its start an attempt to match the given pattern can
+// look, in code units. Like `may_match_newlines`, this errs on the side of
+// returning UINT32_MAX, meaning that there is no bound: any construct that
+// is not recognized counts, as do unbounded quantifiers and backreferences.
+class ReachBound {
+  const u16string &pattern;
+  size_t i;
+  uint64_t unit_width;
+
+  struct Reach {
+    uint64_t length;
+    uint64_t reach;
+  };
+
+  static const uint64_t UNBOUNDED = UINT32_MAX;
+
+  static uint64_t cap(uint64_t value) {
+    return std::min(value, UNBOUNDED);
+  }
+
+  static Reach unbounded() {
+    return Reach{UNBOUNDED, UNBOUNDED};
+  }
+
+  bool at(char16_t c, size_t offset = 0) const {
+    return i + offset < pattern.size() && pattern[i + offset] == c;
+  }
+
+  void skip_braces() {
+    if (!at('{')) return;
+    while (i < pattern.size() && pattern[i] != '}') i++;
+    i++;
+  }
+
+  Reach parse_alternation() {
+    Reach result{0, 0};
+    Reach branch{0, 0};
+    for (;;) {
+      if (i >= pattern.size() || pattern[i] == ')') break;
+      if (pattern[i] == '|') {
+        result.length = std::max(result.length, branch.length);
+        result.reach = std::max(result.reach, branch.reach);
+        branch = Reach{0, 0};
+        i++;
+        continue;
+      }
+
+      Reach item = parse_quantifier(parse_item());
+      branch.reach = cap(std::max(branch.reach, branch.length + item.reach));
+      branch.length = cap(branch.length + item.length);
+      if (branch.reach == UNBOUNDED) return unbounded();
+    }
+    result.length = std::max(result.length, branch.length);
+    result.reach = std::max(result.reach, branch.reach);
+    return result;
+  }
+
+  Reach parse_group() {
+    i++;
+    bool is_lookaround = false;
+    if (at('*')) return unbounded();
+    if (at('?')) {
+      i++;
+      if (at('#')) {
+        while (i < pattern.size() && pattern[i] != ')') i++;
+        i++;
+        return Reach{0, 0};
+      } else if (at(':') || at('>') || at('|')) {
+        i++;
+      } else if (at('=') || at('!')) {
+        is_lookaround = true;
+        i++;
+      } else if (at('<') && (at('=', 1) || at('!', 1))) {
+        is_lookaround = true;
+        i += 2;
+      } else if (at('<') || at('\'') || (at('P') && at('<', 1))) {
+        // Named groups.
+        if (at('P')) i++;
+        char16_t terminator = at('<') ? '>' : '\'';
+        i++;
+        while (i < pattern.size() && pattern[i] != terminator) i++;
+        i++;
+      } else {
+        // Options such as `(?i)` or `(?i:`. Extended mode changes how the
+        // rest of the pattern is parsed.
+        static const u16string OPTION_LETTERS = u"imnsJU-^";
+        while (i < pattern.size() && OPTION_LETTERS.find(pattern[i]) != u16string::npos) i++;
+        if (at('x')) return unbounded();
+        if (at(')')) {
+          i++;
+          return Reach{0, 0};
+        }
+        if (!at(':')) return unbounded();
+        i++;
+      }
+    }
+
+    Reach result = parse_alternation();
+    if (!at(')')) return unbounded();
+    i++;
+    if (is_lookaround) result.length = 0;
+    return result;
+  }
+
+  Reach parse_class() {
+    i++;
+    if (at('^')) i++;
+    if (at(']')) i++;
+    while (i < pattern.size() && pattern[i] != ']') {
+      if (pattern[i] == '\\') {
+        i++;
+      } else if (at('[') && at(':', 1)) {
+        i += 2;
+        while (i < pattern.size() && !(at(':') && at(']', 1))) i++;
+        i++;
+      }
+      i++;
+    }
+    if (i >= pattern.size()) return unbounded();
+    i++;
+    return Reach{unit_width, unit_width};
+  }
+
+  Reach parse_escape() {
+    static const u16string CHARACTER_ESCAPES = u"dDwWsShHvVtnrfeaCN";
+    i++;
+    if (i >= pattern.size()) return unbounded();
+    char16_t c = pattern[i++];
+    if (c > 127 || !isalnum(c) || CHARACTER_ESCAPES.find(c) != u16string::npos) {
+      if (c == 'N') skip_braces();
+      return Reach{unit_width, unit_width};
+    }
+
+    switch (c) {
+      case 'A':
+      case 'G':
+      case 'K':
+      case 'E':
+        return Reach{0, 0};
+      case 'b':
+      case 'B':
+      case 'z':
+        return Reach{0, 1};
+      case 'Z':
+        return Reach{0, 2};
+      case 'R':
+        return Reach{2, 2};
+      case 'Q': {
+        uint64_t length = 0;
+        while (i < pattern.size() && !(at('\\') && at('E', 1))) {
+          length += unit_width;
+          i++;
+        }
+        i += 2;
+        return Reach{cap(length), cap(length)};
+      }
+      case 'x':
+      case 'o':
+        if (at('{')) {
+          skip_braces();
+        } else {
+          for (unsigned j = 0; j < 2 && i < pattern.size() && isxdigit(pattern[i]); j++) i++;
+        }
+        return Reach{unit_width, unit_width};
+      case '0':
+        for (unsigned j = 0; j < 2 && i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '7'; j++) i++;
+        return Reach{unit_width, unit_width};
+      case 'c':
+        i++;
+        return Reach{unit_width, unit_width};
+      case 'p':
+      case 'P':
+        if (at('{')) {
+          skip_braces();
+        } else {
+          i++;
+        }
+        return Reach{unit_width, unit_width};
+      default:
+        // Backreferences, subroutine calls, grapheme clusters and escapes
+        // that aren't recognized.
+        return unbounded();
+    }
+  }
+
+  Reach parse_item() {
+    switch (pattern[i]) {
+      case '(':
+        return parse_group();
+      case '[':
+        return parse_class();
+      case '\\':
+        return parse_escape();
+      case '^':
+        i++;
+        return Reach{0, 0};
+      case '$':
+        i++;
+        return Reach{0, 2};
+      case '*':
+      case '+':
+      case '?':
+        return unbounded();
+      default:
+        i++;
+        return Reach{unit_width, unit_width};
+    }
+  }
+
+  bool parse_count(uint64_t *count) {
+    size_t start = i;
+    uint64_t value = 0;
+    while (i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9') {
+      value = cap(value * 10 + (pattern[i] - '0'));
+      i++;
+    }
+    *count = value;
+    return i > start;
+  }
+
+  Reach parse_quantifier(Reach item) {
+    if (i >= pattern.size()) return item;
+    uint64_t max_count;
+    switch (pattern[i]) {
+      case '*':
+      case '+':
+        return unbounded();
+      case '?':
+        i++;
+        max_count = 1;
+        break;
+      case '{': {
+        size_t start = i;
+        i++;
+        uint64_t min_count;
+        if (!parse_count(&min_count)) {
+          i = start;
+          return item;
+        }
+        max_count = min_count;
+        if (at(',')) {
+          i++;
+          if (!parse_count(&max_count)) max_count = UNBOUNDED;
+        }
+        if (!at('}')) {
+          i = start;
+          return item;
+        }
+        i++;
+        break;
+      }
+      default:
+        return item;
+    }
+
+    if (at('?') || at('+')) i++;
+    if (max_count == 0) return Reach{0, 0};
+    if (max_count == UNBOUNDED && item.reach > 0) return unbounded();
+    return Reach{
+      cap(item.length * max_count),
+      cap(item.length * (max_count - 1) + item.reach)
+    };
+  }
+
+ public:
+  ReachBound(const u16string &pattern, bool unicode) :
+    pattern{pattern}, i{0}, unit_width{unicode ? 2u : 1u} {}
+
+  uint32_t get() {
+    Reach result = parse_alternation();
+    if (i < pattern.size()) return UINT32_MAX;
+    return result.reach;
+  }
+};
+
+const uint64_t ReachBound::UNBOUNDED;
+
+Regex::Regex(const char16_t *pattern, uint32_t pattern_length, u16string *error_message, bool ignore_case, bool unicode)
+  : is_literal{false}, ignore_case{ignore_case} {
   if (pattern_length == 0) {
     pattern = EMPTY_PATTERN;
     pattern_length = 4;
   }
 
   u16string final_pattern = preprocess_pattern(pattern, pattern_length);
+  may_match_newlines = ::may_match_newlines(final_pattern);
+  reach = ReachBound(final_pattern, unicode).get();
 
   int error_number = 0;
   size_t error_offset = 0;
@@ -80,12 +499,28 @@ Regex::Regex(const char16_t *pattern, uint32_t pattern_length, u16string *error_
     code,
     PCRE2_JIT_COMPLETE|PCRE2_JIT_PARTIAL_HARD|PCRE2_JIT_PARTIAL_SOFT
   );
+
+  // In UTF mode, PCRE validates the subject and folds case using Unicode
+  // properties, so literal patterns are only searched for directly without
+  // the unicode flag. Without it, only ASCII letters are folded.
+  if (!unicode) {
+    is_literal = get_literal_prefix(final_pattern, &literal_prefix);
+    if (ignore_case) {
+      for (char16_t &c : literal_prefix) c = fold_case(c);
+    }
+  }
 }
 
 Regex::Regex(const u16string &pattern, u16string *error_message, bool ignore_case, bool unicode)
   : Regex(pattern.data(), pattern.size(), error_message, ignore_case, unicode) {}
 
-Regex::Regex(Regex &&other) : code{other.code} {
+Regex::Regex(Regex &&other) :
+  code{other.code},
+  literal_prefix{std::move(other.literal_prefix)},
+  is_literal{other.is_literal},
+  ignore_case{other.ignore_case},
+  may_match_newlines{other.may_match_newlines},
+  reach{other.reach} {
   other.code = nullptr;
 }
 
@@ -93,17 +528,140 @@ Regex::~Regex() {
   if (code) pcre2_code_free(code);
 }
 
+size_t Regex::compiled_size() const {
+  if (!code) return 0;
+  size_t size = 0, jit_size = 0;
+  pcre2_pattern_info(code, PCRE2_INFO_SIZE, &size);
+  pcre2_pattern_info(code, PCRE2_INFO_JITSIZE, &jit_size);
+  return size + jit_size;
+}
+
 Regex::MatchData::MatchData(const Regex &regex)
-  : data{pcre2_match_data_create_from_pattern(regex.code, nullptr)} {}
+  : data{pcre2_match_data_create_from_pattern(regex.code, nullptr)},
+    context{nullptr} {}
 
 Regex::MatchData::~MatchData() {
   pcre2_match_data_free(data);
+  if (context) pcre2_match_context_free(context);
+}
+
+// JIT-compiled patterns run on a 32KB region of the machine stack by default,
+// which deeply nested patterns can exhaust. In that case we retry the match
+// on a larger JIT stack. Each thread lazily allocates one such stack and
+// reuses it for all subsequent matches.
+namespace {
+
+struct JITStack {
+  pcre2_jit_stack *stack = nullptr;
+
+  ~JITStack() {
+    if (stack) pcre2_jit_stack_free(stack);
+  }
+};
+
+}
+
+static pcre2_jit_stack *get_jit_stack_for_current_thread(void *) {
+  static thread_local JITStack jit_stack;
+  if (!jit_stack.stack) {
+    jit_stack.stack = pcre2_jit_stack_create(JIT_STACK_START_SIZE, JIT_STACK_MAX_SIZE, nullptr);
+  }
+  return jit_stack.stack;
+}
+
+bool Regex::can_match_newlines() const {
+  return may_match_newlines;
+}
+
+uint32_t Regex::max_reach() const {
+  return reach;
+}
+
+uint32_t Regex::max_lookbehind() const {
+  uint32_t result = 0;
+  if (code) pcre2_pattern_info(code, PCRE2_INFO_MAXLOOKBEHIND, &result);
+  return result;
+}
+
+static bool literal_matches_at(const char16_t *data, const u16string &literal,
+                               size_t count, bool ignore_case) {
+  if (ignore_case) {
+    for (size_t i = 0; i < count; i++) {
+      if (fold_case(data[i]) != literal[i]) return false;
+    }
+    return true;
+  } else {
+    return std::equal(data, data + count, literal.data());
+  }
+}
+
+// Returns the offset of the first occurrence of the given literal in the
+// data at or after the given start offset. If there is none, returns the
+// offset of the first non-empty suffix of the data that is a prefix of the
+// literal, and failing that, the length of the data.
+static size_t find_literal(const char16_t *data, size_t length, size_t start,
+                           const u16string &literal, bool ignore_case) {
+  size_t offset = start;
+  size_t literal_length = literal.size();
+
+#ifdef __SSE2__
+  // Compare the first and last characters of the literal against eight
+  // candidate positions at a time, and only check the remaining characters
+  // at positions where both of those match. When ignoring case, setting the
+  // 0x20 bit maps an ASCII letter to its lowercase form without mapping any
+  // other character to that letter.
+  char16_t first = literal.front(), last = literal.back();
+  const __m128i first_vector = _mm_set1_epi16(first);
+  const __m128i last_vector = _mm_set1_epi16(last);
+  const __m128i first_fold = _mm_set1_epi16(ignore_case && is_ascii_letter(first) ? 0x20 : 0);
+  const __m128i last_fold = _mm_set1_epi16(ignore_case && is_ascii_letter(last) ? 0x20 : 0);
+  for (; offset + literal_length + 7 <= length; offset += 8) {
+    __m128i first_block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offset));
+    __m128i last_block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offset + literal_length - 1));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+      _mm_cmpeq_epi16(_mm_or_si128(first_block, first_fold), first_vector),
+      _mm_cmpeq_epi16(_mm_or_si128(last_block, last_fold), last_vector)
+    ));
+    while (mask) {
+      unsigned index = __builtin_ctz(mask) / 2;
+      if (literal_matches_at(data + offset + index, literal, literal_length, ignore_case)) {
+        return offset + index;
+      }
+      mask &= ~(3u << (index * 2));
+    }
+  }
+#endif
+
+  for (; offset < length; offset++) {
+    size_t count = length - offset < literal_length ? length - offset : literal_length;
+    if (literal_matches_at(data + offset, literal, count, ignore_case)) return offset;
+  }
+
+  return length;
 }
 
 MatchResult Regex::match(const char16_t *string, size_t length,
-                         MatchData &match_data, unsigned options) const {
+                         MatchData &match_data, unsigned options,
+                         size_t start_offset) const {
   MatchResult result{MatchResult::None, 0, 0};
 
+  // Search for literal patterns and literal prefixes directly, so that PCRE
+  // only runs at positions where a match can start.
+  if (!literal_prefix.empty()) {
+    size_t literal_offset = find_literal(string, length, start_offset, literal_prefix, ignore_case);
+    bool is_partial = literal_offset + literal_prefix.size() > length;
+    if (literal_offset == length || (is_partial && (options & MatchOptions::IsEndSearch))) {
+      return result;
+    }
+    if (is_literal) {
+      result.type = is_partial ? MatchResult::Partial : MatchResult::Full;
+      result.start_offset = literal_offset;
+      result.end_offset = is_partial ? length : literal_offset + literal_prefix.size();
+      return result;
+    }
+    start_offset = literal_offset;
+  }
+
   unsigned int pcre_options = 0;
   if (!(options & MatchOptions::IsEndSearch)) pcre_options |= PCRE2_PARTIAL_HARD;
   if (!(options & MatchOptions::IsBeginningOfLine)) pcre_options |= PCRE2_NOTBOL;
@@ -113,12 +671,26 @@ MatchResult Regex::match(const char16_t *string, size_t length,
     code,
     reinterpret_cast<const uint16_t *>(string),
     length,
-    0,
+    start_offset,
     pcre_options,
     match_data.data,
-    nullptr
+    match_data.context
   );
 
+  if (status == PCRE2_ERROR_JIT_STACKLIMIT && !match_data.context) {
+    match_data.context = pcre2_match_context_create(nullptr);
+    pcre2_jit_stack_assign(match_data.context, get_jit_stack_for_current_thread, nullptr);
+    status = pcre2_match(
+      code,
+      reinterpret_cast<const uint16_t *>(string),
+      length,
+      start_offset,
+      pcre_options,
+      match_data.data,
+      match_data.context
+    );
+  }
+
   if (status < 0) {
     switch (status) {
       case PCRE2_ERROR_PARTIAL:
@@ -6,10 +6,16 @@
 
 struct pcre2_real_code_16;
 struct pcre2_real_match_data_16;
+struct pcre2_real_match_context_16;
 struct BuildRegexResult;
 
 class Regex {
   pcre2_real_code_16 *code;
+  std::u16string literal_prefix;
+  bool is_literal;
+  bool ignore_case;
+  bool may_match_newlines;
+  uint32_t reach;
   Regex(pcre2_real_code_16 *);
 
  public:
@@ -19,8 +25,17 @@ class Regex {
   Regex(Regex &&);
   ~Regex();
 
+  size_t compiled_size() const;
+  bool can_match_newlines() const;
+  uint32_t max_lookbehind() const;
+
+  // The number of code units past the position where an attempt to match
+  // starts that the attempt can examine, or UINT32_MAX if it isn't bounded.
+  uint32_t max_reach() const;
+
   class MatchData {
     pcre2_real_match_data_16 *data;
+    pcre2_real_match_context_16 *context;
     friend class Regex;
 
    public:
@@ -47,7 +62,8 @@ class Regex {
     IsEndSearch = 4,
   };
 
-  MatchResult match(const char16_t *data, size_t length, MatchData &, unsigned options = 0) const;
+  MatchResult match(const char16_t *data, size_t length, MatchData &, unsigned options = 0,
+                    size_t start_offset = 0) const;
 };
 
 struct BuildRegexResult {
@@ -0,0 +1,207 @@
+#include "search-session.h"
+#include <algorithm>
+#include "text-buffer.h"
+
+using std::move;
+using std::shared_ptr;
+using std::vector;
+using Update = SearchSession::Update;
+
+SearchSession::SearchSession(TextBuffer &buffer, shared_ptr<const Regex> regex) :
+  buffer{&buffer}, regex{move(regex)}, next_id{0}, count{0} {
+  buffer.search_sessions.push_back(this);
+  for (const Range &range : buffer.find_all(*this->regex)) {
+    matches.insert(next_id++, range.start, range.end);
+    count++;
+  }
+}
+
+SearchSession::~SearchSession() {
+  if (buffer) {
+    auto &sessions = buffer->search_sessions;
+    sessions.erase(std::find(sessions.begin(), sessions.end(), this));
+  }
+}
+
+vector<Range> SearchSession::get_matches() {
+  return get_matches_in_range(Range{Point(), Point::max()});
+}
+
+vector<Range> SearchSession::get_matches_in_range(Range range) {
+  vector<Range> result;
+  for (MarkerIndex::MarkerId id : matches.find_intersecting(range.start, range.end)) {
+    result.push_back(matches.get_range(id));
+  }
+  std::sort(result.begin(), result.end(), [](const Range &a, const Range &b) {
+    return a.start < b.start;
+  });
+  return result;
+}
+
+size_t SearchSession::match_count() const {
+  return count;
+}
+
+// Called by the buffer after each edit, with positions that have already
+// been clipped to the text that preceded the edit. The changed range is
+// merged with those recorded since the last update, after moving them past
+// the edit in the same way as the matches.
+void SearchSession::splice(Point start, Point deletion_extent, Point insertion_extent) {
+  matches.splice(start, deletion_extent, insertion_extent);
+
+  Point deletion_end = start.traverse(deletion_extent);
+  Point insertion_end = start.traverse(insertion_extent);
+  auto translate = [&](Point position, Point position_if_deleted) {
+    if (position <= start) return position;
+    if (position >= deletion_end) return insertion_end.traverse(position.traversal(deletion_end));
+    return position_if_deleted;
+  };
+
+  Range changed_range{start, insertion_end};
+  vector<Range> result;
+  bool inserted = false;
+  for (Range range : changed_ranges) {
+    range.start = translate(range.start, start);
+    range.end = translate(range.end, insertion_end);
+    if (range.end < changed_range.start) {
+      result.push_back(range);
+    } else if (range.start > changed_range.end) {
+      if (!inserted) result.push_back(changed_range);
+      inserted = true;
+      result.push_back(range);
+    } else {
+      changed_range.start = Point::min(changed_range.start, range.start);
+      changed_range.end = Point::max(changed_range.end, range.end);
+    }
+  }
+  if (!inserted) result.push_back(changed_range);
+  changed_ranges = move(result);
+}
+
+// Searches the text around each changed range again, starting from a
+// position where a search of the whole buffer would be between matches. That
+// search continues past the changed range until it reaches a position where
+// both it and the search that found the existing matches are between matches
+// again, and where the text visible to lookbehinds is unchanged. From there
+// on, the two searches would find the same matches.
+Update SearchSession::update() {
+  Update result;
+  if (!buffer) return result;
+
+  vector<Range> ranges = move(changed_ranges);
+  changed_ranges.clear();
+
+  Point extent = buffer->extent();
+  size_t i = 0;
+  while (i < ranges.size()) {
+    Point search_start = get_search_start(ranges[i]);
+    Point stop = get_search_stop(ranges[i]);
+    i++;
+
+    vector<Range> new_ranges;
+    Point resume_position = search_start;
+    for (;;) {
+      while (i < ranges.size() && get_search_start(ranges[i]) <= stop) {
+        stop = Point::max(stop, get_search_stop(ranges[i]));
+        i++;
+      }
+
+      while (!new_ranges.empty() && new_ranges.back().start >= resume_position) new_ranges.pop_back();
+      buffer->scan_from(*regex, resume_position, stop, [&new_ranges](Range range) {
+        new_ranges.push_back(range);
+        return false;
+      });
+      if (stop >= extent) break;
+
+      // Only the last new match starting before the stop position can
+      // contain it, while the existing matches are looked up.
+      Point next_stop = stop;
+      resume_position = stop;
+      for (auto range = new_ranges.rbegin(); range != new_ranges.rend(); ++range) {
+        if (range->start < stop) {
+          if (range->end > stop) next_stop = resume_position = range->end;
+          break;
+        }
+      }
+      for (MarkerIndex::MarkerId id : matches.find_containing(stop, stop)) {
+        Range range = matches.get_range(id);
+        if (range.start < stop && range.end > stop) next_stop = Point::max(next_stop, range.end);
+      }
+      if (next_stop == stop) break;
+      stop = next_stop;
+    }
+
+    bool includes_end = stop >= extent;
+    while (!new_ranges.empty() && !includes_end && new_ranges.back().start >= stop) new_ranges.pop_back();
+    replace_matches(get_matches_starting_in(search_start, stop, includes_end), new_ranges, &result);
+  }
+
+  return result;
+}
+
+// Any attempt to match that starts before the returned position can't have
+// looked as far as the changed range. Patterns that can't match newlines only
+// look at their own line, including its line ending, so the search can start
+// at the beginning of the line. Other patterns are searched from the start of
+// the line that contains the earliest position from which an attempt could
+// reach the changed range. If that position is within an existing match, the
+// search resumes at the end of the match, since the match is unaffected.
+Point SearchSession::get_search_start(Range changed_range) {
+  uint32_t reach = regex->can_match_newlines() ? regex->max_reach() : 2;
+  if (reach == UINT32_MAX) return Point();
+
+  uint32_t offset = buffer->clip_position(changed_range.start).offset;
+  Point result(buffer->position_for_offset(offset > reach ? offset - reach : 0).row, 0);
+  for (MarkerIndex::MarkerId id : matches.find_containing(result, result)) {
+    Range range = matches.get_range(id);
+    if (range.start < result && range.end > result) result = range.end;
+  }
+  return result;
+}
+
+// Matches that start at or after the returned position can only see the
+// changed range through their lookbehinds, so the search must at least go
+// past the longest lookbehind in the pattern. It then continues to the end
+// of the line.
+Point SearchSession::get_search_stop(Range changed_range) {
+  uint32_t offset = buffer->clip_position(changed_range.end).offset;
+  offset += std::max(regex->max_lookbehind(), 1u);
+  Point position = buffer->position_for_offset(std::min(offset, buffer->size()));
+  return Point::min(Point(position.row + 1, 0), buffer->extent());
+}
+
+vector<SearchSession::Match> SearchSession::get_matches_starting_in(Point start, Point end, bool include_end) {
+  vector<Match> result;
+  for (MarkerIndex::MarkerId id : matches.find_starting_in(start, end)) {
+    Range range = matches.get_range(id);
+    if (include_end || range.start < end) result.push_back(Match{id, range});
+  }
+  std::sort(result.begin(), result.end(), [](const Match &a, const Match &b) {
+    return a.range.start < b.range.start;
+  });
+  return result;
+}
+
+void SearchSession::replace_matches(const vector<Match> &old_matches, const vector<Range> &new_ranges,
+                                    Update *update) {
+  auto old_match = old_matches.begin();
+  auto new_range = new_ranges.begin();
+  while (old_match != old_matches.end() || new_range != new_ranges.end()) {
+    if (old_match != old_matches.end() && new_range != new_ranges.end() && old_match->range == *new_range) {
+      ++old_match;
+      ++new_range;
+    } else if (new_range == new_ranges.end() ||
+               (old_match != old_matches.end() && old_match->range.start <= new_range->start)) {
+      matches.remove(old_match->id);
+      update->removed.push_back(old_match->range);
+      count--;
+      ++old_match;
+    } else {
+      matches.insert(next_id, new_range->start, new_range->end);
+      next_id++;
+      update->added.push_back(*new_range);
+      count++;
+      ++new_range;
+    }
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef SUPERSTRING_SEARCH_SESSION_H
+#define SUPERSTRING_SEARCH_SESSION_H
+
+#include <memory>
+#include <vector>
+#include "marker-index.h"
+#include "range.h"
+#include "regex.h"
+
+class TextBuffer;
+
+// Holds all of the matches for a regex in a buffer, and keeps them current
+// as the buffer changes. The buffer reports each of its edits to the session,
+// which moves the existing matches accordingly and records the text that
+// needs to be searched again. Calling `update` searches that text and returns
+// the matches that were removed and added. The buffer must outlive the
+// session, or at least no session method may be called once it is gone.
+class SearchSession {
+ public:
+  struct Update {
+    std::vector<Range> removed;
+    std::vector<Range> added;
+  };
+
+  SearchSession(TextBuffer &, std::shared_ptr<const Regex>);
+  SearchSession(const SearchSession &) = delete;
+  ~SearchSession();
+
+  // These reflect the buffer's text as of the last call to `update`.
+  std::vector<Range> get_matches();
+  std::vector<Range> get_matches_in_range(Range);
+  size_t match_count() const;
+
+  Update update();
+
+ private:
+  friend class TextBuffer;
+
+  struct Match {
+    MarkerIndex::MarkerId id;
+    Range range;
+  };
+
+  void splice(Point start, Point deletion_extent, Point insertion_extent);
+  Point get_search_start(Range changed_range);
+  Point get_search_stop(Range changed_range);
+  std::vector<Match> get_matches_starting_in(Point start, Point end, bool include_end);
+  void replace_matches(const std::vector<Match> &, const std::vector<Range> &, Update *);
+
+  TextBuffer *buffer;
+  std::shared_ptr<const Regex> regex;
+  MarkerIndex matches;
+  MarkerIndex::MarkerId next_id;
+  size_t count;
+  std::vector<Range> changed_ranges;
+};
+
+#endif  // SUPERSTRING_SEARCH_SESSION_H
@@ -0,0 +1,202 @@
+#ifndef SUPERSTRING_SMALL_VECTOR_H
+#define SUPERSTRING_SMALL_VECTOR_H
+
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+#include <vector>
+
+// A vector of trivially copyable elements that stores up to N elements
+// inline, and only allocates once it grows beyond that.
+template <typename T, uint32_t N> class small_vector {
+  static_assert(std::is_trivially_copyable<T>::value, "small_vector elements must be trivially copyable");
+
+  T *elements;
+  uint32_t size_;
+  uint32_t capacity_;
+  T inline_elements[N];
+
+  bool is_inline() const { return elements == inline_elements; }
+
+  // Like the allocations made with `new` elsewhere, a failed allocation
+  // throws, leaving the vector unchanged.
+  void grow(uint32_t min_capacity) {
+    uint32_t new_capacity = std::max(min_capacity, capacity_ * 2);
+    T *new_elements;
+    if (is_inline()) {
+      new_elements = static_cast<T *>(malloc(new_capacity * sizeof(T)));
+      if (!new_elements) throw std::bad_alloc();
+      memcpy(new_elements, elements, size_ * sizeof(T));
+    } else {
+      new_elements = static_cast<T *>(realloc(elements, new_capacity * sizeof(T)));
+      if (!new_elements) throw std::bad_alloc();
+    }
+    elements = new_elements;
+    capacity_ = new_capacity;
+  }
+
+  // Opens a gap of the given size at the index, growing if necessary.
+  void open_gap(uint32_t index, uint32_t count) {
+    if (size_ + count > capacity_) grow(size_ + count);
+    std::copy_backward(elements + index, elements + size_, elements + size_ + count);
+    size_ += count;
+  }
+
+  template <typename Iter>
+  void insert_range(uint32_t index, Iter begin, Iter end, std::false_type) {
+    open_gap(index, end - begin);
+    std::copy(begin, end, elements + index);
+  }
+
+  // The inserted elements might belong to this vector. In that case they are
+  // found again by their index once the vector has grown, and the ones that
+  // followed the insertion point are found where the gap moved them.
+  void insert_range(uint32_t index, const T *begin, const T *end, std::true_type) {
+    std::less<const T *> less;
+    if (less(begin, elements) || !less(begin, elements + size_)) {
+      return insert_range(index, begin, end, std::false_type());
+    }
+
+    uint32_t count = end - begin;
+    uint32_t source_index = begin - elements;
+    open_gap(index, count);
+    const T *source = elements + source_index;
+    uint32_t count_before_gap = source_index < index ? std::min(count, index - source_index) : 0;
+    std::copy(source, source + count_before_gap, elements + index);
+    std::copy(source + count + count_before_gap, source + 2 * count, elements + index + count_before_gap);
+  }
+
+  template <typename Iter>
+  void append(Iter begin, Iter end) {
+    uint32_t count = end - begin;
+    if (size_ + count > capacity_) grow(size_ + count);
+    std::copy(begin, end, elements + size_);
+    size_ += count;
+  }
+
+public:
+  using value_type = T;
+  using iterator = T *;
+  using const_iterator = const T *;
+
+  small_vector() : elements{inline_elements}, size_{0}, capacity_{N} {}
+
+  small_vector(std::initializer_list<T> list) : small_vector() {
+    append(list.begin(), list.end());
+  }
+
+  explicit small_vector(const std::vector<T> &vector) : small_vector() {
+    append(vector.begin(), vector.end());
+  }
+
+  small_vector(const small_vector &other) : small_vector() {
+    append(other.begin(), other.end());
+  }
+
+  small_vector(small_vector &&other) : small_vector() {
+    *this = std::move(other);
+  }
+
+  ~small_vector() {
+    if (!is_inline()) free(elements);
+  }
+
+  small_vector &operator=(const small_vector &other) {
+    if (this != &other) {
+      size_ = 0;
+      append(other.begin(), other.end());
+    }
+    return *this;
+  }
+
+  small_vector &operator=(small_vector &&other) {
+    if (this == &other) return *this;
+    if (!is_inline()) free(elements);
+    if (other.is_inline()) {
+      elements = inline_elements;
+      capacity_ = N;
+      std::copy(other.begin(), other.end(), elements);
+    } else {
+      elements = other.elements;
+      capacity_ = other.capacity_;
+      other.elements = other.inline_elements;
+      other.capacity_ = N;
+    }
+    size_ = other.size_;
+    other.size_ = 0;
+    return *this;
+  }
+
+  uint32_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  uint32_t capacity() const { return capacity_; }
+
+  T *data() { return elements; }
+  const T *data() const { return elements; }
+  iterator begin() { return elements; }
+  iterator end() { return elements + size_; }
+  const_iterator begin() const { return elements; }
+  const_iterator end() const { return elements + size_; }
+  const_iterator cbegin() const { return elements; }
+  const_iterator cend() const { return elements + size_; }
+
+  T &operator[](uint32_t index) { return elements[index]; }
+  const T &operator[](uint32_t index) const { return elements[index]; }
+  T &front() { return elements[0]; }
+  const T &front() const { return elements[0]; }
+  T &back() { return elements[size_ - 1]; }
+  const T &back() const { return elements[size_ - 1]; }
+
+  void reserve(uint32_t capacity) {
+    if (capacity > capacity_) grow(capacity);
+  }
+
+  void resize(uint32_t size) {
+    if (size > capacity_) grow(size);
+    if (size > size_) std::fill(elements + size_, elements + size, T());
+    size_ = size;
+  }
+
+  void clear() {
+    size_ = 0;
+  }
+
+  void push_back(const T &value) {
+    T copy = value;
+    if (size_ == capacity_) grow(size_ + 1);
+    elements[size_++] = copy;
+  }
+
+  void assign(std::initializer_list<T> list) {
+    size_ = 0;
+    append(list.begin(), list.end());
+  }
+
+  template <typename Iter>
+  iterator insert(const_iterator position, Iter begin, Iter end) {
+    uint32_t index = position - elements;
+    if (begin != end) {
+      insert_range(index, begin, end, typename std::is_convertible<Iter, const T *>::type());
+    }
+    return elements + index;
+  }
+
+  bool operator==(const small_vector &other) const {
+    return size_ == other.size_ && std::equal(begin(), end(), other.begin());
+  }
+
+  bool operator!=(const small_vector &other) const {
+    return !(*this == other);
+  }
+
+  bool operator==(const std::vector<T> &other) const {
+    return size_ == other.size() && std::equal(begin(), end(), other.begin());
+  }
+};
+
+#endif // SUPERSTRING_SMALL_VECTOR_H
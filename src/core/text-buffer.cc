@@ -1,6 +1,8 @@
 #include "text-slice.h"
 #include "text-buffer.h"
 #include "regex.h"
+#include "search-session.h"
+#include "thread-pool.h"
 #include <algorithm>
 #include <cassert>
 #include <cwctype>
@@ -8,7 +10,6 @@
 #include <unordered_map>
 #include <vector>
 
-using std::equal;
 using std::move;
 using std::pair;
 using std::string;
@@ -19,20 +20,31 @@ using MatchResult = Regex::MatchResult;
 using SubsequenceMatch = TextBuffer::SubsequenceMatch;
 
 uint32_t TextBuffer::MAX_CHUNK_SIZE_TO_COPY = 1024;
+uint32_t TextBuffer::MIN_PARALLEL_SEARCH_SEGMENT_SIZE = 1024 * 1024;
+static const uint32_t SEARCH_SEGMENTS_PER_THREAD = 4;
 
 static Text EMPTY_TEXT;
 
+static void apply_changes(ChunkedText &text, const vector<Patch::Change> &changes) {
+  vector<ChunkedText::Splice> splices;
+  splices.reserve(changes.size());
+  for (const auto &change : changes) {
+    splices.push_back({change.old_start, change.old_end, TextSlice(*change.new_text)});
+  }
+  text.splice(splices);
+}
+
 struct TextBuffer::Layer {
   Layer *previous_layer;
   Patch patch;
-  optional<Text> text;
+  optional<ChunkedText> text;
   bool uses_patch;
 
   Point extent_;
   uint32_t size_;
   uint32_t snapshot_count;
 
-  Layer(Text &&text) :
+  Layer(ChunkedText &&text) :
     previous_layer{nullptr},
     text{move(text)},
     uses_patch{false},
@@ -75,13 +87,10 @@ struct TextBuffer::Layer {
     }
   }
 
-  ClipResult clip_position(Point position, bool splay = false) {
+  ClipResult clip_position(Point position) const {
     if (!uses_patch) return text->clip_position(position);
-    if (snapshot_count > 0) splay = false;
 
-    auto preceding_change = splay ?
-      patch.grab_change_starting_before_new_position(position) :
-      patch.get_change_starting_before_new_position(position);
+    auto preceding_change = patch.get_change_starting_before_new_position(position);
     if (!preceding_change) return previous_layer->clip_position(position);
 
     if (position < preceding_change->new_end) {
@@ -147,22 +156,15 @@ struct TextBuffer::Layer {
 
   template <typename Callback>
   inline bool for_each_chunk_in_range(Point start, Point goal_position,
-                                      const Callback &callback, bool splay = false) {
-    // *goal_position = clip_position(*goal_position, splay).position;
-    // Point current_position = clip_position(start, splay).position;
+                                      const Callback &callback) const {
     Point current_position = start;
 
     if (!uses_patch) {
-      TextSlice slice = TextSlice(*text).slice({current_position, goal_position});
-      return !slice.empty() && callback(slice);
+      return text->for_each_chunk_in_range(current_position, goal_position, callback);
     }
 
-    if (snapshot_count > 0) splay = false;
-
     Point base_position;
-    auto change = splay ?
-      patch.grab_change_starting_before_new_position(current_position) :
-      patch.get_change_starting_before_new_position(current_position);
+    auto change = patch.get_change_starting_before_new_position(current_position);
     if (!change) {
       base_position = current_position;
     } else if (current_position < change->new_end) {
@@ -177,9 +179,7 @@ struct TextBuffer::Layer {
       base_position = change->old_end.traverse(current_position.traversal(change->new_end));
     }
 
-    auto changes = splay ?
-      patch.grab_changes_in_new_range(current_position, goal_position) :
-      patch.get_changes_in_new_range(current_position, goal_position);
+    auto changes = patch.get_changes_in_new_range(current_position, goal_position);
     for (const auto &change : changes) {
       if (base_position < change.old_start) {
         if (previous_layer->for_each_chunk_in_range(base_position, change.old_start, callback)) {
@@ -226,7 +226,7 @@ struct TextBuffer::Layer {
 
   uint32_t size() const { return size_; }
 
-  u16string text_in_range(Range range, bool splay = false) {
+  u16string text_in_range(Range range) const {
     u16string result;
     for_each_chunk_in_range(
       clip_position(range.start).position,
@@ -234,13 +234,31 @@ struct TextBuffer::Layer {
       [&result](TextSlice slice) {
         result.insert(result.end(), slice.begin(), slice.end());
         return false;
-      },
-      splay
+      }
     );
     return result;
   }
 
-  vector<TextSlice> chunks_in_range(Range range) {
+  // Splays the patch's tree around the given range, so that reading near it
+  // again is fast. Layers that are shared with snapshots may be read by other
+  // threads at the same time, so their trees are left alone.
+  void splay_changes_in_range(Point start, Point end) {
+    if (!uses_patch || snapshot_count > 0) return;
+    patch.grab_change_starting_before_new_position(start);
+    if (start < end) patch.grab_changes_in_new_range(start, end);
+  }
+
+  // Builds the layer's text from the text of the nearest layer below it that
+  // doesn't use its patch, sharing that text's chunks except where the patches
+  // in between change them.
+  ChunkedText build_text() const {
+    if (!uses_patch) return *text;
+    ChunkedText result = previous_layer->build_text();
+    apply_changes(result, patch.get_changes());
+    return result;
+  }
+
+  vector<TextSlice> chunks_in_range(Range range) const {
     vector<TextSlice> result;
     for_each_chunk_in_range(
       clip_position(range.start).position,
@@ -254,7 +272,7 @@ struct TextBuffer::Layer {
     return result;
   }
 
-  vector<pair<const char16_t *, uint32_t>> primitive_chunks() {
+  vector<pair<const char16_t *, uint32_t>> primitive_chunks() const {
     vector<pair<const char16_t *, uint32_t>> result;
     for_each_chunk_in_range(Point(), Point::max(), [&result](TextSlice slice) {
       result.push_back({slice.data(), slice.size()});
@@ -265,25 +283,51 @@ struct TextBuffer::Layer {
 
   }
 
+  // Reports each match of the regex within the range to the callback, until
+  // the callback returns true. When a segment end is given, the search stops
+  // once it has moved past that position without any match in progress, which
+  // lets separate parts of a range be searched independently. When a context
+  // start is given, the text between it and the start of the range is visible
+  // to lookbehinds, but no match is reported within it. Returns false if the
+  // regex failed with an error.
   template <typename Callback>
-  void scan_in_range(const Regex &regex, Range range, const Callback &callback, bool splay = false) {
+  bool scan_in_range(const Regex &regex, Range range, const Callback &callback,
+                     Point segment_end = Point::max(),
+                     optional<Point> context_start = optional<Point>{}) const {
     Regex::MatchData match_data(regex);
     range.start = clip_position(range.start).position;
     range.end = clip_position(range.end).position;
+    Point chunks_start = context_start ? clip_position(*context_start).position : range.start;
 
-    uint32_t minimum_match_row = range.start.row;
     Range last_match{Point::max(), Point::max()};
     bool last_match_is_pending = false;
     bool done = false;
+    bool failed = false;
+
+    // Matches are searched for within a subject, which is either the current
+    // chunk or, when a match may span a chunk boundary, a copy of the end of
+    // the previous chunk followed by the start of the current one. Rather than
+    // re-slicing the subject after each match, the search resumes at an
+    // offset within it, so the preceding text remains visible to the regex.
     Text chunk_continuation;
-    TextSlice slice_to_search;
-    Point chunk_start_position = range.start;
+    Point chunk_continuation_start_position;
+    TextSlice subject;
+    Point subject_start_position;
+    Point chunk_start_position = chunks_start;
+    TextSlice previous_chunk;
+    Point previous_chunk_start_position;
+    uint32_t context_size = std::max<uint32_t>(regex.max_lookbehind(), 1);
+    Point search_start_position = range.start;
     Point last_search_end_position = range.start;
-    Point slice_to_search_start_position = range.start;
 
-    for_each_chunk_in_range(range.start, range.end, [&](TextSlice chunk) {
+    auto search_chunk = [&](TextSlice chunk) {
       Point chunk_end_position = chunk_start_position.traverse(chunk.extent());
       while (last_search_end_position < chunk_end_position) {
+        if (last_search_end_position >= segment_end && chunk_continuation.empty() && !last_match_is_pending) {
+          done = true;
+          return true;
+        }
+
         if (last_search_end_position >= chunk_start_position) {
           TextSlice remaining_chunk = chunk
             .suffix(last_search_end_position.traversal(chunk_start_position));
@@ -294,8 +338,9 @@ struct TextBuffer::Layer {
           // endings are not valid.
           if (last_match_is_pending) {
             if (!remaining_chunk.empty() && remaining_chunk.front() == '\n') {
-              chunk_continuation.splice(Point(), Point(), Text{u"\r"});
-              slice_to_search_start_position.column--;
+              search_start_position.column--;
+              chunk_continuation.assign(Text{u"\r"});
+              chunk_continuation_start_position = search_start_position;
               last_match.end.column--;
             }
 
@@ -306,22 +351,46 @@ struct TextBuffer::Layer {
             }
           }
 
+          // When the search reaches the start of a chunk, begin with a copy of
+          // the end of the previous chunk, so that lookbehinds and assertions
+          // like `\A` see the same text as in a search of the whole range.
+          if (chunk_continuation.empty() && last_search_end_position == chunk_start_position &&
+              !previous_chunk.empty() && !(previous_chunk.back() == '\r' && chunk.front() == '\n')) {
+            uint32_t context_offset = previous_chunk.size() > context_size
+              ? previous_chunk.size() - context_size
+              : 0;
+            TextSlice context = previous_chunk.split(context_offset).second;
+            if (context_offset > 0 && context.front() == '\n' &&
+                previous_chunk.split(context_offset - 1).second.front() == '\r') {
+              context_offset--;
+              context = previous_chunk.split(context_offset).second;
+            }
+            chunk_continuation.assign(context);
+            chunk_continuation_start_position = previous_chunk_start_position
+              .traverse(previous_chunk.split(context_offset).first.extent());
+          }
+
           if (!chunk_continuation.empty()) {
             chunk_continuation.append(remaining_chunk.prefix(MAX_CHUNK_SIZE_TO_COPY));
-            slice_to_search = TextSlice(chunk_continuation);
+            subject = TextSlice(chunk_continuation);
+            subject_start_position = chunk_continuation_start_position;
           } else {
-            slice_to_search = remaining_chunk;
+            subject = chunk;
+            subject_start_position = chunk_start_position;
           }
         } else {
-          slice_to_search = TextSlice(chunk_continuation);
+          subject = TextSlice(chunk_continuation);
+          subject_start_position = chunk_continuation_start_position;
         }
 
-        Point slice_to_search_end_position =
-          slice_to_search_start_position.traverse(slice_to_search.extent());
+        Point subject_end_position = subject_start_position.traverse(subject.extent());
+        Point search_start = search_start_position.traversal(subject_start_position);
+        uint32_t search_start_offset = subject.suffix(search_start).start_offset() - subject.start_offset();
+        uint32_t minimum_match_row = search_start.row;
 
         int options = 0;
-        if (slice_to_search_start_position.column == 0) options |= MatchOptions::IsBeginningOfLine;
-        if (slice_to_search_end_position == range.end) {
+        if (subject_start_position.column == 0) options |= MatchOptions::IsBeginningOfLine;
+        if (subject_end_position == range.end) {
           options |= MatchOptions::IsEndSearch;
           if (range.end == clip_position(Point{range.end.row, UINT32_MAX}).position) {
             options |= MatchOptions::IsEndOfLine;
@@ -329,48 +398,51 @@ struct TextBuffer::Layer {
         }
 
         MatchResult match_result = regex.match(
-          slice_to_search.data(),
-          slice_to_search.size(),
+          subject.data(),
+          subject.size(),
           match_data,
-          options
+          options,
+          search_start_offset
         );
 
         switch (match_result.type) {
           case MatchResult::Error:
             chunk_continuation.clear();
+            failed = true;
             return true;
 
           case MatchResult::None:
-            last_search_end_position = slice_to_search_start_position.traverse(slice_to_search.extent());
-            slice_to_search_start_position = last_search_end_position;
-            minimum_match_row = slice_to_search_start_position.row;
+            last_search_end_position = subject_end_position;
+            search_start_position = last_search_end_position;
             chunk_continuation.clear();
             break;
 
-          case MatchResult::Partial:
-            last_search_end_position = slice_to_search_start_position.traverse(slice_to_search.extent());
-            if (chunk_continuation.empty() || match_result.start_offset > 0) {
-              Point partial_match_position = slice_to_search.position_for_offset(match_result.start_offset,
-                minimum_match_row - slice_to_search_start_position.row
-              );
-              slice_to_search_start_position = slice_to_search_start_position.traverse(partial_match_position);
-              minimum_match_row = slice_to_search_start_position.row;
-              chunk_continuation.assign(slice_to_search.suffix(partial_match_position));
+          case MatchResult::Partial: {
+            last_search_end_position = subject_end_position;
+            Point partial_match_position = subject.position_for_offset(
+              match_result.start_offset,
+              minimum_match_row
+            );
+            search_start_position = subject_start_position.traverse(partial_match_position);
+            if (chunk_continuation.empty()) {
+              chunk_continuation.assign(subject.suffix(partial_match_position));
+              chunk_continuation_start_position = search_start_position;
             }
             break;
+          }
 
           case MatchResult::Full:
-            Point match_start_position = slice_to_search.position_for_offset(
+            Point match_start_position = subject.position_for_offset(
               match_result.start_offset,
-              minimum_match_row - slice_to_search_start_position.row
+              minimum_match_row
             );
-            Point match_end_position = slice_to_search.position_for_offset(
+            Point match_end_position = subject.position_for_offset(
               match_result.end_offset,
-              minimum_match_row - slice_to_search_start_position.row
+              minimum_match_row
             );
             last_match = Range{
-              slice_to_search_start_position.traverse(match_start_position),
-              slice_to_search_start_position.traverse(match_end_position)
+              subject_start_position.traverse(match_start_position),
+              subject_start_position.traverse(match_end_position)
             };
 
             last_search_end_position = last_match.end;
@@ -381,18 +453,17 @@ struct TextBuffer::Layer {
                 last_search_end_position.row++;
               }
             }
-            minimum_match_row = last_search_end_position.row;
 
-            slice_to_search_start_position = last_search_end_position;
-            if (slice_to_search_start_position >= chunk_start_position) {
+            // If the search resumes before the current chunk, it continues
+            // within the chunk continuation, which is left intact.
+            search_start_position = last_search_end_position;
+            if (search_start_position >= chunk_start_position) {
               chunk_continuation.clear();
-            } else {
-              chunk_continuation.assign(slice_to_search.suffix(match_end_position));
             }
 
             // If the match ends with a CR at the end of a chunk, continue looking
             // at the next chunk, in case that chunk starts with an LF.
-            if (match_result.end_offset == slice_to_search.size() && slice_to_search.back() == '\r') {
+            if (match_result.end_offset == subject.size() && subject.back() == '\r') {
               last_match_is_pending = true;
               continue;
             }
@@ -404,9 +475,23 @@ struct TextBuffer::Layer {
         }
       }
 
+      previous_chunk = chunk;
+      previous_chunk_start_position = chunk_start_position;
       chunk_start_position = chunk_end_position;
       return false;
-    }, splay);
+    };
+
+    // Search up to the end of the segment, and then past it only as far as is
+    // needed to finish any match that started before it.
+    if (segment_end < range.end) {
+      if (!for_each_chunk_in_range(chunks_start, segment_end, search_chunk)) {
+        for_each_chunk_in_range(segment_end, range.end, search_chunk);
+      }
+    } else {
+      for_each_chunk_in_range(chunks_start, range.end, search_chunk);
+    }
+
+    if (failed) return false;
 
     if (last_match_is_pending) {
       callback(last_match);
@@ -422,35 +507,139 @@ struct TextBuffer::Layer {
         callback(Range{range.end, range.end});
       }
     }
+
+    return true;
   }
 
-  optional<Range> find_in_range(const Regex &regex, Range range, bool splay = false) {
+  // Splits the range into roughly equal segments that start at the beginning
+  // of a row, so that they can be searched in parallel. Returns the boundaries
+  // of the segments, including the start and end of the range, or an empty
+  // vector if the range is too small to be worth splitting.
+  vector<Point> search_segment_boundaries(Range range, unsigned thread_count) const {
+    vector<Point> result;
+    ClipResult start = clip_position(range.start);
+    ClipResult end = clip_position(range.end);
+    if (end.offset <= start.offset) return result;
+
+    uint32_t size = end.offset - start.offset;
+    uint32_t segment_count = std::min(
+      size / MIN_PARALLEL_SEARCH_SEGMENT_SIZE,
+      thread_count * SEARCH_SEGMENTS_PER_THREAD
+    );
+    if (segment_count < 2) return result;
+
+    result.push_back(start.position);
+    for (uint32_t i = 1; i < segment_count; i++) {
+      uint64_t offset = start.offset + static_cast<uint64_t>(size) * i / segment_count;
+      Point boundary(position_for_offset(offset).row + 1, 0);
+      if (boundary > result.back() && boundary < end.position) result.push_back(boundary);
+    }
+    result.push_back(end.position);
+
+    if (result.size() < 3) result.clear();
+    return result;
+  }
+
+  struct SearchSegmentResult {
+    vector<Range> matches;
+    bool failed = false;
+  };
+
+  // Searches one segment of a range. The text preceding the segment is made
+  // visible to the regex, as far back as the longest lookbehind in the pattern
+  // and at least one character, so that lookbehinds and assertions like `\A`
+  // behave as they would in a sequential search of the whole range.
+  SearchSegmentResult search_segment(const Regex &regex, Point start, Point segment_end,
+                                     Range range) const {
+    SearchSegmentResult result;
+    uint32_t start_offset = clip_position(start).offset;
+    uint32_t range_start_offset = clip_position(range.start).offset;
+    uint32_t context_size = std::max<uint32_t>(regex.max_lookbehind(), 1);
+    Point context_start = start_offset - range_start_offset > context_size
+      ? position_for_offset(start_offset - context_size)
+      : range.start;
+
+    result.failed = !scan_in_range(regex, Range{start, range.end}, [&](Range match_range) {
+      if (match_range.start >= segment_end && segment_end < range.end) return true;
+      result.matches.push_back(match_range);
+      return false;
+    }, segment_end, context_start);
+    return result;
+  }
+
+  // Searches each segment of the range independently, using the shared thread
+  // pool, and then combines the results in order. A match
+  // that extends past the end of its segment makes the following segment's
+  // results invalid, because a sequential search would have resumed from the
+  // end of that match. In that case, the following segment is searched again.
+  vector<Range> find_all_in_segments(const Regex &regex, const vector<Point> &boundaries) const {
+    size_t segment_count = boundaries.size() - 1;
+    Range range{boundaries.front(), boundaries.back()};
+    vector<SearchSegmentResult> segment_results(segment_count);
+    ThreadPool::shared().parallel_for(segment_count, [&](size_t i) {
+      segment_results[i] = search_segment(regex, boundaries[i], boundaries[i + 1], range);
+    });
+
+    vector<Range> result;
+    Point resume_position = boundaries.front();
+    for (size_t i = 0; i < segment_count; i++) {
+      if (resume_position >= boundaries[i + 1]) continue;
+      if (resume_position > boundaries[i]) {
+        segment_results[i] = search_segment(regex, resume_position, boundaries[i + 1], range);
+      }
+
+      auto &matches = segment_results[i].matches;
+      result.insert(result.end(), matches.begin(), matches.end());
+      if (segment_results[i].failed) break;
+      if (!result.empty()) resume_position = std::max(resume_position, result.back().end);
+    }
+
+    return result;
+  }
+
+  optional<Range> find_in_range(const Regex &regex, Range range) const {
     optional<Range> result;
     scan_in_range(regex, range, [&result](Range match_range) -> bool {
       result = match_range;
       return true;
-    }, splay);
+    });
     return result;
   }
 
-  vector<Range> find_all_in_range(const Regex &regex, Range range, bool splay = false) {
+  bool scan_from(const Regex &regex, Point start, Point stop,
+                 const std::function<bool(Range)> &callback) const {
+    uint32_t start_offset = clip_position(start).offset;
+    uint32_t context_size = std::max<uint32_t>(regex.max_lookbehind(), 1);
+    Point context_start = start_offset > context_size
+      ? position_for_offset(start_offset - context_size)
+      : Point();
+    return scan_in_range(regex, Range{start, extent()}, callback, stop, context_start);
+  }
+
+  vector<Range> find_all_in_range(const Regex &regex, Range range) const {
+    unsigned thread_count = ThreadPool::shared().concurrency();
+    vector<Point> segment_boundaries = search_segment_boundaries(range, thread_count);
+    if (!segment_boundaries.empty()) {
+      return find_all_in_segments(regex, segment_boundaries);
+    }
+
     vector<Range> result;
     scan_in_range(regex, range, [&result](Range match_range) -> bool {
       result.push_back(match_range);
       return false;
-    }, splay);
+    });
     return result;
   }
 
   unsigned find_and_mark_all_in_range(MarkerIndex &index, MarkerIndex::MarkerId first_id,
-                                      bool exclusive, const Regex &regex, Range range, bool splay = false) {
+                                      bool exclusive, const Regex &regex, Range range) const {
     unsigned id = first_id;
-    scan_in_range(regex, range, [&index, &id, exclusive](Range match_range) -> bool {
-      index.insert(id, match_range.start, match_range.end);
-      index.set_exclusive(id, exclusive);
+    vector<MarkerIndex::Insertion> insertions;
+    for (Range match_range : find_all_in_range(regex, range)) {
+      insertions.push_back({id, match_range.start, match_range.end, exclusive});
       id++;
-      return false;
-    }, splay);
+    }
+    index.bulk_insert(insertions);
     return id - first_id;
   }
 
@@ -464,7 +653,7 @@ struct TextBuffer::Layer {
     }
   };
 
-  vector<SubsequenceMatch> find_words_with_subsequence_in_range(u16string query, const u16string &extra_word_characters, Range range) {
+  vector<SubsequenceMatch> find_words_with_subsequence_in_range(u16string query, const u16string &extra_word_characters, Range range) const {
     const size_t MAX_WORD_LENGTH = 80;
     size_t query_index = 0;
     Point position;
@@ -637,14 +826,14 @@ struct TextBuffer::Layer {
     return matches;
   }
 
-  bool is_modified(const Layer *base_layer) {
+  bool is_modified(const Layer *base_layer) const {
+    if (this == base_layer) return false;
     if (size() != base_layer->size()) return true;
 
     bool result = false;
     uint32_t start_offset = 0;
     for_each_chunk_in_range(Point(), extent(), [&](TextSlice chunk) {
-      if (chunk.text == &(*base_layer->text) ||
-          equal(chunk.begin(), chunk.end(), base_layer->text->begin() + start_offset)) {
+      if (base_layer->text->matches(start_offset, chunk)) {
         start_offset += chunk.size();
         return false;
       }
@@ -655,7 +844,7 @@ struct TextBuffer::Layer {
     return result;
   }
 
-  bool has_astral() {
+  bool has_astral() const {
     bool result = false;
     for_each_chunk_in_range(Point(), extent(), [&](TextSlice chunk) {
       for (auto ch : chunk) {
@@ -671,14 +860,18 @@ struct TextBuffer::Layer {
 };
 
 TextBuffer::TextBuffer(u16string &&text) :
-  base_layer{new Layer(move(text))},
-  top_layer{base_layer} {}
+  base_layer{new Layer(ChunkedText{Text{move(text)}})},
+  top_layer{base_layer},
+  consolidation_policy{1, 0, 0} {}
 
 TextBuffer::TextBuffer() :
-  base_layer{new Layer(Text{})},
-  top_layer{base_layer} {}
+  base_layer{new Layer(ChunkedText{})},
+  top_layer{base_layer},
+  consolidation_policy{1, 0, 0} {}
 
 TextBuffer::~TextBuffer() {
+  for (SearchSession *session : search_sessions) session->buffer = nullptr;
+
   Layer *layer = top_layer;
   while (layer) {
     Layer *previous_layer = layer->previous_layer;
@@ -690,30 +883,38 @@ TextBuffer::~TextBuffer() {
 TextBuffer::TextBuffer(const std::u16string &text) :
   TextBuffer{u16string{text.begin(), text.end()}} {}
 
-void TextBuffer::reset(Text &&new_base_text) {
-  bool has_snapshot = false;
-  auto layer = top_layer;
-  while (layer) {
-    if (layer->snapshot_count > 0) {
-      has_snapshot = true;
-      break;
-    }
-    layer = layer->previous_layer;
+bool TextBuffer::has_snapshot() const {
+  for (const Layer *layer = top_layer; layer; layer = layer->previous_layer) {
+    if (layer->snapshot_count > 0) return true;
   }
+  return false;
+}
 
-  if (has_snapshot) {
+void TextBuffer::reset(Text &&new_base_text) {
+  if (has_snapshot()) {
     set_text(move(new_base_text.content));
     flush_changes();
     return;
   }
 
-  layer = top_layer->previous_layer;
+  reset(ChunkedText{move(new_base_text)});
+}
+
+void TextBuffer::reset(ChunkedText &&new_base_text) {
+  if (has_snapshot()) {
+    set_text(move(new_base_text.text().content));
+    flush_changes();
+    return;
+  }
+
+  Layer *layer = top_layer->previous_layer;
   while (layer) {
     Layer *previous_layer = layer->previous_layer;
     delete layer;
     layer = previous_layer;
   }
 
+  Point old_extent = top_layer->extent_;
   top_layer->extent_ = new_base_text.extent();
   top_layer->size_ = new_base_text.size();
   top_layer->text = move(new_base_text);
@@ -721,6 +922,8 @@ void TextBuffer::reset(Text &&new_base_text) {
   top_layer->uses_patch = false;
   base_layer = top_layer;
   top_layer->previous_layer = nullptr;
+  line_index.reset();
+  notify_search_sessions(Point(), old_extent, top_layer->extent_);
 }
 
 Patch TextBuffer::get_inverted_changes(const Snapshot *snapshot) const {
@@ -738,7 +941,7 @@ Patch TextBuffer::get_inverted_changes(const Snapshot *snapshot) const {
     left_to_right = !left_to_right;
   }
 
-  TextSlice base{*snapshot->base_layer.text};
+  const ChunkedText &base = *snapshot->base_layer.text;
   Patch result;
   for (auto change : combination.get_changes()) {
     result.splice(
@@ -746,7 +949,7 @@ Patch TextBuffer::get_inverted_changes(const Snapshot *snapshot) const {
       change.new_end.traversal(change.new_start),
       change.old_end.traversal(change.old_start),
       *change.new_text,
-      Text{base.slice({change.old_start, change.old_end})},
+      base.text_in_range({change.old_start, change.old_end}),
       change.new_text->size()
     );
   }
@@ -788,10 +991,12 @@ bool TextBuffer::deserialize_changes(Deserializer &deserializer) {
   top_layer->size_ = deserializer.read<uint32_t>();
   top_layer->extent_ = Point(deserializer);
   top_layer->patch = Patch(deserializer);
+  line_index.reset();
+  notify_search_sessions(Point(), base_layer->extent(), top_layer->extent_);
   return true;
 }
 
-const Text &TextBuffer::base_text() const {
+const ChunkedText &TextBuffer::base_text() const {
   return *base_layer->text;
 }
 
@@ -805,7 +1010,10 @@ uint32_t TextBuffer::size() const {
 
 optional<uint32_t> TextBuffer::line_length_for_row(uint32_t row) {
   if (row > extent().row) return optional<uint32_t>{};
-  return top_layer->clip_position(Point{row, UINT32_MAX}, true).position.column;
+  if (line_index) return line_index->line_for_row(row).content_length;
+  Point line_end{row, UINT32_MAX};
+  top_layer->splay_changes_in_range(line_end, line_end);
+  return top_layer->clip_position(line_end).position.column;
 }
 
 const uint16_t *TextBuffer::line_ending_for_row(uint32_t row) {
@@ -816,15 +1024,17 @@ const uint16_t *TextBuffer::line_ending_for_row(uint32_t row) {
   static uint16_t NONE[] = {0};
 
   const uint16_t *result = NONE;
+  Point line_end = clip_position(Point(row, UINT32_MAX)).position;
+  top_layer->splay_changes_in_range(line_end, Point(row + 1, 0));
   top_layer->for_each_chunk_in_range(
-    clip_position(Point(row, UINT32_MAX)).position,
+    line_end,
     Point(row + 1, 0),
     [&result](TextSlice slice) {
       auto begin = slice.begin();
       if (begin == slice.end()) return false;
       result = (*begin == '\r') ? CRLF : LF;
       return true;
-    }, true);
+    });
   return result;
 }
 
@@ -858,11 +1068,39 @@ optional<u16string> TextBuffer::line_for_row(uint32_t row) {
 }
 
 ClipResult TextBuffer::clip_position(Point position) {
-  return top_layer->clip_position(position, true);
+  if (line_index) return line_index->clip_position(position);
+  top_layer->splay_changes_in_range(position, position);
+  return top_layer->clip_position(position);
 }
 
 Point TextBuffer::position_for_offset(uint32_t offset) {
-  return top_layer->position_for_offset(offset);
+  if (!line_index && !top_layer->uses_patch) return top_layer->text->position_for_offset(offset);
+  return get_line_index().position_for_offset(offset);
+}
+
+// The line index is only built once offsets are converted into positions,
+// because buffers that never need that conversion can do without it. Once
+// built, it is kept up to date by `set_text_in_range`.
+LineIndex &TextBuffer::get_line_index() {
+  if (!line_index) {
+    vector<LineIndex::Line> lines;
+    uint32_t length = 0;
+    uint16_t previous_character = 0;
+    top_layer->for_each_chunk_in_range(Point(), extent(), [&](TextSlice chunk) {
+      for (uint16_t character : chunk) {
+        length++;
+        if (character == '\n') {
+          lines.push_back({length, length - (previous_character == '\r' ? 2 : 1)});
+          length = 0;
+        }
+        previous_character = character;
+      }
+      return false;
+    });
+    lines.push_back({length, length});
+    line_index.reset(new LineIndex(lines));
+  }
+  return *line_index;
 }
 
 u16string TextBuffer::text() {
@@ -874,7 +1112,8 @@ uint16_t TextBuffer::character_at(Point position) const {
 }
 
 u16string TextBuffer::text_in_range(Range range) {
-  return top_layer->text_in_range(range, true);
+  top_layer->splay_changes_in_range(range.start, range.end);
+  return top_layer->text_in_range(range);
 }
 
 vector<TextSlice> TextBuffer::chunks() const {
@@ -901,6 +1140,27 @@ void TextBuffer::set_text_in_range(Range old_range, u16string &&string) {
   Point inserted_extent = new_text.extent();
   Point new_range_end = start.position.traverse(new_text.extent());
   uint32_t deleted_text_size = end.offset - start.offset;
+
+  // The lines of the inserted text replace the changed rows in the line
+  // index. The first and last of those rows also contain unchanged text,
+  // so their line endings are measured once the patch has been updated.
+  vector<LineIndex::Line> inserted_lines;
+  uint32_t end_row_suffix_length = 0;
+  if (line_index) {
+    end_row_suffix_length = line_index->line_for_row(end.position.row).length - end.position.column;
+    for (uint32_t row = 0; row <= inserted_extent.row; row++) {
+      uint32_t row_end_offset = row < inserted_extent.row ?
+        new_text.line_offsets[row + 1] :
+        new_text.size();
+      inserted_lines.push_back({
+        row_end_offset - new_text.line_offsets[row],
+        new_text.line_length_for_row(row)
+      });
+    }
+    inserted_lines.front().length += start.position.column;
+    inserted_lines.back().length += end_row_suffix_length;
+  }
+
   top_layer->extent_ = new_range_end.traverse(top_layer->extent_.traversal(end.position));
   top_layer->size_ += new_text.size() - deleted_text_size;
   top_layer->patch.splice(
@@ -912,6 +1172,14 @@ void TextBuffer::set_text_in_range(Range old_range, u16string &&string) {
     deleted_text_size
   );
 
+  if (line_index) {
+    Point first_row_end{start.position.row, UINT32_MAX};
+    Point last_row_end{new_range_end.row, UINT32_MAX};
+    inserted_lines.front().content_length = top_layer->clip_position(first_row_end).position.column;
+    inserted_lines.back().content_length = top_layer->clip_position(last_row_end).position.column;
+    line_index->splice(start.position.row, deleted_extent.row + 1, inserted_lines);
+  }
+
   auto change = top_layer->patch.grab_change_starting_before_new_position(start.position);
   if (change && change->old_text_size == change->new_text->size()) {
     bool change_is_noop = true;
@@ -932,19 +1200,150 @@ void TextBuffer::set_text_in_range(Range old_range, u16string &&string) {
       top_layer->patch.splice_old(change->old_start, Point(), Point());
     }
   }
+
+  notify_search_sessions(start.position, deleted_extent, inserted_extent);
+}
+
+// Applies several edits whose ranges are all expressed in the buffer's
+// current coordinates. The ranges are clipped to the current text up front,
+// before any of the edits change it, and must then be sorted and must not
+// overlap. All of the edits are spliced into the top layer's patch in a single
+// pass, and the line index is then updated from the last edit to the first,
+// which leaves the rows of the remaining edits unchanged.
+bool TextBuffer::set_text_in_ranges(vector<Edit> &&edits) {
+  vector<ClipResult> clipped_starts, clipped_ends;
+  clipped_starts.reserve(edits.size());
+  clipped_ends.reserve(edits.size());
+  for (size_t i = 0; i < edits.size(); i++) {
+    const Range &range = edits[i].old_range;
+    clipped_starts.push_back(clip_position(range.start));
+    clipped_ends.push_back(clip_position(range.end));
+    if (clipped_ends[i].position < clipped_starts[i].position) return false;
+    if (i > 0 && clipped_starts[i].position < clipped_ends[i - 1].position) return false;
+  }
+
+  if (edits.empty()) return true;
+  if (top_layer == base_layer || top_layer->snapshot_count > 0) {
+    top_layer = new Layer(top_layer);
+  }
+
+  struct EditPositions {
+    Point start, end, new_start, new_end;
+    vector<LineIndex::Line> inserted_lines;
+  };
+
+  vector<EditPositions> positions(edits.size());
+  vector<Patch::Splice> splices;
+  splices.reserve(edits.size());
+  Point previous_end, previous_new_end;
+  uint32_t size = top_layer->size_;
+  for (size_t i = 0; i < edits.size(); i++) {
+    EditPositions &edit_positions = positions[i];
+    Text new_text{move(edits[i].new_text)};
+    edit_positions.start = clipped_starts[i].position;
+    edit_positions.end = clipped_ends[i].position;
+    edit_positions.new_start = previous_new_end.traverse(edit_positions.start.traversal(previous_end));
+    edit_positions.new_end = edit_positions.new_start.traverse(new_text.extent());
+    previous_end = edit_positions.end;
+    previous_new_end = edit_positions.new_end;
+
+    if (line_index) {
+      Point inserted_extent = new_text.extent();
+      for (uint32_t row = 0; row <= inserted_extent.row; row++) {
+        uint32_t row_end_offset = row < inserted_extent.row ?
+          new_text.line_offsets[row + 1] :
+          new_text.size();
+        edit_positions.inserted_lines.push_back({
+          row_end_offset - new_text.line_offsets[row],
+          new_text.line_length_for_row(row)
+        });
+      }
+      edit_positions.inserted_lines.front().length += edit_positions.start.column;
+    }
+
+    uint32_t deleted_text_size = clipped_ends[i].offset - clipped_starts[i].offset;
+    size += new_text.size() - deleted_text_size;
+    splices.push_back(Patch::Splice{
+      edit_positions.start,
+      edit_positions.end.traversal(edit_positions.start),
+      move(new_text),
+      deleted_text_size
+    });
+  }
+
+  top_layer->extent_ = previous_new_end.traverse(top_layer->extent_.traversal(previous_end));
+  top_layer->size_ = size;
+  auto changes = top_layer->patch.splice_many(move(splices));
+
+  if (line_index) {
+    for (auto edit_positions = positions.rbegin(); edit_positions != positions.rend(); ++edit_positions) {
+      vector<LineIndex::Line> &inserted_lines = edit_positions->inserted_lines;
+      Point start = edit_positions->start, end = edit_positions->end;
+      inserted_lines.back().length += line_index->line_for_row(end.row).length - end.column;
+      Point first_row_end{edit_positions->new_start.row, UINT32_MAX};
+      Point last_row_end{edit_positions->new_end.row, UINT32_MAX};
+      inserted_lines.front().content_length = top_layer->clip_position(first_row_end).position.column;
+      inserted_lines.back().content_length = top_layer->clip_position(last_row_end).position.column;
+      line_index->splice(start.row, end.row - start.row + 1, inserted_lines);
+    }
+  }
+
+  for (auto change = changes.rbegin(); change != changes.rend(); ++change) {
+    if (change->old_text_size != change->new_text->size()) continue;
+    bool change_is_noop = true;
+    auto new_text_iter = change->new_text->begin();
+    top_layer->previous_layer->for_each_chunk_in_range(
+      change->old_start,
+      change->old_end,
+      [&change_is_noop, &new_text_iter](TextSlice chunk) {
+        auto new_text_end = new_text_iter + chunk.size();
+        if (!std::equal(new_text_iter, new_text_end, chunk.begin())) {
+          change_is_noop = false;
+          return true;
+        }
+        new_text_iter = new_text_end;
+        return false;
+      });
+    if (change_is_noop) {
+      top_layer->patch.splice_old(change->old_start, Point(), Point());
+    }
+  }
+
+  for (auto edit_positions = positions.rbegin(); edit_positions != positions.rend(); ++edit_positions) {
+    notify_search_sessions(
+      edit_positions->start,
+      edit_positions->end.traversal(edit_positions->start),
+      edit_positions->new_end.traversal(edit_positions->new_start)
+    );
+  }
+  return true;
+}
+
+// Each edit is reported in the coordinates of the text that preceded it, so
+// that the sessions can update their matches' positions as a marker index
+// would.
+void TextBuffer::notify_search_sessions(Point start, Point deletion_extent, Point insertion_extent) {
+  for (SearchSession *session : search_sessions) {
+    session->splice(start, deletion_extent, insertion_extent);
+  }
 }
 
 optional<Range> TextBuffer::find(const Regex &regex, Range range) const {
-  return top_layer->find_in_range(regex, range, false);
+  return top_layer->find_in_range(regex, range);
 }
 
 vector<Range> TextBuffer::find_all(const Regex &regex, Range range) const {
-  return top_layer->find_all_in_range(regex, range, false);
+  return top_layer->find_all_in_range(regex, range);
+}
+
+bool TextBuffer::scan_from(const Regex &regex, Point start, Point stop,
+                           const std::function<bool(Range)> &callback) const {
+  return top_layer->scan_from(regex, start, stop, callback);
 }
 
 unsigned TextBuffer::find_and_mark_all(MarkerIndex &index, MarkerIndex::MarkerId next_id,
                                        bool exclusive, const Regex &regex, Range range) const {
-  return top_layer->find_and_mark_all_in_range(index, next_id, exclusive, regex, range, false);
+  return top_layer->find_and_mark_all_in_range(index, next_id, exclusive, regex, range);
 }
 
 bool TextBuffer::SubsequenceMatch::operator==(const SubsequenceMatch &other) const {
@@ -1009,12 +1408,13 @@ size_t TextBuffer::layer_count() const {
 TextBuffer::Snapshot *TextBuffer::create_snapshot() {
   top_layer->snapshot_count++;
   base_layer->snapshot_count++;
+  if (top_layer->uses_patch) top_layer->patch.freeze();
   return new Snapshot(*this, *top_layer, *base_layer);
 }
 
 void TextBuffer::flush_changes() {
   if (!top_layer->text) {
-    top_layer->text = Text{text()};
+    top_layer->text = top_layer->build_text();
     base_layer = top_layer;
     consolidate_layers();
   }
@@ -1053,30 +1453,41 @@ vector<pair<const char16_t *, uint32_t>> TextBuffer::Snapshot::primitive_chunks(
 }
 
 optional<Range> TextBuffer::Snapshot::find(const Regex &regex, Range range) const {
-  return layer.find_in_range(regex, range, false);
+  return layer.find_in_range(regex, range);
 }
 
 vector<Range> TextBuffer::Snapshot::find_all(const Regex &regex, Range range) const {
-  return layer.find_all_in_range(regex, range, false);
+  return layer.find_all_in_range(regex, range);
 }
 
 vector<SubsequenceMatch> TextBuffer::Snapshot::find_words_with_subsequence_in_range(std::u16string query, const std::u16string &extra_word_characters, Range range) const {
   return layer.find_words_with_subsequence_in_range(query, extra_word_characters, range);
 }
 
-const Text &TextBuffer::Snapshot::base_text() const {
+const ChunkedText &TextBuffer::Snapshot::base_text() const {
   return *base_layer.text;
 }
 
+bool TextBuffer::Snapshot::has_read_error() const {
+  const Layer *current_layer = &layer;
+  while (current_layer->uses_patch) current_layer = current_layer->previous_layer;
+  return current_layer->text->has_read_error();
+}
+
 TextBuffer::Snapshot::Snapshot(TextBuffer &buffer, TextBuffer::Layer &layer,
                                TextBuffer::Layer &base_layer)
   : buffer{buffer}, layer{layer}, base_layer{base_layer} {}
 
-void TextBuffer::Snapshot::flush_preceding_changes() {
+optional<ChunkedText> TextBuffer::Snapshot::build_flushed_text() const {
+  if (layer.text) return optional<ChunkedText>{};
+  return layer.build_text();
+}
+
+void TextBuffer::Snapshot::flush_preceding_changes(optional<ChunkedText> &&flushed_text) {
   if (!layer.text) {
-    layer.text = Text{text()};
+    layer.text = flushed_text ? move(*flushed_text) : layer.build_text();
     if (layer.is_above_layer(buffer.base_layer)) buffer.base_layer = &layer;
-    buffer.consolidate_layers();
+    buffer.consolidate_layers_if_needed();
   }
 }
 
@@ -1084,8 +1495,37 @@ TextBuffer::Snapshot::~Snapshot() {
   assert(layer.snapshot_count > 0);
   layer.snapshot_count--;
   base_layer.snapshot_count--;
+
+  // Snapshots of the layers above this one may still be reading its patch on
+  // other threads, so it stays frozen until it is next modified, which only
+  // happens once it is an unshared top layer, or until it is squashed.
+  if (layer.snapshot_count == 0 && &layer == buffer.top_layer) layer.patch.thaw();
   if (layer.snapshot_count == 0 || base_layer.snapshot_count == 0) {
-    buffer.consolidate_layers();
+    buffer.consolidate_layers_if_needed();
+  }
+}
+
+void TextBuffer::set_consolidation_policy(ConsolidationPolicy policy) {
+  consolidation_policy = policy;
+  consolidate_layers_if_needed();
+}
+
+void TextBuffer::consolidate_layers_if_needed() {
+  size_t layer_count = 0;
+  size_t change_count = 0;
+  size_t change_bytes = 0;
+  for (const Layer *layer = top_layer; layer; layer = layer->previous_layer) {
+    layer_count++;
+    if (layer->uses_patch) {
+      change_count += layer->patch.get_change_count();
+      change_bytes += layer->patch.get_new_text_size() * sizeof(char16_t);
+    }
+  }
+
+  if (layer_count > consolidation_policy.max_layer_count ||
+      change_count > consolidation_policy.max_change_count ||
+      change_bytes > consolidation_policy.max_change_bytes) {
+    consolidate_layers();
   }
 }
 
@@ -1122,7 +1562,7 @@ void TextBuffer::squash_layers(const vector<Layer *> &layers) {
   if (layer_count < 2) return;
 
   // Find the highest layer that has already computed its text.
-  optional<Text> text;
+  optional<ChunkedText> text;
   for (layer_index = 0; layer_index < layer_count; layer_index++) {
     if (layers[layer_index]->text) {
       text = move(*layers[layer_index]->text);
@@ -1130,17 +1570,12 @@ void TextBuffer::squash_layers(const vector<Layer *> &layers) {
     }
   }
 
-  // Incorporate into that text the patches from all the layers above.
+  // Incorporate into that text the patches from all the layers above. Each
+  // patch only replaces the chunks of the text that its changes touch.
   if (text) {
     layer_index--;
     for (; layer_index + 1 > 0; layer_index--) {
-      for (auto change : layers[layer_index]->patch.get_changes()) {
-        text->splice(
-          change.new_start,
-          change.old_end.traversal(change.old_start),
-          *change.new_text
-        );
-      }
+      apply_changes(*text, layers[layer_index]->patch.get_changes());
     }
   }
 
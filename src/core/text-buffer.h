@@ -1,8 +1,11 @@
 #ifndef SUPERSTRING_TEXT_BUFFER_H_
 #define SUPERSTRING_TEXT_BUFFER_H_
 
+#include <memory>
 #include <string>
 #include <vector>
+#include "chunked-text.h"
+#include "line-index.h"
 #include "text.h"
 #include "patch.h"
 #include "point.h"
@@ -10,15 +13,39 @@
 #include "regex.h"
 #include "marker-index.h"
 
+class SearchSession;
+
 class TextBuffer {
+public:
+  // Releasing a snapshot lets the layers that were kept for it be squashed
+  // together, which takes time proportional to the changes they contain. By
+  // default this happens right away, but it can be deferred until the buffer
+  // has more than the given number of layers or changes, or until the text
+  // inserted by those changes takes up more than the given number of bytes.
+  struct ConsolidationPolicy {
+    size_t max_layer_count;
+    size_t max_change_count;
+    size_t max_change_bytes;
+  };
+
+private:
   struct Layer;
   Layer *base_layer;
   Layer *top_layer;
+  ConsolidationPolicy consolidation_policy;
+  std::unique_ptr<LineIndex> line_index;
+  std::vector<SearchSession *> search_sessions;
   void squash_layers(const std::vector<Layer *> &);
   void consolidate_layers();
+  void consolidate_layers_if_needed();
+  LineIndex &get_line_index();
+  bool has_snapshot() const;
+  void notify_search_sessions(Point start, Point deletion_extent, Point insertion_extent);
+  friend class SearchSession;
 
 public:
   static uint32_t MAX_CHUNK_SIZE_TO_COPY;
+  static uint32_t MIN_PARALLEL_SEARCH_SEGMENT_SIZE;
 
   TextBuffer();
   TextBuffer(std::u16string &&);
@@ -41,21 +68,37 @@ public:
   void set_text(const std::u16string &);
   void set_text_in_range(Range old_range, std::u16string &&);
   void set_text_in_range(Range old_range, const std::u16string &);
+
+  struct Edit {
+    Range old_range;
+    std::u16string new_text;
+  };
+
+  bool set_text_in_ranges(std::vector<Edit> &&);
   bool is_modified() const;
   bool has_astral();
   std::vector<TextSlice> chunks() const;
 
   void reset(Text &&);
+  void reset(ChunkedText &&);
   void flush_changes();
+  void set_consolidation_policy(ConsolidationPolicy);
   void serialize_changes(Serializer &);
   bool deserialize_changes(Deserializer &);
-  const Text &base_text() const;
+  const ChunkedText &base_text() const;
 
   optional<Range> find(const Regex &, Range range = Range::all_inclusive()) const;
   std::vector<Range> find_all(const Regex &, Range range = Range::all_inclusive()) const;
   unsigned find_and_mark_all(MarkerIndex &, MarkerIndex::MarkerId, bool exclusive,
                              const Regex &, Range range = Range::all_inclusive()) const;
 
+  // Reports the matches that a search of the whole buffer would find after
+  // the given start position, which must not lie within one of those matches,
+  // until the callback returns true. The search ends once it has moved past
+  // the stop position without a match in progress. Returns false if the regex
+  // failed with an error.
+  bool scan_from(const Regex &, Point start, Point stop, const std::function<bool(Range)> &) const;
+
   struct SubsequenceMatch {
     std::u16string word;
     std::vector<Point> positions;
@@ -76,7 +119,13 @@ public:
 
   public:
     ~Snapshot();
-    void flush_preceding_changes();
+
+    // Flushing builds the snapshot's full text, so for large buffers the
+    // text can be built ahead of time on another thread and then passed to
+    // flush_preceding_changes on the buffer's thread. Nothing is built if the
+    // snapshot's layer already has its text, since the flush would discard it.
+    optional<ChunkedText> build_flushed_text() const;
+    void flush_preceding_changes(optional<ChunkedText> &&flushed_text = optional<ChunkedText>{});
 
     uint32_t size() const;
     Point extent() const;
@@ -86,7 +135,12 @@ public:
     std::vector<std::pair<const char16_t *, uint32_t>> primitive_chunks() const;
     std::u16string text() const;
     std::u16string text_in_range(Range) const;
-    const Text &base_text() const;
+    const ChunkedText &base_text() const;
+
+    // Checks whether any of the snapshot's text that has been read so far
+    // came from a lazily loaded chunk that could not be read.
+    bool has_read_error() const;
+
     optional<Range> find(const Regex &, Range range = Range::all_inclusive()) const;
     std::vector<Range> find_all(const Regex &, Range range = Range::all_inclusive()) const;
     std::vector<SubsequenceMatch> find_words_with_subsequence_in_range(std::u16string query, const std::u16string &extra_word_characters, Range range) const;
@@ -1,6 +1,9 @@
 #include "text-diff.h"
 #include "libmba-diff.h"
 #include "text-slice.h"
+#include "thread-pool.h"
+#include <algorithm>
+#include <unordered_map>
 #include <vector>
 #include <string.h>
 #include <ostream>
@@ -16,29 +19,384 @@ static Point previous_column(Point position) {
   return position;
 }
 
-static int MAX_EDIT_DISTANCE = 4 * 1024;
+static const int MAX_EDIT_DISTANCE = 4 * 1024;
+static const uint64_t MAX_REFINEMENT_COST = 32 * 1024 * 1024;
+static const uint64_t MIN_PARALLEL_DIFF_SEGMENT_SIZE = 256 * 1024;
 
-Patch text_diff(const Text &old_text, const Text &new_text) {
-  Patch result;
-  Text empty;
-  Text cr{u"\r"};
-  Text lf{u"\n"};
+namespace {
+
+struct Line {
+  const char16_t *data;
+  uint32_t length;
+  size_t hash;
 
+  bool operator==(const Line &other) const {
+    return length == other.length && std::equal(data, data + length, other.data);
+  }
+};
+
+struct LineHash {
+  size_t operator()(const Line &line) const {
+    return line.hash;
+  }
+};
+
+struct LineCounts {
+  uint32_t old_count;
+  uint32_t new_count;
+  uint32_t old_index;
+  uint32_t new_index;
+};
+
+// The lines of the regions of the two texts that differ, after trimming
+// their common prefix and suffix. Lines with the same content share an id.
+struct Lines {
+  const char16_t *old_data;
+  const char16_t *new_data;
+  vector<uint32_t> old_offsets;
+  vector<uint32_t> new_offsets;
+  vector<uint32_t> old_ids;
+  vector<uint32_t> new_ids;
+
+  Lines(const char16_t *old_data, uint32_t old_start, uint32_t old_end,
+        const char16_t *new_data, uint32_t new_start, uint32_t new_end) :
+    old_data{old_data}, new_data{new_data} {
+    std::unordered_map<Line, uint32_t, LineHash> ids;
+    split(old_data, old_start, old_end, &ids, &old_offsets, &old_ids);
+    split(new_data, new_start, new_end, &ids, &new_offsets, &new_ids);
+  }
+
+  static void split(const char16_t *data, uint32_t start, uint32_t end,
+                    std::unordered_map<Line, uint32_t, LineHash> *line_ids,
+                    vector<uint32_t> *offsets, vector<uint32_t> *ids) {
+    uint32_t line_start = start;
+    for (uint32_t offset = start; offset < end; offset++) {
+      if (data[offset] == '\n' || offset + 1 == end) {
+        Line line{data + line_start, offset + 1 - line_start, 0};
+        for (uint32_t i = 0; i < line.length; i++) {
+          line.hash = line.hash * 31 + line.data[i];
+        }
+        offsets->push_back(line_start);
+        ids->push_back(line_ids->insert({line, static_cast<uint32_t>(line_ids->size())}).first->second);
+        line_start = offset + 1;
+      }
+    }
+    offsets->push_back(end);
+  }
+};
+
+// Finds the longest sequence of lines that occur exactly once in both of the
+// given regions and appear in the same order in both, using patience sorting.
+vector<std::pair<uint32_t, uint32_t>> find_anchors(const Lines &lines,
+                                                   uint32_t old_start, uint32_t old_end,
+                                                   uint32_t new_start, uint32_t new_end) {
+  std::unordered_map<uint32_t, LineCounts> counts;
+  for (uint32_t i = old_start; i < old_end; i++) {
+    LineCounts &line_counts = counts[lines.old_ids[i]];
+    line_counts.old_count++;
+    line_counts.old_index = i;
+  }
+  for (uint32_t i = new_start; i < new_end; i++) {
+    auto iter = counts.find(lines.new_ids[i]);
+    if (iter != counts.end()) {
+      iter->second.new_count++;
+      iter->second.new_index = i;
+    }
+  }
+
+  vector<std::pair<uint32_t, uint32_t>> candidates;
+  for (uint32_t i = new_start; i < new_end; i++) {
+    auto iter = counts.find(lines.new_ids[i]);
+    if (iter != counts.end() && iter->second.old_count == 1 && iter->second.new_count == 1) {
+      candidates.push_back({iter->second.old_index, i});
+    }
+  }
+
+  vector<uint32_t> pile_tops;
+  vector<uint32_t> predecessors(candidates.size());
+  for (uint32_t i = 0; i < candidates.size(); i++) {
+    auto pile = std::lower_bound(
+      pile_tops.begin(), pile_tops.end(), candidates[i].first,
+      [&candidates](uint32_t index, uint32_t old_index) {
+        return candidates[index].first < old_index;
+      }
+    );
+    predecessors[i] = pile == pile_tops.begin() ? UINT32_MAX : *(pile - 1);
+    if (pile == pile_tops.end()) {
+      pile_tops.push_back(i);
+    } else {
+      *pile = i;
+    }
+  }
+
+  vector<std::pair<uint32_t, uint32_t>> anchors;
+  if (!pile_tops.empty()) {
+    for (uint32_t i = pile_tops.back(); i != UINT32_MAX; i = predecessors[i]) {
+      anchors.push_back(candidates[i]);
+    }
+    std::reverse(anchors.begin(), anchors.end());
+  }
+  return anchors;
+}
+
+// Computes an edit script for a region of the lines in two passes. The first
+// pass matches up whole lines using the patience diff algorithm: lines that
+// occur exactly once in both texts anchor the diff, and the regions between
+// anchors are diffed recursively. Regions without any unique lines are diffed
+// line by line using Myers' algorithm. The second pass diffs the characters
+// of each run of changed lines, again using Myers' algorithm. The total cost
+// of all the Myers diffs is bounded; once it has been spent, the remaining
+// runs of changed lines are replaced in their entirety.
+class EditScriptBuilder {
+  const Lines &lines;
+  uint64_t remaining_refinement_cost;
+
+  void diff_lines(uint32_t old_start, uint32_t old_end, uint32_t new_start, uint32_t new_end) {
+    while (old_start < old_end && new_start < new_end &&
+           lines.old_ids[old_start] == lines.new_ids[new_start]) {
+      push_edit(DIFF_MATCH, lines.old_offsets[old_start + 1] - lines.old_offsets[old_start]);
+      old_start++;
+      new_start++;
+    }
+
+    uint32_t common_suffix_end = old_end;
+    while (old_start < old_end && new_start < new_end &&
+           lines.old_ids[old_end - 1] == lines.new_ids[new_end - 1]) {
+      old_end--;
+      new_end--;
+    }
+
+    auto anchors = find_anchors(lines, old_start, old_end, new_start, new_end);
+    if (anchors.empty()) {
+      if (!diff_line_sequences(old_start, old_end, new_start, new_end)) {
+        diff_characters(
+          lines.old_offsets[old_start], lines.old_offsets[old_end],
+          lines.new_offsets[new_start], lines.new_offsets[new_end]
+        );
+      }
+    } else {
+      for (auto &anchor : anchors) {
+        diff_lines(old_start, anchor.first, new_start, anchor.second);
+        push_edit(DIFF_MATCH, lines.old_offsets[anchor.first + 1] - lines.old_offsets[anchor.first]);
+        old_start = anchor.first + 1;
+        new_start = anchor.second + 1;
+      }
+      diff_lines(old_start, old_end, new_start, new_end);
+    }
+
+    push_edit(DIFF_MATCH, lines.old_offsets[common_suffix_end] - lines.old_offsets[old_end]);
+  }
+
+  // Returns the largest edit distance that Myers' algorithm can search for
+  // between sequences of the given total size within the remaining budget.
+  int get_max_edit_distance(uint64_t size) {
+    return std::min<uint64_t>(MAX_EDIT_DISTANCE, remaining_refinement_cost / size);
+  }
+
+  // Runs Myers' algorithm on the given sequences, charging its cost to the
+  // budget. Returns false if the edit distance exceeds the affordable limit.
+  bool diff_sequences(const char16_t *old_sequence, uint32_t old_length,
+                      const char16_t *new_sequence, uint32_t new_length,
+                      vector<diff_edit> *edits) {
+    uint64_t size = old_length + new_length;
+    int max_edit_distance = get_max_edit_distance(size);
+    if (max_edit_distance == 0) return false;
+    int edit_distance = diff(old_sequence, old_length, new_sequence, new_length, max_edit_distance, edits);
+    if (edit_distance == -1 || edit_distance >= max_edit_distance) {
+      remaining_refinement_cost -= size * max_edit_distance;
+      return false;
+    }
+    remaining_refinement_cost -= size * (edit_distance + 1);
+    return true;
+  }
+
+  // When no line is unique within a region, diffs the region's lines as a
+  // sequence, then diffs the characters of each run of changed lines.
+  bool diff_line_sequences(uint32_t old_start, uint32_t old_end, uint32_t new_start, uint32_t new_end) {
+    if (old_start == old_end || new_start == new_end) return false;
+
+    std::unordered_map<uint32_t, char16_t> local_line_ids;
+    std::u16string old_sequence, new_sequence;
+    for (uint32_t i = old_start; i < old_end; i++) {
+      if (local_line_ids.size() > 0xFFFF) return false;
+      old_sequence += local_line_ids.insert({lines.old_ids[i], local_line_ids.size()}).first->second;
+    }
+    for (uint32_t i = new_start; i < new_end; i++) {
+      if (local_line_ids.size() > 0xFFFF) return false;
+      new_sequence += local_line_ids.insert({lines.new_ids[i], local_line_ids.size()}).first->second;
+    }
+
+    vector<diff_edit> edits;
+    if (!diff_sequences(old_sequence.data(), old_sequence.size(),
+                        new_sequence.data(), new_sequence.size(), &edits)) {
+      return false;
+    }
+
+    uint32_t old_row = old_start, new_row = new_start;
+    uint32_t changed_old_start = old_row, changed_new_start = new_row;
+    for (const diff_edit &edit : edits) {
+      switch (edit.op) {
+        case DIFF_MATCH:
+          if (edit.len == 0) break;
+          diff_characters(
+            lines.old_offsets[changed_old_start], lines.old_offsets[old_row],
+            lines.new_offsets[changed_new_start], lines.new_offsets[new_row]
+          );
+          push_edit(DIFF_MATCH, lines.old_offsets[old_row + edit.len] - lines.old_offsets[old_row]);
+          old_row += edit.len;
+          new_row += edit.len;
+          changed_old_start = old_row;
+          changed_new_start = new_row;
+          break;
+        case DIFF_DELETE:
+          old_row += edit.len;
+          break;
+        case DIFF_INSERT:
+          new_row += edit.len;
+          break;
+      }
+    }
+    diff_characters(
+      lines.old_offsets[changed_old_start], lines.old_offsets[old_row],
+      lines.new_offsets[changed_new_start], lines.new_offsets[new_row]
+    );
+    return true;
+  }
+
+  void diff_characters(uint32_t old_start, uint32_t old_end, uint32_t new_start, uint32_t new_end) {
+    uint32_t old_length = old_end - old_start;
+    uint32_t new_length = new_end - new_start;
+    if (old_length > 0 && new_length > 0) {
+      vector<diff_edit> edits;
+      if (diff_sequences(lines.old_data + old_start, old_length,
+                         lines.new_data + new_start, new_length, &edits)) {
+        for (const diff_edit &edit : edits) push_edit(edit.op, edit.len);
+        return;
+      }
+    }
+
+    push_edit(DIFF_DELETE, old_length);
+    push_edit(DIFF_INSERT, new_length);
+  }
+
+ public:
+  vector<diff_edit> edit_script;
+
+  EditScriptBuilder(const Lines &lines, uint64_t refinement_cost) :
+    lines(lines), remaining_refinement_cost{refinement_cost} {}
+
+  void push_edit(diff_op op, uint32_t length) {
+    if (length == 0) return;
+    if (!edit_script.empty() && edit_script.back().op == op) {
+      edit_script.back().len += length;
+    } else {
+      edit_script.push_back(diff_edit{op, 0, length});
+    }
+  }
+
+  void build(uint32_t old_start, uint32_t old_end, uint32_t new_start, uint32_t new_end) {
+    diff_lines(old_start, old_end, new_start, new_end);
+  }
+};
+
+struct DiffSegment {
+  uint32_t old_start;
+  uint32_t old_end;
+  uint32_t new_start;
+  uint32_t new_end;
   vector<diff_edit> edit_script;
+};
 
-  int edit_distance = diff(
-    old_text.content.data(),
-    old_text.content.size(),
-    new_text.content.data(),
-    new_text.content.size(),
-    MAX_EDIT_DISTANCE,
-    &edit_script
+// Splits the lines into segments that end just after a unique line shared by
+// both texts, so that each segment can be diffed independently. Each segment
+// spans at least MIN_PARALLEL_DIFF_SEGMENT_SIZE characters, except the last.
+vector<DiffSegment> get_diff_segments(const Lines &lines) {
+  uint32_t old_line_count = lines.old_ids.size();
+  uint32_t new_line_count = lines.new_ids.size();
+  vector<DiffSegment> result;
+  DiffSegment segment{0, old_line_count, 0, new_line_count, {}};
+
+  uint64_t total_size =
+    (lines.old_offsets.back() - lines.old_offsets.front()) +
+    (lines.new_offsets.back() - lines.new_offsets.front());
+  if (total_size >= 2 * MIN_PARALLEL_DIFF_SEGMENT_SIZE) {
+    for (auto &anchor : find_anchors(lines, 0, old_line_count, 0, new_line_count)) {
+      uint32_t old_end = anchor.first + 1, new_end = anchor.second + 1;
+      uint64_t size =
+        (lines.old_offsets[old_end] - lines.old_offsets[segment.old_start]) +
+        (lines.new_offsets[new_end] - lines.new_offsets[segment.new_start]);
+      if (size >= MIN_PARALLEL_DIFF_SEGMENT_SIZE) {
+        segment.old_end = old_end;
+        segment.new_end = new_end;
+        result.push_back(segment);
+        segment = DiffSegment{old_end, old_line_count, new_end, new_line_count, {}};
+      }
+    }
+  }
+
+  result.push_back(segment);
+  return result;
+}
+
+// Diffs the segments independently, using the shared thread pool. Each
+// segment's share of the refinement budget is proportional
+// to its size, so the result doesn't depend on the number of threads.
+void diff_segments(const Lines &lines, vector<DiffSegment> *segments) {
+  uint64_t total_size =
+    (lines.old_offsets.back() - lines.old_offsets.front()) +
+    (lines.new_offsets.back() - lines.new_offsets.front());
+  ThreadPool::shared().parallel_for(segments->size(), [&](size_t i) {
+    DiffSegment &segment = (*segments)[i];
+    uint64_t size =
+      (lines.old_offsets[segment.old_end] - lines.old_offsets[segment.old_start]) +
+      (lines.new_offsets[segment.new_end] - lines.new_offsets[segment.new_start]);
+    EditScriptBuilder builder(lines, size > 0 ? MAX_REFINEMENT_COST * size / total_size : 0);
+    builder.build(segment.old_start, segment.old_end, segment.new_start, segment.new_end);
+    segment.edit_script = move(builder.edit_script);
+  });
+}
+
+vector<diff_edit> get_edit_script(const Text &old_text, const Text &new_text) {
+  const char16_t *old_data = old_text.data(), *new_data = new_text.data();
+  uint32_t old_size = old_text.size(), new_size = new_text.size();
+
+  uint32_t prefix_length = 0;
+  while (prefix_length < old_size && prefix_length < new_size &&
+         old_data[prefix_length] == new_data[prefix_length]) {
+    prefix_length++;
+  }
+
+  uint32_t suffix_length = 0;
+  while (suffix_length < old_size - prefix_length && suffix_length < new_size - prefix_length &&
+         old_data[old_size - suffix_length - 1] == new_data[new_size - suffix_length - 1]) {
+    suffix_length++;
+  }
+
+  Lines lines(
+    old_data, prefix_length, old_size - suffix_length,
+    new_data, prefix_length, new_size - suffix_length
   );
+  vector<DiffSegment> segments = get_diff_segments(lines);
+  diff_segments(lines, &segments);
 
-  if (edit_distance == -1 || edit_distance >= MAX_EDIT_DISTANCE) {
-    result.splice(Point(), old_text.extent(), new_text.extent(), old_text, new_text);
-    return result;
+  EditScriptBuilder result(lines, 0);
+  result.push_edit(DIFF_MATCH, prefix_length);
+  for (const DiffSegment &segment : segments) {
+    for (const diff_edit &edit : segment.edit_script) result.push_edit(edit.op, edit.len);
   }
+  result.push_edit(DIFF_MATCH, suffix_length);
+  return move(result.edit_script);
+}
+
+}  // namespace
+
+Patch text_diff(const Text &old_text, const Text &new_text) {
+  Patch result;
+  Text empty;
+  Text cr{u"\r"};
+  Text lf{u"\n"};
+
+  vector<diff_edit> edit_script = get_edit_script(old_text, new_text);
 
   size_t old_offset = 0;
   size_t new_offset = 0;
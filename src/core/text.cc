@@ -1,21 +1,59 @@
 #include "text.h"
 #include <algorithm>
+#include <cstdint>
+#include <mutex>
 #include "text-slice.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using std::function;
 using std::move;
 using std::ostream;
 using std::vector;
 using std::u16string;
 
+// Calls the given callback with the offset of every '\n' in the given
+// characters, in order. Carriage returns need no special handling because
+// line offsets always point just past the '\n' of a CRLF pair.
+template <typename Callback>
+static void for_each_newline(const char16_t *characters, uint32_t size, const Callback &callback) {
+  uint32_t offset = 0;
+
+#ifdef __SSE2__
+  const __m128i newline = _mm_set1_epi16('\n');
+  for (; offset + 16 <= size; offset += 16) {
+    __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(characters + offset));
+    __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(characters + offset + 8));
+    unsigned mask = _mm_movemask_epi8(_mm_packs_epi16(
+      _mm_cmpeq_epi16(low, newline),
+      _mm_cmpeq_epi16(high, newline)
+    ));
+    while (mask) {
+      callback(offset + __builtin_ctz(mask));
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; offset < size; offset++) {
+    if (characters[offset] == '\n') callback(offset);
+  }
+}
+
+static void append_line_offsets(Text::LineOffsets &line_offsets, const u16string &content) {
+  for_each_newline(content.data(), content.size(), [&line_offsets](uint32_t offset) {
+    line_offsets.push_back(offset + 1);
+  });
+}
+
+const uint32_t Text::DIGEST_CHECKPOINT_SIZE = 16 * 1024;
+
 Text::Text() : line_offsets{0} {}
 
 Text::Text(u16string &&content) : content{move(content)}, line_offsets{0} {
-  for (uint32_t offset = 0, size = this->content.size(); offset < size; offset++) {
-    if (this->content[offset] == '\n') {
-      line_offsets.push_back(offset + 1);
-    }
-  }
+  append_line_offsets(line_offsets, this->content);
 }
 
 Text::Text(const std::u16string &string) :
@@ -37,19 +75,22 @@ Text::Text(TextSlice slice) :
   for (uint32_t &line_offset : line_offsets) {
     line_offset -= slice.start_offset();
   }
+
+  if (slice.start_offset() == 0) {
+    digest_checkpoints.copy_prefix(slice.text->digest_checkpoints, slice.size());
+  }
 }
 
 Text::Text(const u16string &&content, const vector<uint32_t> &&line_offsets) :
-  content{move(content)}, line_offsets{move(line_offsets)} {}
+  content{move(content)}, line_offsets{line_offsets} {}
 
 Text::Text(Deserializer &deserializer) : line_offsets{0} {
   uint32_t size = deserializer.read<uint32_t>();
   content.reserve(size);
   for (uint32_t offset = 0; offset < size; offset++) {
-    uint16_t character = deserializer.read<uint16_t>();
-    content.push_back(character);
-    if (character == '\n') line_offsets.push_back(offset + 1);
+    content.push_back(deserializer.read<uint16_t>());
   }
+  append_line_offsets(line_offsets, content);
 }
 
 void Text::serialize(Serializer &serializer) const {
@@ -60,16 +101,12 @@ void Text::serialize(Serializer &serializer) const {
 }
 
 Point Text::extent(const std::u16string &string) {
-  Point result;
-  for (auto c : string) {
-    if (c == '\n') {
-      result.row++;
-      result.column = 0;
-    } else {
-      result.column++;
-    }
-  }
-  return result;
+  uint32_t row = 0, line_start = 0;
+  for_each_newline(string.data(), string.size(), [&row, &line_start](uint32_t offset) {
+    row++;
+    line_start = offset + 1;
+  });
+  return Point(row, string.size() - line_start);
 }
 
 Text Text::concat(TextSlice a, TextSlice b) {
@@ -90,6 +127,7 @@ Text Text::concat(TextSlice a, TextSlice b, TextSlice c) {
 void Text::clear() {
   content.clear();
   line_offsets.assign({0});
+  digest_checkpoints.truncate(0);
 }
 
 template<typename T>
@@ -165,6 +203,8 @@ void Text::splice(Point start, Point deletion_extent, TextSlice inserted_slice)
   for (auto iter = line_offsets.begin() + inserted_newlines_end; iter != line_offsets.end(); ++iter) {
     *iter += trailing_line_offsets_delta;
   }
+
+  digest_checkpoints.truncate(content_splice_start);
 }
 
 uint16_t Text::at(uint32_t offset) const {
@@ -249,15 +289,143 @@ inline void hash_combine(std::size_t &seed, const T &value) {
   seed ^= hasher(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
 }
 
-size_t Text::digest() const {
-  size_t result = 0;
-  for (uint16_t character : content) {
-    hash_combine(result, character);
+struct Text::DigestCheckpoints::State {
+  std::mutex mutex;
+  vector<size_t> states;
+};
+
+vector<size_t> Text::DigestCheckpoints::copy_states(State *state, size_t max_count) {
+  vector<size_t> result;
+  if (state) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    size_t count = std::min(state->states.size(), max_count);
+    result.assign(state->states.begin(), state->states.begin() + count);
+  }
+  return result;
+}
+
+Text::DigestCheckpoints::DigestCheckpoints() : state{nullptr} {}
+
+Text::DigestCheckpoints::DigestCheckpoints(const DigestCheckpoints &other) : state{nullptr} {
+  vector<size_t> other_states = copy_states(other.state.load(), SIZE_MAX);
+  if (!other_states.empty()) {
+    State *new_state = new State();
+    new_state->states = move(other_states);
+    state.store(new_state);
+  }
+}
+
+Text::DigestCheckpoints::DigestCheckpoints(DigestCheckpoints &&other) :
+  state{other.state.exchange(nullptr)} {}
+
+Text::DigestCheckpoints::~DigestCheckpoints() {
+  delete state.load();
+}
+
+Text::DigestCheckpoints &Text::DigestCheckpoints::operator=(const DigestCheckpoints &other) {
+  if (this != &other) {
+    vector<size_t> other_states = copy_states(other.state.load(), SIZE_MAX);
+    if (other_states.empty()) {
+      truncate(0);
+    } else {
+      State *own_state = get_or_create_state();
+      std::lock_guard<std::mutex> lock(own_state->mutex);
+      own_state->states = move(other_states);
+    }
+  }
+  return *this;
+}
+
+Text::DigestCheckpoints &Text::DigestCheckpoints::operator=(DigestCheckpoints &&other) {
+  if (this != &other) {
+    delete state.exchange(other.state.exchange(nullptr));
+  }
+  return *this;
+}
+
+Text::DigestCheckpoints::State *Text::DigestCheckpoints::get_or_create_state() {
+  State *current_state = state.load();
+  if (current_state) return current_state;
+
+  State *new_state = new State();
+  if (state.compare_exchange_strong(current_state, new_state)) {
+    return new_state;
+  } else {
+    delete new_state;
+    return current_state;
+  }
+}
+
+static size_t hash_range(size_t result, const u16string &content, size_t offset, size_t end) {
+  for (; offset < end; offset++) {
+    hash_combine(result, static_cast<uint16_t>(content[offset]));
   }
   return result;
 }
 
+size_t Text::DigestCheckpoints::compute_digest(const u16string &content) {
+  if (content.size() < DIGEST_CHECKPOINT_SIZE) {
+    return hash_range(0, content, 0, content.size());
+  }
+
+  State *own_state = get_or_create_state();
+  std::lock_guard<std::mutex> lock(own_state->mutex);
+  vector<size_t> &states = own_state->states;
+
+  // Discard checkpoints beyond the end of the content, in case the content
+  // was modified directly rather than through Text's methods.
+  if (states.size() > content.size() / DIGEST_CHECKPOINT_SIZE) {
+    states.resize(content.size() / DIGEST_CHECKPOINT_SIZE);
+  }
+
+  size_t result = states.empty() ? 0 : states.back();
+  size_t offset = states.size() * DIGEST_CHECKPOINT_SIZE;
+  while (offset < content.size()) {
+    size_t end = std::min<size_t>(offset + DIGEST_CHECKPOINT_SIZE, content.size());
+    result = hash_range(result, content, offset, end);
+    offset = end;
+    if (offset % DIGEST_CHECKPOINT_SIZE == 0) states.push_back(result);
+  }
+  return result;
+}
+
+void Text::DigestCheckpoints::copy_prefix(const DigestCheckpoints &other, uint32_t size) {
+  vector<size_t> other_states = copy_states(other.state.load(), size / DIGEST_CHECKPOINT_SIZE);
+  if (other_states.empty()) {
+    truncate(0);
+  } else {
+    State *own_state = get_or_create_state();
+    std::lock_guard<std::mutex> lock(own_state->mutex);
+    own_state->states = move(other_states);
+  }
+}
+
+void Text::DigestCheckpoints::truncate(uint32_t size) {
+  State *own_state = state.load();
+  if (!own_state) return;
+  std::lock_guard<std::mutex> lock(own_state->mutex);
+  if (own_state->states.size() > size / DIGEST_CHECKPOINT_SIZE) {
+    own_state->states.resize(size / DIGEST_CHECKPOINT_SIZE);
+  }
+}
+
+size_t Text::digest() const {
+  return digest_checkpoints.compute_digest(content);
+}
+
+size_t Text::extend_digest(size_t digest, TextSlice slice) {
+  return hash_range(digest, slice.text->content, slice.start_offset(), slice.end_offset());
+}
+
 void Text::append(TextSlice slice) {
+  if (content.empty()) {
+    if (slice.start_offset() == 0 && slice.text != this) {
+      digest_checkpoints.copy_prefix(slice.text->digest_checkpoints, slice.size());
+    } else {
+      digest_checkpoints.truncate(0);
+    }
+  }
+
   int64_t line_offset_delta = static_cast<int64_t>(content.size()) - static_cast<int64_t>(slice.start_offset());
 
   content.insert(
@@ -278,8 +446,18 @@ void Text::append(TextSlice slice) {
   }
 }
 
+void Text::reserve(uint32_t size, uint32_t line_count) {
+  content.reserve(size);
+  line_offsets.reserve(line_count);
+}
+
 void Text::assign(TextSlice slice) {
   uint32_t slice_start_offset = slice.start_offset();
+  if (slice_start_offset > 0) {
+    digest_checkpoints.truncate(0);
+  } else if (slice.text != this) {
+    digest_checkpoints.copy_prefix(slice.text->digest_checkpoints, slice.size());
+  }
 
   content.assign(
     slice.begin(),
@@ -1,6 +1,7 @@
 #ifndef SUPERSTRING_TEXT_H_
 #define SUPERSTRING_TEXT_H_
 
+#include <atomic>
 #include <istream>
 #include <functional>
 #include <vector>
@@ -8,6 +9,7 @@
 #include "serializer.h"
 #include "point.h"
 #include "optional.h"
+#include "small-vector.h"
 
 class TextSlice;
 
@@ -19,11 +21,48 @@ struct ClipResult {
 class Text {
   friend class TextSlice;
 
+  // The intermediate states of the digest after every DIGEST_CHECKPOINT_SIZE
+  // characters. After a splice, only the characters following the last
+  // checkpoint before the change need to be hashed again. A text built by
+  // appending slices to an empty text inherits the checkpoints covered by its
+  // first slice.
+  //
+  // Most texts are far shorter than a checkpoint, so the checkpoints are only
+  // allocated once a digest is computed over a text long enough to have one.
+  // The pointer is atomic because digests may be computed concurrently.
+  class DigestCheckpoints {
+    struct State;
+    std::atomic<State *> state;
+
+    State *get_or_create_state();
+    static std::vector<size_t> copy_states(State *, size_t max_count);
+
+   public:
+    DigestCheckpoints();
+    DigestCheckpoints(const DigestCheckpoints &);
+    DigestCheckpoints(DigestCheckpoints &&);
+    ~DigestCheckpoints();
+    DigestCheckpoints &operator=(const DigestCheckpoints &);
+    DigestCheckpoints &operator=(DigestCheckpoints &&);
+
+    size_t compute_digest(const std::u16string &);
+    void copy_prefix(const DigestCheckpoints &, uint32_t size);
+    void truncate(uint32_t size);
+  };
+
+  static const uint32_t DIGEST_CHECKPOINT_SIZE;
+  mutable DigestCheckpoints digest_checkpoints;
+
  public:
   static Point extent(const std::u16string &);
 
   std::u16string content;
-  std::vector<uint32_t> line_offsets;
+
+  // The offset at which each line starts. Most texts in patches contain at
+  // most one newline, so these are stored inline.
+  using LineOffsets = small_vector<uint32_t, 2>;
+  LineOffsets line_offsets;
+
   Text(const std::u16string &&, const std::vector<uint32_t> &&);
 
   using const_iterator = std::u16string::const_iterator;
@@ -54,12 +93,17 @@ class Text {
   uint32_t line_length_for_row(uint32_t row) const;
   void append(TextSlice);
   void assign(TextSlice);
+  void reserve(uint32_t size, uint32_t line_count = 1);
   void serialize(Serializer &) const;
   uint32_t size() const;
   const char16_t *data() const;
   size_t digest() const;
   void clear();
 
+  // Continues a digest of the characters preceding the slice, giving the same
+  // result as digesting those characters and the slice's characters together.
+  static size_t extend_digest(size_t digest, TextSlice);
+
   bool operator!=(const Text &) const;
   bool operator==(const Text &) const;
 
@@ -0,0 +1,97 @@
+#include "thread-pool.h"
+#include <algorithm>
+#include <atomic>
+
+using std::function;
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+struct ThreadPool::Job {
+  const function<void(size_t)> &body;
+  size_t count;
+  std::atomic<size_t> next_index;
+
+  // The number of workers currently taking indices from this job. Guarded
+  // by the pool's mutex.
+  unsigned worker_count;
+};
+
+ThreadPool &ThreadPool::shared() {
+#ifdef __EMSCRIPTEN__
+  static ThreadPool pool(0);
+#else
+  static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+#endif
+  return pool;
+}
+
+ThreadPool::ThreadPool(unsigned worker_count) : stopping{false} {
+  for (unsigned i = 0; i < worker_count; i++) {
+    workers.emplace_back([this]() { work(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(jobs_mutex);
+    stopping = true;
+  }
+  job_available.notify_all();
+  for (auto &worker : workers) worker.join();
+}
+
+unsigned ThreadPool::concurrency() const {
+  return workers.size() + 1;
+}
+
+void ThreadPool::run_job(Job &job) {
+  for (;;) {
+    size_t i = job.next_index++;
+    if (i >= job.count) break;
+    job.body(i);
+  }
+}
+
+void ThreadPool::parallel_for(size_t count, const function<void(size_t)> &body) {
+  Job job{body, count, {0}, 0};
+  if (count > 1 && !workers.empty()) {
+    {
+      lock_guard<mutex> lock(jobs_mutex);
+      jobs.push_back(&job);
+    }
+    if (count == 2) {
+      job_available.notify_one();
+    } else {
+      job_available.notify_all();
+    }
+  }
+
+  run_job(job);
+
+  // Every index has been taken once the loop above finishes. Withdraw the
+  // job so that no more workers pick it up, and wait for the ones that did
+  // to finish their last index.
+  unique_lock<mutex> lock(jobs_mutex);
+  auto iter = std::find(jobs.begin(), jobs.end(), &job);
+  if (iter != jobs.end()) jobs.erase(iter);
+  job_released.wait(lock, [&job]() { return job.worker_count == 0; });
+}
+
+void ThreadPool::work() {
+  unique_lock<mutex> lock(jobs_mutex);
+  for (;;) {
+    job_available.wait(lock, [this]() { return stopping || !jobs.empty(); });
+    if (stopping) break;
+
+    Job *job = jobs.front();
+    job->worker_count++;
+    lock.unlock();
+    run_job(*job);
+    lock.lock();
+
+    auto iter = std::find(jobs.begin(), jobs.end(), job);
+    if (iter != jobs.end()) jobs.erase(iter);
+    if (--job->worker_count == 0) job_released.notify_all();
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef SUPERSTRING_THREAD_POOL_H
+#define SUPERSTRING_THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads shared by every parallel operation in the
+// process. A thread that runs a parallel loop works on it too, so loops always
+// make progress even when every worker is busy with other loops, and the
+// number of threads doing work at once stays bounded by the pool's size plus
+// the number of callers, however many operations run concurrently.
+class ThreadPool {
+ public:
+  static ThreadPool &shared();
+
+  explicit ThreadPool(unsigned worker_count);
+  ThreadPool(const ThreadPool &) = delete;
+  ~ThreadPool();
+
+  // The number of threads that can work on a single loop, including the
+  // calling thread.
+  unsigned concurrency() const;
+
+  // Calls the given function once for every index below `count`, on the
+  // calling thread and on any idle workers, and returns once all the calls
+  // have returned.
+  void parallel_for(size_t count, const std::function<void(size_t)> &);
+
+ private:
+  struct Job;
+
+  void work();
+  static void run_job(Job &);
+
+  std::mutex jobs_mutex;
+  std::condition_variable job_available;
+  std::condition_variable job_released;
+  std::vector<Job *> jobs;
+  std::vector<std::thread> workers;
+  bool stopping;
+};
+
+#endif  // SUPERSTRING_THREAD_POOL_H
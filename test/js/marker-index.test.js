@@ -528,6 +528,70 @@ describe('MarkerIndex', () => {
     assert.equal(index.compare(4, 1), -1)
   })
 
+  it('can insert many markers at once', function () {
+    if (!MarkerIndex.prototype.bulkInsert) return
+
+    let index = new MarkerIndex()
+    index.insert(1, {row: 0, column: 1}, {row: 0, column: 3})
+    index.bulkInsert([
+      {id: 2, start: {row: 0, column: 2}, end: {row: 1, column: 0}, exclusive: true},
+      {id: 3, start: {row: 0, column: 3}, end: {row: 0, column: 3}, exclusive: false}
+    ])
+
+    assert.deepEqual(index.getRange(1), {start: {row: 0, column: 1}, end: {row: 0, column: 3}})
+    assert.deepEqual(index.getRange(2), {start: {row: 0, column: 2}, end: {row: 1, column: 0}})
+    assert.deepEqual(Array.from(index.findContaining({row: 0, column: 3}, {row: 0, column: 3})).sort(), [1, 2, 3])
+
+    index.splice({row: 0, column: 2}, {row: 0, column: 0}, {row: 0, column: 1})
+    assert.deepEqual(index.getStart(2), {row: 0, column: 3})
+    assert.deepEqual(index.getEnd(1), {row: 0, column: 4})
+  })
+
+  it('can apply several splices at once', function () {
+    if (!MarkerIndex.prototype.spliceMany) return
+
+    let index = new MarkerIndex()
+    index.insert(1, {row: 0, column: 1}, {row: 0, column: 3})
+    index.insert(2, {row: 0, column: 4}, {row: 0, column: 8})
+
+    const invalidated = index.spliceMany([
+      {start: {row: 0, column: 2}, oldExtent: {row: 0, column: 1}, newExtent: {row: 0, column: 3}},
+      {start: {row: 0, column: 7}, oldExtent: {row: 0, column: 2}, newExtent: {row: 0, column: 0}}
+    ])
+
+    assert.deepEqual(index.getRange(1), {start: {row: 0, column: 1}, end: {row: 0, column: 5}})
+    assert.deepEqual(index.getRange(2), {start: {row: 0, column: 6}, end: {row: 0, column: 9}})
+    assert.deepEqual(Array.from(invalidated.touch).sort(), [1, 2])
+    assert.deepEqual(Array.from(invalidated.overlap), [2])
+
+    assert.throws(() => index.spliceMany([
+      {start: {row: 0, column: 4}, oldExtent: {row: 0, column: 2}, newExtent: {row: 0, column: 0}},
+      {start: {row: 0, column: 5}, oldExtent: {row: 0, column: 0}, newExtent: {row: 0, column: 1}}
+    ]))
+    assert.throws(() => index.spliceMany([
+      {start: {row: 0, column: 4}, oldExtent: {row: 0, column: 2}, newExtent: {row: 0, column: 0}},
+      {start: {row: 0, column: 6}, oldExtent: {row: 0, column: 0}, newExtent: {row: 0, column: 1}}
+    ]))
+  })
+
+  it('can find the ranges of the markers intersecting a range', function () {
+    if (!MarkerIndex.prototype.findIntersectingRanges) return
+
+    let index = new MarkerIndex()
+    index.insert(1, {row: 2, column: 0}, {row: 3, column: 1})
+    index.insert(2, {row: 1, column: 5}, {row: 2, column: 3})
+    index.insert(3, {row: 1, column: 5}, {row: 4, column: 0})
+    index.insert(4, {row: 5, column: 0}, {row: 5, column: 1})
+
+    const ranges = index.findIntersectingRanges({row: 2, column: 0}, {row: 3, column: Infinity})
+    assert(ranges instanceof Uint32Array)
+    assert.deepEqual(Array.from(ranges), [
+      3, 1, 5, 4, 0,
+      2, 1, 5, 2, 3,
+      1, 2, 0, 3, 1
+    ])
+  })
+
   it('handles range queries involving Infinity', () => {
     let index = new MarkerIndex()
     index.insert(1, {row: 10, column: 10}, {row: 20, column: 20})
@@ -96,6 +96,22 @@ describe('TextBuffer', () => {
         })
     })
 
+    it('can load a large file with multi-byte characters spanning its read chunks', () => {
+      const buffer = new TextBuffer()
+
+      // Each repeated unit is 10KB, and the two leading bytes shift its
+      // four-byte '😁' to straddle a 10KB chunk boundary.
+      const {path: filePath} = temp.openSync()
+      const content = 'ab' + ('a'.repeat(10 * 1024 - 5) + '\n😁').repeat(110)
+      fs.writeFileSync(filePath, content)
+      assert(fs.statSync(filePath).size > 1024 * 1024)
+
+      return buffer.load(filePath).then(() => {
+        assert.equal(buffer.getText(), content)
+        assert.equal(buffer.getLineCount(), 111)
+      })
+    })
+
     it('can load from a given stream', () => {
       const buffer = new TextBuffer()
 
@@ -776,6 +792,61 @@ describe('TextBuffer', () => {
     })
   })
 
+  describe('.setTextInRanges', () => {
+    it('applies several edits given in the buffer\'s current coordinates', () => {
+      const buffer = new TextBuffer('abc\ndef\nghi')
+
+      buffer.setTextInRanges([
+        Range(Point(0, 0), Point(0, 1)),
+        Range(Point(0, 3), Point(1, 1)),
+        Range(Point(2, 3), Point(2, 3))
+      ], ['A', '', '!\n'])
+      assert.equal(buffer.getText(), 'Abcef\nghi!\n')
+    })
+
+    it('throws if the ranges are out of order', () => {
+      const buffer = new TextBuffer('abc\ndef')
+      assert.throws(() => {
+        buffer.setTextInRanges([Range(Point(1, 0), Point(1, 1)), Range(Point(0, 0), Point(0, 1))], ['x', 'y'])
+      })
+      assert.equal(buffer.getText(), 'abc\ndef')
+    })
+
+    it('throws if the number of ranges and strings differ', () => {
+      const buffer = new TextBuffer('abc\ndef')
+      assert.throws(() => {
+        buffer.setTextInRanges([Range(Point(0, 0), Point(0, 1))], ['x', 'y'])
+      }, TypeError)
+      assert.equal(buffer.getText(), 'abc\ndef')
+    })
+  })
+
+  describe('.setConsolidationPolicy', () => {
+    if (!TextBuffer.prototype.setConsolidationPolicy) return
+
+    it('keeps the buffer\'s contents while deferring consolidation', () => {
+      const buffer = new TextBuffer('abc')
+      buffer.setConsolidationPolicy({maxLayerCount: 4, maxChangeCount: Infinity, maxChangeBytes: 1024})
+
+      for (let i = 0; i < 5; i++) {
+        const snapshot = buffer.getSnapshot()
+        buffer.setTextInRange(Range(Point(0, 0), Point(0, 0)), String(i))
+        snapshot.destroy()
+        assert.equal(buffer.getText(), '43210abc'.slice(4 - i))
+      }
+
+      buffer.setConsolidationPolicy({maxLayerCount: 1, maxChangeCount: 0, maxChangeBytes: 0})
+      assert.equal(buffer.getText(), '43210abc')
+    })
+
+    it('throws if a limit is not a non-negative number', () => {
+      const buffer = new TextBuffer('abc')
+      assert.throws(() => buffer.setConsolidationPolicy({maxLayerCount: -1}))
+      assert.throws(() => buffer.setConsolidationPolicy({maxChangeBytes: 'many'}))
+      assert.throws(() => buffer.setConsolidationPolicy())
+    })
+  })
+
   describe('.getCharacterAtPosition', () => {
     it('return a character at the given position', () => {
       const buffer = new TextBuffer()
@@ -1241,6 +1312,35 @@ describe('TextBuffer', () => {
     })
   })
 
+  describe('.createSearchSession', () => {
+    if (!TextBuffer.prototype.createSearchSession) return
+
+    it('keeps the matches for a pattern current as the buffer changes', () => {
+      const buffer = new TextBuffer('abc def\nghi abc\n')
+      const session = buffer.createSearchSession(/abc/)
+      assert.deepEqual(session.getMatches(), [
+        {start: {row: 0, column: 0}, end: {row: 0, column: 3}},
+        {start: {row: 1, column: 4}, end: {row: 1, column: 7}}
+      ])
+
+      buffer.setTextInRange({start: {row: 0, column: 1}, end: {row: 0, column: 1}}, 'x')
+      assert.deepEqual(session.update(), {
+        removed: [{start: {row: 0, column: 0}, end: {row: 0, column: 4}}],
+        added: []
+      })
+
+      buffer.setTextInRange({start: {row: 0, column: 4}, end: {row: 0, column: 4}}, 'abc')
+      assert.deepEqual(session.update(), {
+        removed: [],
+        added: [{start: {row: 0, column: 4}, end: {row: 0, column: 7}}]
+      })
+      assert.equal(session.getMatchCount(), 2)
+      assert.deepEqual(session.getMatchesInRange({start: {row: 1, column: 0}, end: {row: 2, column: 0}}), [
+        {start: {row: 1, column: 4}, end: {row: 1, column: 7}}
+      ])
+    })
+  })
+
   describe('.findWordsWithSubsequence and .findWordsWithSubsequenceInRange', () => {
     it('doesn\'t crash intermittently', () => {
       let buffer;
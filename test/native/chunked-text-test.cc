@@ -0,0 +1,276 @@
+#include "test-helpers.h"
+#include "chunked-text.h"
+#include "text-slice.h"
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <thread>
+
+using std::u16string;
+using std::vector;
+
+static void verify_chunked_text(const ChunkedText &text, const Text &reference, Generator &rand) {
+  REQUIRE(text.size() == reference.size());
+  REQUIRE(text.extent() == reference.extent());
+  REQUIRE(text == reference);
+  REQUIRE(text.text().content == reference.content);
+  REQUIRE(text.digest() == Text{u16string(reference.content)}.digest());
+
+  vector<TextSlice> chunks = text.chunks();
+  REQUIRE(chunks.size() == text.chunk_count());
+  for (size_t i = 0; i < chunks.size(); i++) {
+    REQUIRE(!chunks[i].empty());
+    REQUIRE(chunks[i].size() <= ChunkedText::MAX_CHUNK_SIZE);
+    if (i + 1 < chunks.size()) {
+      REQUIRE(!(chunks[i].back() == '\r' && chunks[i + 1].front() == '\n'));
+    }
+  }
+
+  for (uint32_t offset = 0; offset < reference.size() + 2; offset++) {
+    REQUIRE(text.position_for_offset(offset) == reference.position_for_offset(offset));
+    if (offset < reference.size()) REQUIRE(text.at(offset) == reference.at(offset));
+  }
+
+  for (uint32_t row = 0; row < reference.extent().row + 2; row++) {
+    REQUIRE(text.line_length_for_row(row) == reference.line_length_for_row(row));
+    for (uint32_t column = 0; column < 12; column++) {
+      ClipResult expected = reference.clip_position(Point(row, column));
+      ClipResult actual = text.clip_position(Point(row, column));
+      REQUIRE(actual.position == expected.position);
+      REQUIRE(actual.offset == expected.offset);
+    }
+  }
+
+  for (uint32_t k = 0; k < 5; k++) {
+    Range range = get_random_range(rand, reference);
+    u16string expected = Text{TextSlice(reference).slice(range)}.content;
+    u16string actual;
+    text.for_each_chunk_in_range(range.start, range.end, [&actual](TextSlice slice) {
+      actual.insert(actual.end(), slice.begin(), slice.end());
+      return false;
+    });
+    REQUIRE(actual == expected);
+    REQUIRE(text.text_in_range(range).content == expected);
+  }
+}
+
+TEST_CASE("ChunkedText - random splices") {
+  uint32_t max_chunk_size = ChunkedText::MAX_CHUNK_SIZE;
+  ChunkedText::MAX_CHUNK_SIZE = 8;
+
+  auto t = time(nullptr);
+  for (uint32_t i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    Text reference{get_random_string(rand, 100)};
+    ChunkedText text{Text{reference}};
+    verify_chunked_text(text, reference, rand);
+
+    for (uint32_t j = 0; j < 10; j++) {
+      ChunkedText original_text{text};
+      Text original_reference{reference};
+
+      vector<Range> ranges;
+      for (uint32_t k = 0, count = 1 + rand() % 4; k < count; k++) {
+        ranges.push_back(get_random_range(rand, reference));
+      }
+      std::sort(ranges.begin(), ranges.end(), [](Range a, Range b) { return a.start < b.start; });
+
+      vector<Text> inserted_texts;
+      inserted_texts.reserve(ranges.size());
+      vector<ChunkedText::Splice> splices;
+      for (Range range : ranges) {
+        if (!splices.empty() && range.start < splices.back().old_end) continue;
+        inserted_texts.push_back(Text{get_random_string(rand, rand() % 30)});
+        splices.push_back({range.start, range.end, TextSlice(inserted_texts.back())});
+      }
+
+      if (splices.size() == 1) {
+        text.splice(splices[0].old_start, splices[0].old_end.traversal(splices[0].old_start), splices[0].new_text);
+      } else {
+        text.splice(splices);
+      }
+      for (auto splice = splices.rbegin(); splice != splices.rend(); ++splice) {
+        reference.splice(splice->old_start, splice->old_end.traversal(splice->old_start), splice->new_text);
+      }
+
+      verify_chunked_text(text, reference, rand);
+      REQUIRE(original_text == original_reference);
+      REQUIRE(original_text.digest() == original_reference.digest());
+    }
+  }
+
+  ChunkedText::MAX_CHUNK_SIZE = max_chunk_size;
+}
+
+TEST_CASE("ChunkedText - sharing chunks between copies") {
+  uint32_t max_chunk_size = ChunkedText::MAX_CHUNK_SIZE;
+  ChunkedText::MAX_CHUNK_SIZE = 16;
+
+  u16string content;
+  for (uint32_t i = 0; i < 100; i++) content += u"line\r\n";
+  ChunkedText text{Text{content}};
+  REQUIRE(text.chunk_count() > 30);
+  size_t digest = text.digest();
+
+  ChunkedText copy{text};
+  Text inserted{u"X\nY"};
+  copy.splice(Point{50, 2}, Point{0, 1}, TextSlice(inserted));
+  REQUIRE(text == Text{content});
+  REQUIRE(text.digest() == digest);
+  REQUIRE(copy.extent() == Point(101, 0));
+  REQUIRE(copy.text_in_range({{50, 0}, {52, 0}}).content == u"liX\nYe\r\n");
+
+  std::set<const Text *> original_chunks;
+  for (TextSlice chunk : text.chunks()) original_chunks.insert(chunk.text);
+  size_t new_chunk_count = 0;
+  for (TextSlice chunk : copy.chunks()) {
+    if (!original_chunks.count(chunk.text)) new_chunk_count++;
+  }
+  REQUIRE(new_chunk_count <= 3);
+  REQUIRE(copy.digest() == copy.text().digest());
+
+  ChunkedText moved{std::move(copy)};
+  REQUIRE(copy.empty());
+  REQUIRE(copy.chunk_count() == 0);
+  REQUIRE(moved.text_in_range({{50, 0}, {51, 0}}).content == u"liX\n");
+
+  ChunkedText::MAX_CHUNK_SIZE = max_chunk_size;
+}
+
+struct TestChunkSource : ChunkedText::Source {
+  vector<Text> chunks;
+  vector<std::atomic<unsigned>> read_counts;
+  size_t failing_index;
+
+  TestChunkSource(const ChunkedText &text) :
+    read_counts(text.chunk_count()), failing_index{SIZE_MAX} {
+    for (TextSlice chunk : text.chunks()) chunks.push_back(Text{chunk});
+    for (auto &read_count : read_counts) read_count = 0;
+  }
+
+  bool read_chunk(size_t index, Text &result) override {
+    read_counts[index]++;
+    if (index == failing_index) return false;
+    result = Text{chunks[index]};
+    return true;
+  }
+
+  ChunkedText build_text(std::shared_ptr<TestChunkSource> self) {
+    ChunkedText result;
+    for (size_t index = 0; index < chunks.size(); index++) {
+      result.append_lazy_chunk(self, index, chunks[index].size(), chunks[index].extent());
+    }
+    return result;
+  }
+
+  unsigned total_read_count() {
+    unsigned result = 0;
+    for (auto &read_count : read_counts) result += read_count;
+    return result;
+  }
+};
+
+TEST_CASE("ChunkedText - reading lazily appended chunks") {
+  uint32_t max_chunk_size = ChunkedText::MAX_CHUNK_SIZE;
+  ChunkedText::MAX_CHUNK_SIZE = 8;
+
+  auto t = time(nullptr);
+  for (uint32_t i = 0; i < 50; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    Text reference{get_random_string(rand, 100)};
+    auto source = std::make_shared<TestChunkSource>(ChunkedText{Text{reference}});
+    ChunkedText text = source->build_text(source);
+    REQUIRE(text.size() == reference.size());
+    REQUIRE(text.extent() == reference.extent());
+    REQUIRE(source->total_read_count() == 0);
+
+    if (!reference.empty()) {
+      uint32_t offset = rand() % reference.size();
+      REQUIRE(text.at(offset) == reference.at(offset));
+      REQUIRE(source->total_read_count() == 1);
+    }
+
+    Range range = get_random_range(rand, reference);
+    Text inserted{get_random_string(rand, rand() % 10)};
+    ChunkedText copy{text};
+    copy.splice(range.start, range.end.traversal(range.start), TextSlice(inserted));
+    REQUIRE(source->total_read_count() <= 5);
+
+    Text copy_reference{reference};
+    copy_reference.splice(range.start, range.end.traversal(range.start), TextSlice(inserted));
+    verify_chunked_text(copy, copy_reference, rand);
+    verify_chunked_text(text, reference, rand);
+    for (auto &read_count : source->read_counts) REQUIRE(read_count <= 1);
+    REQUIRE(!text.has_read_error());
+    REQUIRE(!copy.has_read_error());
+  }
+
+  ChunkedText::MAX_CHUNK_SIZE = max_chunk_size;
+}
+
+TEST_CASE("ChunkedText - failing to read lazily appended chunks") {
+  uint32_t max_chunk_size = ChunkedText::MAX_CHUNK_SIZE;
+  ChunkedText::MAX_CHUNK_SIZE = 8;
+
+  u16string content;
+  for (uint32_t i = 0; i < 20; i++) content += u"ab\r\ncd\n";
+  auto source = std::make_shared<TestChunkSource>(ChunkedText{Text{content}});
+  source->failing_index = 2;
+  ChunkedText text = source->build_text(source);
+  ChunkedText copy{text};
+  REQUIRE(!text.has_read_error());
+
+  // A chunk that can't be read is replaced by one of the same size and extent.
+  Text result = text.text();
+  REQUIRE(text.has_read_error());
+  REQUIRE(copy.has_read_error());
+  REQUIRE(result.size() == content.size());
+  REQUIRE(result.extent() == Text{content}.extent());
+  REQUIRE(text.extent() == Text{content}.extent());
+  REQUIRE(result.content.find(u'\xFFFD') != u16string::npos);
+  REQUIRE(source->read_counts[2] == 1);
+
+  // A splice that combines the unreadable chunk into a new one keeps the error.
+  Text inserted{u"xyz"};
+  ChunkedText spliced{text};
+  spliced.splice(Point(3, 0), Point(0, 1), TextSlice(inserted));
+  REQUIRE(spliced.has_read_error());
+
+  // Chunks whose source returns characters of the wrong shape are replaced too.
+  auto mismatched_source = std::make_shared<TestChunkSource>(ChunkedText{Text{content}});
+  ChunkedText mismatched_text = mismatched_source->build_text(mismatched_source);
+  mismatched_source->chunks[1] = Text{u"ab"};
+  REQUIRE(mismatched_text.text().size() == content.size());
+  REQUIRE(mismatched_text.has_read_error());
+
+  ChunkedText::MAX_CHUNK_SIZE = max_chunk_size;
+}
+
+TEST_CASE("ChunkedText - reading lazily appended chunks from several threads") {
+  uint32_t max_chunk_size = ChunkedText::MAX_CHUNK_SIZE;
+  ChunkedText::MAX_CHUNK_SIZE = 8;
+
+  u16string content;
+  for (uint32_t i = 0; i < 100; i++) content += u"line\r\n";
+  auto source = std::make_shared<TestChunkSource>(ChunkedText{Text{content}});
+  ChunkedText text = source->build_text(source);
+
+  std::atomic<unsigned> match_count{0};
+  vector<std::thread> threads;
+  for (unsigned i = 0; i < 4; i++) {
+    threads.push_back(std::thread([&text, &content, &match_count]() {
+      if (text == Text{content}) match_count++;
+    }));
+  }
+  for (auto &thread : threads) thread.join();
+  REQUIRE(match_count == 4);
+  for (auto &read_count : source->read_counts) REQUIRE(read_count == 1);
+
+  ChunkedText::MAX_CHUNK_SIZE = max_chunk_size;
+}
@@ -70,6 +70,38 @@ TEST_CASE("EncodingConversion::decode - four-byte UTF-16 characters") {
   REQUIRE(string == u"ab" "\xd83d" "\xde01" "cd");
 }
 
+TEST_CASE("EncodingConversion::decode - multi-byte characters spanning input buffers") {
+  // Place a four-byte and a three-byte character across each boundary of the
+  // 10KB buffers that files are loaded with, for over a megabyte of input.
+  string input;
+  u16string expected;
+  size_t buffer_size = 10 * 1024;
+  while (input.size() < 1100 * 1024) {
+    size_t padding = buffer_size - input.size() % buffer_size - 2;
+    input.append(padding, 'a');
+    expected.append(padding, u'a');
+    input += "\xf0\x9f\x98\x81" "\xe2\x88\x80" "b"; // '😁∀b'
+    expected += u"\xd83d\xde01" u"\u2200" u"b";
+  }
+
+  FILE *file = tmpfile();
+  fwrite(input.data(), 1, input.size(), file);
+  rewind(file);
+
+  auto conversion = transcoding_from("UTF-8");
+  u16string string;
+  vector<char> buffer(buffer_size);
+  size_t bytes_decoded = 0;
+  REQUIRE(conversion->decode(string, file, buffer, [&bytes_decoded](size_t bytes) {
+    REQUIRE(bytes > bytes_decoded);
+    bytes_decoded = bytes;
+  }));
+  REQUIRE(bytes_decoded == input.size());
+  REQUIRE(string == expected);
+
+  fclose(file);
+}
+
 TEST_CASE("EncodingConversion::encode - basic") {
   auto conversion = transcoding_to("UTF-8");
   u16string string = u"abγdefg\nhijklmnop";
@@ -145,3 +177,95 @@ TEST_CASE("EncodingConversion::encode - invalid characters at the end of the str
     string, &start, string.size(), output.data(), output.size(), true);
   REQUIRE(std::string(output.data(), bytes_encoded) == "abc" "\ufffd");
 }
+
+TEST_CASE("EncodingConversion - long ASCII runs mixed with other characters") {
+  string utf8_text, invalid_utf8_text;
+  u16string utf16_text, decoded_invalid_utf8_text;
+  for (int i = 0; i < 100; i++) {
+    utf8_text += "the quick brown fox jumps over the lazy dog\n";
+    utf16_text += u"the quick brown fox jumps over the lazy dog\n";
+    invalid_utf8_text += "the quick brown fox jumps over the lazy dog\n";
+    decoded_invalid_utf8_text += u"the quick brown fox jumps over the lazy dog\n";
+    if (i % 3 == 0) {
+      utf8_text += "γ" "\xf0\x9f" "\x98\x81";
+      utf16_text += u"γ" "\xd83d" "\xde01";
+      invalid_utf8_text += "\xc0" "\xe2\x82";
+      decoded_invalid_utf8_text += u"\ufffd" "\ufffd" "\ufffd";
+    }
+  }
+
+  auto decoder = transcoding_from("UTF-8");
+  u16string decoded;
+  decoder->decode(decoded, utf8_text.data(), utf8_text.size(), true);
+  REQUIRE(decoded == utf16_text);
+
+  decoded.clear();
+  decoder->decode(decoded, invalid_utf8_text.data(), invalid_utf8_text.size(), true);
+  REQUIRE(decoded == decoded_invalid_utf8_text);
+
+  // Decoding in small chunks splits multi-byte characters across chunks.
+  decoded.clear();
+  size_t offset = 0;
+  while (offset < utf8_text.size()) {
+    size_t length = std::min<size_t>(19, utf8_text.size() - offset);
+    bool is_last = offset + length == utf8_text.size();
+    offset += decoder->decode(decoded, utf8_text.data() + offset, length, is_last);
+  }
+  REQUIRE(decoded == utf16_text);
+
+  // Encoding into a small buffer leaves some characters for the next call.
+  auto encoder = transcoding_to("UTF-8");
+  string encoded;
+  vector<char> output(21);
+  size_t start = 0;
+  while (start < utf16_text.size()) {
+    size_t bytes_encoded = encoder->encode(
+      utf16_text, &start, utf16_text.size(), output.data(), output.size());
+    encoded.append(output.data(), bytes_encoded);
+  }
+  REQUIRE(encoded == utf8_text);
+}
+
+TEST_CASE("EncodingConversion::decode_and_compare") {
+  string input = "abc\xE2\x88\x80" "def\xF0\x9F\x98\x80" "ghi";
+  u16string expected = u"abc∀def\U0001F600ghi";
+
+  FILE *file = tmpfile();
+  fwrite(input.data(), 1, input.size(), file);
+
+  auto check = [&](const char *encoding, const u16string &string) {
+    auto conversion = transcoding_from(encoding);
+    rewind(file);
+    vector<char> buffer(4);
+    bool result = false;
+    REQUIRE(conversion->decode_and_compare(string, file, input.size(), buffer, &result));
+    return result;
+  };
+
+  // Multi-byte characters are split across the small input buffer.
+  REQUIRE(check("UTF-8", expected));
+  REQUIRE(!check("UTF-8", u"abc∀dXf\U0001F600ghi"));
+  REQUIRE(!check("UTF-8", expected + u"j"));
+  REQUIRE(!check("UTF-8", expected.substr(0, expected.size() - 1)));
+  REQUIRE(!check("UTF-8", u""));
+  REQUIRE(!check("ISO-8859-1", expected));
+  REQUIRE(check("ISO-8859-1", u"abcâ\u0088\u0080defð\u009F\u0098\u0080ghi"));
+
+  // Chunked texts are compared across the boundaries of their chunks.
+  uint32_t max_chunk_size = ChunkedText::MAX_CHUNK_SIZE;
+  ChunkedText::MAX_CHUNK_SIZE = 3;
+  auto check_chunked = [&](const u16string &string) {
+    auto conversion = transcoding_from("UTF-8");
+    rewind(file);
+    vector<char> buffer(4);
+    bool result = false;
+    REQUIRE(conversion->decode_and_compare(ChunkedText{Text{string}}, file, input.size(), buffer, &result));
+    return result;
+  };
+  REQUIRE(check_chunked(expected));
+  REQUIRE(!check_chunked(u"abc∀def\U0001F600ghj"));
+  REQUIRE(!check_chunked(expected + u"j"));
+  ChunkedText::MAX_CHUNK_SIZE = max_chunk_size;
+
+  fclose(file);
+}
@@ -0,0 +1,89 @@
+#include "test-helpers.h"
+#include "file-chunk-source.h"
+#include "encoding-conversion.h"
+
+using std::string;
+using std::u16string;
+using std::vector;
+
+static string get_random_utf8_string(Generator &rand, uint32_t length) {
+  static const vector<string> pieces = {
+    "a", "b", "c", "\n", "\r\n", "\r", "\xce\xb3", "\xe2\x88\x80", "\xf0\x9f\x98\x81", "\xff", "\xe2\x88"
+  };
+
+  string result;
+  for (uint32_t i = 0; i < length; i++) {
+    result += pieces[rand() % pieces.size()];
+  }
+  return result;
+}
+
+static FILE *get_file_with_content(const string &content) {
+  FILE *file = tmpfile();
+  fwrite(content.data(), 1, content.size(), file);
+  rewind(file);
+  return file;
+}
+
+TEST_CASE("FileChunkSource - decoding chunks as they are read") {
+  uint32_t max_chunk_size = ChunkedText::MAX_CHUNK_SIZE;
+  ChunkedText::MAX_CHUNK_SIZE = 8;
+
+  auto t = time(nullptr);
+  for (uint32_t i = 0; i < 50; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    string input = get_random_utf8_string(rand, rand() % 100);
+    u16string expected;
+    transcoding_from("UTF-8")->decode(expected, input.data(), input.size(), true);
+
+    size_t bytes_scanned = 0;
+    auto text = FileChunkSource::load(get_file_with_content(input), [&bytes_scanned](size_t bytes) {
+      REQUIRE(bytes > bytes_scanned);
+      bytes_scanned = bytes;
+    });
+    REQUIRE(text);
+    REQUIRE(bytes_scanned == input.size());
+    REQUIRE(text->size() == expected.size());
+    REQUIRE(text->extent() == Text::extent(expected));
+
+    for (TextSlice chunk : text->chunks()) {
+      REQUIRE(chunk.size() <= ChunkedText::MAX_CHUNK_SIZE);
+    }
+    REQUIRE(*text == Text{expected});
+    REQUIRE(text->text().extent() == Text::extent(expected));
+    REQUIRE(!text->has_read_error());
+  }
+
+  ChunkedText::MAX_CHUNK_SIZE = max_chunk_size;
+}
+
+TEST_CASE("FileChunkSource - reading chunks after the file has changed") {
+  uint32_t max_chunk_size = ChunkedText::MAX_CHUNK_SIZE;
+  ChunkedText::MAX_CHUNK_SIZE = 8;
+
+  string input;
+  for (uint32_t i = 0; i < 20; i++) input += "abc\xce\xb3\r\n";
+  FILE *file = get_file_with_content(input);
+  auto text = FileChunkSource::load(file, [](size_t) {});
+  REQUIRE(text);
+  REQUIRE(text->at(Point(0, 0)) == 'a');
+
+  // Overwriting part of the file makes the chunks covering it unreadable,
+  // without changing the text's size or extent.
+  fseek(file, 40, SEEK_SET);
+  fwrite("xyz", 1, 3, file);
+  fflush(file);
+
+  Text result = text->text();
+  REQUIRE(text->has_read_error());
+  REQUIRE(result.size() == text->size());
+  REQUIRE(result.extent() == text->extent());
+  REQUIRE(result.content.find(u"xyz") == u16string::npos);
+  REQUIRE(result.content.find(u'\xFFFD') != u16string::npos);
+  REQUIRE(result.content.substr(0, 6) == u"abcγ\r\n");
+
+  ChunkedText::MAX_CHUNK_SIZE = max_chunk_size;
+}
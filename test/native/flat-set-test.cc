@@ -0,0 +1,73 @@
+#include "test-helpers.h"
+#include "flat_set.h"
+#include <set>
+
+using std::vector;
+
+static vector<uint32_t> values(const flat_set<uint32_t> &set) {
+  return vector<uint32_t>(set.begin(), set.end());
+}
+
+TEST_CASE("flat_set - growing beyond and shrinking back to its inline storage") {
+  flat_set<uint32_t> set;
+  for (uint32_t value : {5, 1, 3, 1, 9, 7, 2}) set.insert(value);
+  REQUIRE(values(set) == vector<uint32_t>({1, 2, 3, 5, 7, 9}));
+
+  flat_set<uint32_t> copy(set);
+  set.erase(3);
+  set.erase(1);
+  set.erase(4);
+  REQUIRE(values(set) == vector<uint32_t>({2, 5, 7, 9}));
+  REQUIRE(values(copy) == vector<uint32_t>({1, 2, 3, 5, 7, 9}));
+
+  for (auto iter = set.begin(); iter != set.end();) {
+    if (*iter != 7) {
+      iter = set.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  REQUIRE(values(set) == vector<uint32_t>({7}));
+
+  flat_set<uint32_t> moved(std::move(copy));
+  REQUIRE(values(moved) == vector<uint32_t>({1, 2, 3, 5, 7, 9}));
+  REQUIRE(copy.size() == 0);
+  copy = moved;
+  moved = std::move(set);
+  REQUIRE(values(moved) == vector<uint32_t>({7}));
+  REQUIRE(values(copy) == vector<uint32_t>({1, 2, 3, 5, 7, 9}));
+}
+
+TEST_CASE("flat_set::insert_sorted - random values") {
+  auto t = time(nullptr);
+  for (uint i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    flat_set<uint32_t> set;
+    std::set<uint32_t> expected_set;
+    for (uint j = 0; j < 20; j++) {
+      std::set<uint32_t> inserted_values;
+      for (uint k = 0, n = rand() % 8; k < n; k++) inserted_values.insert(rand() % 40);
+
+      if (rand() % 2) {
+        set.insert_sorted(inserted_values.begin(), inserted_values.end());
+      } else {
+        flat_set<uint32_t> other;
+        for (uint32_t value : inserted_values) other.insert(value);
+        set.insert(other);
+      }
+      expected_set.insert(inserted_values.begin(), inserted_values.end());
+
+      for (uint k = 0, n = rand() % 8; k < n; k++) {
+        uint32_t value = rand() % 40;
+        set.erase(value);
+        expected_set.erase(value);
+      }
+
+      REQUIRE(values(set) == vector<uint32_t>(expected_set.begin(), expected_set.end()));
+      REQUIRE(set.count(expected_set.empty() ? 0 : *expected_set.begin()) == !expected_set.empty());
+    }
+  }
+}
@@ -0,0 +1,85 @@
+#include "test-helpers.h"
+#include "line-index.h"
+#include "text-slice.h"
+
+using std::u16string;
+using std::vector;
+using Line = LineIndex::Line;
+
+static vector<Line> get_lines(const Text &text, bool include_last_line = true) {
+  vector<Line> result;
+  for (uint32_t row = 0; row <= text.extent().row; row++) {
+    uint32_t end_offset = row < text.extent().row ? text.line_offsets[row + 1] : text.size();
+    if (row == text.extent().row && !include_last_line) break;
+    result.push_back({end_offset - text.line_offsets[row], text.line_length_for_row(row)});
+  }
+  return result;
+}
+
+static void verify_line_index(const LineIndex &index, const Text &text) {
+  REQUIRE(index.size() == text.size());
+  REQUIRE(index.extent() == text.extent());
+
+  for (uint32_t offset = 0; offset <= text.size() + 1; offset++) {
+    REQUIRE(index.position_for_offset(offset) == text.position_for_offset(offset));
+  }
+
+  for (uint32_t row = 0; row <= text.extent().row + 1; row++) {
+    for (uint32_t column = 0; column <= text.line_length_for_row(row) + 2; column++) {
+      ClipResult expected = text.clip_position({row, column});
+      ClipResult actual = index.clip_position({row, column});
+      REQUIRE(actual.position == expected.position);
+      REQUIRE(actual.offset == expected.offset);
+    }
+  }
+}
+
+TEST_CASE("LineIndex - converting between offsets and positions") {
+  Text text{u"abc\r\ndefg\n\nh\ri\r\n"};
+  LineIndex index(get_lines(text));
+
+  REQUIRE(index.size() == 16);
+  REQUIRE(index.extent() == Point(4, 0));
+  REQUIRE(index.line_for_row(0).length == 5);
+  REQUIRE(index.line_for_row(0).content_length == 3);
+  REQUIRE(index.line_for_row(3).content_length == 3);
+
+  REQUIRE(index.clip_position({0, 4}).position == Point(0, 3));
+  REQUIRE(index.clip_position({1, 2}).offset == 7);
+  REQUIRE(index.clip_position({9, 0}).position == Point(4, 0));
+  REQUIRE(index.position_for_offset(4) == Point(0, 3));
+  REQUIRE(index.position_for_offset(5) == Point(1, 0));
+  REQUIRE(index.position_for_offset(100) == Point(4, 0));
+  verify_line_index(index, text);
+}
+
+TEST_CASE("LineIndex::splice - random edits") {
+  auto t = time(nullptr);
+  for (uint i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    Text text{get_random_string(rand, 100)};
+    LineIndex index(get_lines(text));
+    verify_line_index(index, text);
+
+    for (uint j = 0; j < 10; j++) {
+      // Replace whole rows, so that the replaced lines are known up front.
+      uint32_t start_row = rand() % (text.extent().row + 1);
+      uint32_t end_row = start_row + rand() % (text.extent().row + 1 - start_row);
+      Text inserted_text{get_random_string(rand, rand() % 30)};
+
+      if (end_row == text.extent().row) {
+        text.splice({start_row, 0}, text.extent().traversal({start_row, 0}), inserted_text);
+        index.splice(start_row, end_row - start_row + 1, get_lines(inserted_text));
+      } else {
+        inserted_text.append(Text{u"\n"});
+        text.splice({start_row, 0}, Point(end_row + 1 - start_row, 0), inserted_text);
+        index.splice(start_row, end_row - start_row + 1, get_lines(inserted_text, false));
+      }
+
+      verify_line_index(index, text);
+    }
+  }
+}
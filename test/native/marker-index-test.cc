@@ -0,0 +1,255 @@
+#include "test-helpers.h"
+#include "marker-index.h"
+#include <algorithm>
+
+using std::vector;
+using MarkerId = MarkerIndex::MarkerId;
+using Insertion = MarkerIndex::Insertion;
+
+static vector<MarkerId> ids(const flat_set<MarkerId> &set) {
+  return vector<MarkerId>(set.begin(), set.end());
+}
+
+static Point get_random_point(Generator &rand) {
+  return Point(rand() % 10, rand() % 10);
+}
+
+static vector<Insertion> get_random_insertions(Generator &rand, MarkerId first_id, uint32_t count) {
+  vector<Insertion> result;
+  for (MarkerId id = first_id; id < first_id + count; id++) {
+    Point start = get_random_point(rand);
+    Point end = get_random_point(rand);
+    if (end < start) std::swap(start, end);
+    result.push_back({id, start, end, rand() % 2 == 0});
+  }
+  return result;
+}
+
+static void insert_one_at_a_time(MarkerIndex &index, const vector<Insertion> &insertions) {
+  for (const Insertion &insertion : insertions) {
+    index.insert(insertion.id, insertion.start, insertion.end);
+    index.set_exclusive(insertion.id, insertion.exclusive);
+  }
+}
+
+static void verify_same_markers(MarkerIndex &index, MarkerIndex &expected_index, Generator &rand) {
+  REQUIRE(index.dump() == expected_index.dump());
+
+  for (uint32_t k = 0; k < 10; k++) {
+    Point start = get_random_point(rand);
+    Point end = get_random_point(rand);
+    if (end < start) std::swap(start, end);
+    REQUIRE(ids(index.find_intersecting(start, end)) == ids(expected_index.find_intersecting(start, end)));
+    REQUIRE(ids(index.find_containing(start, end)) == ids(expected_index.find_containing(start, end)));
+    REQUIRE(ids(index.find_contained_in(start, end)) == ids(expected_index.find_contained_in(start, end)));
+    REQUIRE(ids(index.find_starting_in(start, end)) == ids(expected_index.find_starting_in(start, end)));
+    REQUIRE(ids(index.find_ending_in(start, end)) == ids(expected_index.find_ending_in(start, end)));
+
+    auto containing_start = index.find_boundaries_after(start, 5).containing_start;
+    auto expected_containing_start = expected_index.find_boundaries_after(start, 5).containing_start;
+    std::sort(containing_start.begin(), containing_start.end());
+    std::sort(expected_containing_start.begin(), expected_containing_start.end());
+    REQUIRE(containing_start == expected_containing_start);
+  }
+}
+
+TEST_CASE("MarkerIndex::bulk_insert - building an index") {
+  MarkerIndex index;
+  index.bulk_insert({
+    {1, Point(0, 2), Point(0, 5), false},
+    {2, Point(0, 4), Point(1, 0), true},
+    {3, Point(0, 5), Point(0, 5), false},
+  });
+
+  REQUIRE(index.get_range(1) == (Range{Point(0, 2), Point(0, 5)}));
+  REQUIRE(index.get_range(2) == (Range{Point(0, 4), Point(1, 0)}));
+  REQUIRE(ids(index.find_intersecting(Point(0, 3), Point(0, 3))) == vector<MarkerId>({1}));
+  REQUIRE(ids(index.find_containing(Point(0, 5), Point(0, 5))) == vector<MarkerId>({1, 2, 3}));
+
+  // Exclusive markers don't grow when text is inserted at their start.
+  index.splice(Point(0, 4), Point(), Point(0, 1));
+  REQUIRE(index.get_range(2) == (Range{Point(0, 5), Point(1, 0)}));
+  REQUIRE(index.get_range(1) == (Range{Point(0, 2), Point(0, 6)}));
+}
+
+TEST_CASE("MarkerIndex::bulk_insert - random markers") {
+  auto t = time(nullptr);
+  for (uint i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    MarkerIndex index(seed);
+    MarkerIndex expected_index(seed);
+    MarkerId next_id = 0;
+
+    for (uint j = 0; j < 5; j++) {
+      // Batches both larger and smaller than the existing index.
+      auto insertions = get_random_insertions(rand, next_id, rand() % 2 ? 50 : 5);
+      next_id += insertions.size();
+      index.bulk_insert(insertions);
+      insert_one_at_a_time(expected_index, insertions);
+      verify_same_markers(index, expected_index, rand);
+
+      for (uint k = 0; k < 5; k++) {
+        Point start = get_random_point(rand);
+        Point old_extent = Point(rand() % 2, rand() % 3);
+        Point new_extent = Point(rand() % 2, rand() % 3);
+        auto result = index.splice(start, old_extent, new_extent);
+        auto expected_result = expected_index.splice(start, old_extent, new_extent);
+        REQUIRE(ids(result.touch) == ids(expected_result.touch));
+        REQUIRE(ids(result.inside) == ids(expected_result.inside));
+        REQUIRE(ids(result.overlap) == ids(expected_result.overlap));
+        REQUIRE(ids(result.surround) == ids(expected_result.surround));
+      }
+      verify_same_markers(index, expected_index, rand);
+
+      MarkerId removed_id = rand() % next_id;
+      if (index.has(removed_id)) {
+        index.remove(removed_id);
+        expected_index.remove(removed_id);
+      }
+    }
+  }
+}
+
+TEST_CASE("MarkerIndex::splice_many - applying several splices at once") {
+  MarkerIndex index;
+  index.bulk_insert({
+    {1, Point(0, 1), Point(0, 3), false},
+    {2, Point(0, 4), Point(0, 8), false},
+    {3, Point(0, 6), Point(0, 7), true},
+  });
+
+  auto result = index.splice_many({
+    {Point(0, 2), Point(0, 1), Point(0, 3)},
+    {Point(0, 6), Point(), Point(0, 2)},
+    {Point(0, 7), Point(0, 2), Point()},
+  });
+
+  REQUIRE(index.get_range(1) == (Range{Point(0, 1), Point(0, 5)}));
+  REQUIRE(index.get_range(2) == (Range{Point(0, 6), Point(0, 11)}));
+  REQUIRE(index.get_range(3) == (Range{Point(0, 10), Point(0, 11)}));
+  REQUIRE(ids(result.touch) == vector<MarkerId>({1, 2, 3}));
+  REQUIRE(ids(result.inside) == vector<MarkerId>({1, 2}));
+  REQUIRE(ids(result.overlap) == vector<MarkerId>({2}));
+  REQUIRE(ids(result.surround) == vector<MarkerId>({}));
+}
+
+TEST_CASE("MarkerIndex::splice_many - random splices") {
+  auto t = time(nullptr);
+  for (uint i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    MarkerIndex index(seed);
+    MarkerIndex expected_index(seed);
+    MarkerIndex sequential_index(seed);
+    auto insertions = get_random_insertions(rand, 0, 30);
+    index.bulk_insert(insertions);
+    expected_index.bulk_insert(insertions);
+    sequential_index.bulk_insert(insertions);
+
+    for (uint j = 0; j < 5; j++) {
+      vector<MarkerIndex::Splice> splices;
+      Point position;
+      for (uint k = 0, n = rand() % 5; k < n; k++) {
+        Point gap(rand() % 2, rand() % 4);
+        if (k > 0 && gap.is_zero()) gap.column = 1;
+        Point start = position.traverse(gap);
+        Point old_extent = Point(rand() % 2, rand() % 3);
+        Point new_extent = Point(rand() % 2, rand() % 3);
+        splices.push_back({start, old_extent, new_extent});
+        position = start.traverse(old_extent);
+      }
+
+      auto result = index.splice_many(splices);
+
+      // Applying the splices from first to last, with each one moved by the
+      // ones before it, leaves the markers in the same places.
+      Point previous_old_end, previous_new_end;
+      for (auto &splice : splices) {
+        Point start = previous_new_end.traverse(splice.start.traversal(previous_old_end));
+        sequential_index.splice(start, splice.old_extent, splice.new_extent);
+        previous_old_end = splice.start.traverse(splice.old_extent);
+        previous_new_end = start.traverse(splice.new_extent);
+      }
+      REQUIRE(index.dump() == sequential_index.dump());
+
+      MarkerIndex::MarkerIdSet touch, inside, overlap, surround;
+      for (auto iter = splices.rbegin(); iter != splices.rend(); ++iter) {
+        auto expected_result = expected_index.splice(iter->start, iter->old_extent, iter->new_extent);
+        touch.insert(expected_result.touch.begin(), expected_result.touch.end());
+        inside.insert(expected_result.inside.begin(), expected_result.inside.end());
+        overlap.insert(expected_result.overlap.begin(), expected_result.overlap.end());
+        surround.insert(expected_result.surround.begin(), expected_result.surround.end());
+      }
+
+      REQUIRE(ids(result.touch) == ids(touch));
+      REQUIRE(ids(result.inside) == ids(inside));
+      REQUIRE(ids(result.overlap) == ids(overlap));
+      REQUIRE(ids(result.surround) == ids(surround));
+      verify_same_markers(index, expected_index, rand);
+    }
+  }
+}
+
+TEST_CASE("MarkerIndex - markers with sparse and reused ids") {
+  MarkerIndex index;
+  index.insert(0, Point(0, 1), Point(0, 2));
+  index.insert(4000000000u, Point(0, 3), Point(0, 4));
+  index.insert(100, Point(0, 5), Point(0, 6));
+  index.insert(1, Point(0, 7), Point(0, 8));
+
+  REQUIRE(index.has(4000000000u));
+  REQUIRE(!index.has(2));
+  REQUIRE(!index.has(99));
+  REQUIRE(index.get_range(4000000000u) == (Range{Point(0, 3), Point(0, 4)}));
+  REQUIRE(index.get_range(100) == (Range{Point(0, 5), Point(0, 6)}));
+
+  index.remove(0);
+  REQUIRE(!index.has(0));
+  index.insert(0, Point(1, 1), Point(1, 2));
+  REQUIRE(index.get_range(0) == (Range{Point(1, 1), Point(1, 2)}));
+
+  // Splicing invalidates the positions that were cached by the reads above.
+  index.splice(Point(0, 0), Point(), Point(1, 0));
+  REQUIRE(index.get_range(0) == (Range{Point(2, 1), Point(2, 2)}));
+  REQUIRE(index.get_range(4000000000u) == (Range{Point(1, 3), Point(1, 4)}));
+  REQUIRE(index.get_range(100) == (Range{Point(1, 5), Point(1, 6)}));
+  REQUIRE(index.compare(100, 1) == -1);
+}
+
+TEST_CASE("MarkerIndex::find_intersecting_ranges - random markers") {
+  auto t = time(nullptr);
+  for (uint i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    MarkerIndex index(seed);
+    index.bulk_insert(get_random_insertions(rand, 0, 40));
+    index.splice(get_random_point(rand), Point(rand() % 2, rand() % 3), Point(rand() % 2, rand() % 3));
+
+    for (uint j = 0; j < 10; j++) {
+      uint32_t start_row = rand() % 10;
+      uint32_t end_row = start_row + rand() % 3;
+      Point start(start_row, 0);
+      Point end(end_row, UINT32_MAX);
+
+      vector<MarkerId> expected_ids = ids(index.find_intersecting(start, end));
+      std::sort(expected_ids.begin(), expected_ids.end(), [&index](MarkerId a, MarkerId b) {
+        int comparison = index.compare(a, b);
+        return comparison == 0 ? a < b : comparison < 0;
+      });
+
+      auto ranges = index.find_intersecting_ranges(start, end);
+      REQUIRE(ranges.size() == expected_ids.size());
+      for (size_t k = 0; k < ranges.size(); k++) {
+        REQUIRE(ranges[k].id == expected_ids[k]);
+        REQUIRE((Range{ranges[k].start, ranges[k].end}) == index.get_range(ranges[k].id));
+      }
+    }
+  }
+}
@@ -1,6 +1,8 @@
 #include "test-helpers.h"
+#include "text-slice.h"
 
 using Change = Patch::Change;
+using std::move;
 using std::vector;
 
 static optional<Text> null_text;
@@ -214,6 +216,67 @@ TEST_CASE("Patch::splice - inconsistent old text") {
   }));
 }
 
+TEST_CASE("Patch::splice_many - random splices") {
+  auto t = time(nullptr);
+  for (uint i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    Text text = get_random_text(rand);
+    Patch patch, expected_patch;
+
+    for (uint j = 0; j < 10; j++) {
+      vector<Point> endpoints;
+      uint32_t splice_count = rand() % 5;
+      for (uint32_t k = 0; k < splice_count; k++) {
+        Range range = get_random_range(rand, text);
+        endpoints.push_back(range.start);
+        endpoints.push_back(rand() % 4 ? range.end : range.start);
+      }
+      std::sort(endpoints.begin(), endpoints.end());
+
+      vector<Patch::Splice> splices;
+      for (uint32_t k = 0; k < splice_count; k++) {
+        Point start = endpoints[2 * k], end = endpoints[2 * k + 1];
+        Text inserted_text = rand() % 4 ? get_random_text(rand) : Text{};
+        uint32_t deleted_text_size = text.offset_for_position(end) - text.offset_for_position(start);
+        splices.push_back({start, end.traversal(start), move(inserted_text), deleted_text_size});
+      }
+
+      for (auto splice = splices.rbegin(); splice != splices.rend(); ++splice) {
+        expected_patch.splice(
+          splice->start,
+          splice->deletion_extent,
+          splice->inserted_text.extent(),
+          optional<Text>{},
+          Text{splice->inserted_text},
+          splice->deleted_text_size
+        );
+        text.splice(splice->start, splice->deletion_extent, TextSlice(splice->inserted_text));
+      }
+      vector<Change> merged_changes = patch.splice_many(move(splices));
+
+      vector<Change> changes = patch.get_changes();
+      vector<Change> expected_changes = expected_patch.get_changes();
+      REQUIRE(changes == expected_changes);
+      REQUIRE(patch.get_change_count() == expected_patch.get_change_count());
+      for (size_t k = 0; k < changes.size(); k++) {
+        REQUIRE(changes[k].preceding_old_text_size == expected_changes[k].preceding_old_text_size);
+        REQUIRE(changes[k].preceding_new_text_size == expected_changes[k].preceding_new_text_size);
+        REQUIRE(changes[k].old_text_size == expected_changes[k].old_text_size);
+      }
+
+      for (const Change &merged_change : merged_changes) {
+        auto change = std::find(changes.begin(), changes.end(), merged_change);
+        REQUIRE(change != changes.end());
+        REQUIRE(merged_change.preceding_old_text_size == change->preceding_old_text_size);
+        REQUIRE(merged_change.old_text_size == change->old_text_size);
+      }
+    }
+  }
+}
+
 TEST_CASE("Patch::find_changes_in_new_range") {
   Patch patch;
 
@@ -327,3 +390,70 @@ TEST_CASE("Patch::serialize") {
     }
   }));
 }
+
+TEST_CASE("Patch::copy and Patch::invert - outliving the original patch") {
+  optional<Patch> patch_copy, inverted_patch;
+
+  {
+    Patch patch;
+    for (uint32_t i = 0; i < 100; i++) {
+      patch.splice(Point{i, 0}, Point{0, 1}, Point{0, 2}, Text{u"a"}, Text{u"bc"});
+    }
+
+    // Clearing the patch releases its nodes, and splicing afterwards
+    // allocates new ones.
+    patch.clear();
+    REQUIRE(patch.get_change_count() == 0);
+    for (uint32_t i = 0; i < 50; i++) {
+      patch.splice(Point{i * 2, 0}, Point{0, 1}, Point{0, 2}, Text{u"a"}, Text{u"bc"});
+    }
+
+    patch_copy = patch.copy();
+    inverted_patch = patch.invert();
+  }
+
+  auto changes = patch_copy->get_changes();
+  REQUIRE(changes.size() == 50);
+  REQUIRE(changes[49].new_start == Point(98, 0));
+  REQUIRE(*changes[49].old_text == Text{u"a"});
+  REQUIRE(*changes[49].new_text == Text{u"bc"});
+
+  auto inverted_changes = inverted_patch->get_changes();
+  REQUIRE(inverted_changes.size() == 50);
+  REQUIRE(*inverted_changes[49].old_text == Text{u"bc"});
+  REQUIRE(*inverted_changes[49].new_text == Text{u"a"});
+}
+
+TEST_CASE("Patch::freeze - reading a frozen patch") {
+  auto t = time(nullptr);
+  for (uint32_t i = 0; i < 20; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    Patch patch;
+    for (uint32_t j = 0; j < 50; j++) {
+      Point start{rand() % 20, rand() % 20};
+      patch.splice(start, Point{rand() % 2, rand() % 5}, Point{rand() % 2, rand() % 5});
+    }
+
+    Patch frozen_patch = patch.copy();
+    frozen_patch.freeze();
+    REQUIRE(frozen_patch.get_changes() == patch.get_changes());
+
+    for (uint32_t j = 0; j < 50; j++) {
+      Point start{rand() % 25, rand() % 25};
+      Point end = start.traverse(Point{rand() % 3, rand() % 10});
+      REQUIRE(
+        frozen_patch.get_change_starting_before_new_position(start) ==
+        patch.get_change_starting_before_new_position(start)
+      );
+      REQUIRE(frozen_patch.get_changes_in_new_range(start, end) == patch.get_changes_in_new_range(start, end));
+    }
+
+    // Splicing thaws the patch.
+    frozen_patch.splice(Point{0, 0}, Point{0, 1}, Point{0, 2});
+    patch.splice(Point{0, 0}, Point{0, 1}, Point{0, 2});
+    REQUIRE(frozen_patch.get_changes() == patch.get_changes());
+  }
+}
@@ -0,0 +1,79 @@
+#include "test-helpers.h"
+#include "regex-cache.h"
+
+using std::u16string;
+
+TEST_CASE("RegexCache::get - reusing compiled patterns") {
+  RegexCache cache(1024 * 1024);
+  u16string error_message;
+
+  auto regex1 = cache.get(u"ab+c", &error_message);
+  auto regex2 = cache.get(u"ab+c", &error_message);
+  auto regex3 = cache.get(u"ab+c", &error_message, true);
+  auto regex4 = cache.get(u"ab+c", &error_message, false, true);
+  REQUIRE(error_message.empty());
+  REQUIRE(regex1 == regex2);
+  REQUIRE(regex1 != regex3);
+  REQUIRE(regex1 != regex4);
+  REQUIRE(regex3 != regex4);
+
+  auto stats = cache.stats();
+  REQUIRE(stats.hits == 1);
+  REQUIRE(stats.misses == 3);
+  REQUIRE(stats.entry_count == 3);
+
+  TextBuffer buffer{u"xABBC abbc"};
+  REQUIRE(buffer.find(*regex1) == (Range{{0, 6}, {0, 10}}));
+  REQUIRE(buffer.find(*regex3) == (Range{{0, 1}, {0, 5}}));
+
+  auto regex5 = cache.get(u"ab(", &error_message);
+  REQUIRE(regex5 == nullptr);
+  REQUIRE(!error_message.empty());
+  REQUIRE(cache.stats().entry_count == 3);
+
+  // A message left over from a previous failure does not affect later lookups.
+  auto regex6 = cache.get(u"ab*", &error_message);
+  REQUIRE(regex6 != nullptr);
+  REQUIRE(error_message.empty());
+  error_message = u"stale";
+  REQUIRE(cache.get(u"ab*", &error_message) == regex6);
+  REQUIRE(error_message.empty());
+  REQUIRE(cache.stats().entry_count == 4);
+
+  cache.clear();
+  stats = cache.stats();
+  REQUIRE(stats.hits == 0);
+  REQUIRE(stats.misses == 0);
+  REQUIRE(stats.entry_count == 0);
+  REQUIRE(stats.size == 0);
+}
+
+TEST_CASE("RegexCache::get - evicting the least recently used patterns") {
+  u16string error_message;
+  size_t entry_size = Regex(u"a1", &error_message).compiled_size() + 2 * sizeof(char16_t);
+  RegexCache cache(entry_size * 3);
+
+  auto regex1 = cache.get(u"a1", &error_message);
+  cache.get(u"a2", &error_message);
+  cache.get(u"a3", &error_message);
+  REQUIRE(cache.stats().entry_count == 3);
+  REQUIRE(cache.stats().size <= entry_size * 3);
+
+  // Using 'a1' makes 'a2' the least recently used pattern.
+  REQUIRE(cache.get(u"a1", &error_message) == regex1);
+  cache.get(u"a4", &error_message);
+  REQUIRE(cache.stats().entry_count == 3);
+
+  auto stats = cache.stats();
+  cache.get(u"a1", &error_message);
+  cache.get(u"a3", &error_message);
+  cache.get(u"a4", &error_message);
+  REQUIRE(cache.stats().hits == stats.hits + 3);
+  cache.get(u"a2", &error_message);
+  REQUIRE(cache.stats().misses == stats.misses + 1);
+
+  // Evicted regexes remain usable by their existing owners.
+  cache.clear();
+  TextBuffer buffer{u"xa1"};
+  REQUIRE(buffer.find(*regex1) == (Range{{0, 1}, {0, 3}}));
+}
@@ -0,0 +1,163 @@
+#include "test-helpers.h"
+#include <algorithm>
+#include "search-session.h"
+
+using std::make_shared;
+using std::u16string;
+using std::vector;
+
+TEST_CASE("SearchSession::update - updating the matches on changed lines") {
+  TextBuffer buffer{u"abc abc\nxyz\nabc"};
+  SearchSession session(buffer, make_shared<Regex>(u"ab+c", nullptr));
+  REQUIRE(session.get_matches() == vector<Range>({
+    Range{Point{0, 0}, Point{0, 3}},
+    Range{Point{0, 4}, Point{0, 7}},
+    Range{Point{2, 0}, Point{2, 3}},
+  }));
+
+  buffer.set_text_in_range(Range{Point{0, 5}, Point{0, 5}}, u"bb\n");
+  auto update = session.update();
+  REQUIRE(update.removed == vector<Range>({
+    Range{Point{0, 4}, Point{1, 2}},
+  }));
+  REQUIRE(update.added == vector<Range>());
+  REQUIRE(session.get_matches() == vector<Range>({
+    Range{Point{0, 0}, Point{0, 3}},
+    Range{Point{3, 0}, Point{3, 3}},
+  }));
+
+  buffer.set_text_in_range(Range{Point{0, 7}, Point{1, 0}}, u"");
+  update = session.update();
+  REQUIRE(update.removed == vector<Range>());
+  REQUIRE(update.added == vector<Range>({
+    Range{Point{0, 4}, Point{0, 9}},
+  }));
+  REQUIRE(session.match_count() == 3);
+
+  REQUIRE(session.get_matches_in_range(Range{Point{0, 5}, Point{1, 3}}) == vector<Range>({
+    Range{Point{0, 4}, Point{0, 9}},
+  }));
+}
+
+TEST_CASE("SearchSession::update - patterns spanning lines") {
+  TextBuffer buffer{u"ab\ncd\nef"};
+  SearchSession session(buffer, make_shared<Regex>(u"a[\\s\\S]*?f", nullptr));
+  REQUIRE(session.get_matches() == vector<Range>({
+    Range{Point{0, 0}, Point{2, 2}},
+  }));
+
+  buffer.set_text_in_range(Range{Point{2, 1}, Point{2, 2}}, u"");
+  auto update = session.update();
+  REQUIRE(update.removed == vector<Range>({
+    Range{Point{0, 0}, Point{2, 1}},
+  }));
+  REQUIRE(update.added == vector<Range>());
+  REQUIRE(session.get_matches() == vector<Range>());
+}
+
+TEST_CASE("SearchSession::update - several edits, including unclipped ones") {
+  TextBuffer buffer{u"abc\r\nabc\nabc"};
+  SearchSession session(buffer, make_shared<Regex>(u"c$", nullptr));
+  REQUIRE(session.match_count() == 3);
+
+  // The buffer clips the positions of its edits before reporting them to the
+  // session, so positions past the end of a line or inside a CRLF line ending
+  // are handled the same way as in the buffer.
+  buffer.set_text_in_range(Range{Point{0, 4}, Point{0, 4}}, u"d");
+  buffer.set_text_in_range(Range{Point{1, 10}, Point{2, 0}}, u"");
+  REQUIRE(buffer.text() == u"abcd\r\nabcabc");
+
+  auto update = session.update();
+  REQUIRE(update.removed == vector<Range>({
+    Range{Point{0, 2}, Point{0, 4}},
+    Range{Point{1, 2}, Point{1, 3}},
+  }));
+  REQUIRE(update.added == vector<Range>());
+  REQUIRE(session.get_matches() == vector<Range>({
+    Range{Point{1, 5}, Point{1, 6}},
+  }));
+}
+
+TEST_CASE("Regex::max_reach") {
+  REQUIRE(Regex(u"abc", nullptr).max_reach() == 3);
+  REQUIRE(Regex(u"ab|c(?=de)", nullptr).max_reach() == 3);
+  REQUIRE(Regex(u"a\\r?\\nb$", nullptr).max_reach() == 6);
+  REQUIRE(Regex(u"[a-c]{2,4}\\b", nullptr).max_reach() == 5);
+  REQUIRE(Regex(u"(?:ab){3}", nullptr).max_reach() == 6);
+  REQUIRE(Regex(u"a{,2}", nullptr).max_reach() == 5);
+  REQUIRE(Regex(u"\\u00e9\\x{e9}", nullptr, false, true).max_reach() == 4);
+  REQUIRE(Regex(u"a+", nullptr).max_reach() == UINT32_MAX);
+  REQUIRE(Regex(u"a{2,}", nullptr).max_reach() == UINT32_MAX);
+  REQUIRE(Regex(u"(a)\\1", nullptr).max_reach() == UINT32_MAX);
+  REQUIRE(Regex(u"(?x)a b", nullptr).max_reach() == UINT32_MAX);
+  REQUIRE(Regex(u"(?R)?", nullptr).max_reach() == UINT32_MAX);
+}
+
+TEST_CASE("SearchSession - random edits") {
+  const vector<u16string> patterns = {
+    u"[a-e]+",
+    u"\\b\\w",
+    u"^a|b$|c\\r?$",
+    u"(?<=a)b|x(?!y)",
+    u"a\\r?\\nb",
+    u"d[^e]*e",
+    u"(?<=b\\s)c|\\Aa|e\\z",
+    u"[ab]\\s{0,3}[cd]",
+    u"x(?=[\\s\\S]{2}y)",
+    u"\\R\\R",
+  };
+
+  auto t = time(nullptr);
+  for (uint i = 0; i < 200; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    TextBuffer buffer{get_random_text(rand).content};
+    const u16string &pattern = patterns[rand() % patterns.size()];
+    Regex regex(pattern, nullptr);
+    SearchSession session(buffer, make_shared<Regex>(pattern, nullptr));
+    vector<Range> matches = session.get_matches();
+    REQUIRE(matches == buffer.find_all(regex));
+
+    for (uint j = 0; j < 10; j++) {
+      // Edit the buffer one or more times before updating the session, with
+      // positions that may be past the end of a line or inside a CRLF.
+      uint32_t edit_count = 1 + rand() % 3;
+      for (uint32_t k = 0; k < edit_count; k++) {
+        Range range = get_random_range(rand, buffer);
+        if (rand() % 3 == 0) range.start.column += rand() % 3;
+        if (rand() % 3 == 0) range.end.column += rand() % 3;
+        if (range.end < range.start) range.end = range.start;
+        if (rand() % 4 == 0) {
+          Range next_range = get_random_range(rand, buffer);
+          if (next_range.start < range.end) std::swap(range, next_range);
+          if (next_range.start < range.end) next_range.start = next_range.end = range.end;
+          buffer.set_text_in_ranges({
+            {range, get_random_text(rand).content},
+            {next_range, get_random_text(rand).content},
+          });
+        } else {
+          buffer.set_text_in_range(range, get_random_text(rand).content);
+        }
+      }
+
+      auto update = session.update();
+      vector<Range> expected_matches = buffer.find_all(regex);
+      REQUIRE(session.get_matches() == expected_matches);
+      REQUIRE(session.match_count() == expected_matches.size());
+
+      // The reported changes only involve the affected matches.
+      for (const Range &range : update.removed) {
+        REQUIRE(std::find(expected_matches.begin(), expected_matches.end(), range) == expected_matches.end());
+      }
+      for (const Range &range : update.added) {
+        REQUIRE(std::find(expected_matches.begin(), expected_matches.end(), range) != expected_matches.end());
+      }
+    }
+
+    buffer.reset(get_random_text(rand));
+    session.update();
+    REQUIRE(session.get_matches() == buffer.find_all(regex));
+  }
+}
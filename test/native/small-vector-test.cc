@@ -0,0 +1,56 @@
+#include "test-helpers.h"
+#include "small-vector.h"
+
+using std::vector;
+
+static vector<uint32_t> values(const small_vector<uint32_t, 4> &elements) {
+  return vector<uint32_t>(elements.begin(), elements.end());
+}
+
+TEST_CASE("small_vector - growing beyond its inline storage") {
+  small_vector<uint32_t, 4> elements{1, 2, 3};
+  REQUIRE(elements.capacity() == 4);
+
+  for (uint32_t value : {4, 5, 6}) elements.push_back(value);
+  REQUIRE(values(elements) == vector<uint32_t>({1, 2, 3, 4, 5, 6}));
+  REQUIRE(elements.capacity() >= 6);
+
+  small_vector<uint32_t, 4> moved(std::move(elements));
+  REQUIRE(values(moved) == vector<uint32_t>({1, 2, 3, 4, 5, 6}));
+  REQUIRE(elements.empty());
+
+  moved.push_back(moved[0]);
+  moved.push_back(moved[6]);
+  REQUIRE(values(moved) == vector<uint32_t>({1, 2, 3, 4, 5, 6, 1, 1}));
+}
+
+TEST_CASE("small_vector::insert") {
+  small_vector<uint32_t, 4> elements{1, 2};
+  vector<uint32_t> inserted{7, 8, 9};
+  elements.insert(elements.begin() + 1, inserted.begin(), inserted.end());
+  REQUIRE(values(elements) == vector<uint32_t>({1, 7, 8, 9, 2}));
+  elements.insert(elements.end(), inserted.begin(), inserted.begin());
+  REQUIRE(values(elements) == vector<uint32_t>({1, 7, 8, 9, 2}));
+}
+
+TEST_CASE("small_vector::insert - elements of the same vector") {
+  for (uint32_t size = 1; size < 8; size++) {
+    for (uint32_t index = 0; index <= size; index++) {
+      for (uint32_t start = 0; start < size; start++) {
+        for (uint32_t end = start + 1; end <= size; end++) {
+          small_vector<uint32_t, 4> elements;
+          vector<uint32_t> expected;
+          for (uint32_t i = 0; i < size; i++) {
+            elements.push_back(i);
+            expected.push_back(i);
+          }
+
+          vector<uint32_t> inserted(expected.begin() + start, expected.begin() + end);
+          expected.insert(expected.begin() + index, inserted.begin(), inserted.end());
+          elements.insert(elements.begin() + index, elements.begin() + start, elements.begin() + end);
+          REQUIRE(values(elements) == expected);
+        }
+      }
+    }
+  }
+}
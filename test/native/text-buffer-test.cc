@@ -2,6 +2,7 @@
 #include <sstream>
 #include "text-buffer.h"
 #include "text-slice.h"
+#include "file-chunk-source.h"
 #include "regex.h"
 #include <future>
 #include <unistd.h>
@@ -28,6 +29,39 @@ TEST_CASE("TextBuffer::set_text_in_range - basic") {
   REQUIRE(buffer.text_in_range(Range {{0, 1}, {10, 1}}) == u"z");
 }
 
+TEST_CASE("TextBuffer::set_text_in_ranges") {
+  TextBuffer buffer{u"abc\ndef\nghi"};
+
+  REQUIRE(buffer.set_text_in_ranges({
+    {Range{{0, 0}, {0, 1}}, u"A"},
+    {Range{{0, 3}, {1, 1}}, u""},
+    {Range{{1, 2}, {1, 2}}, u"1"},
+    {Range{{1, 2}, {1, 2}}, u"2"},
+    {Range{{2, 3}, {2, 9}}, u"!\n"},
+  }));
+  REQUIRE(buffer.text() == u"Abce12f\nghi!\n");
+  REQUIRE(buffer.position_for_offset(13) == Point(2, 0));
+
+  // Ranges that aren't sorted, or that overlap, leave the buffer unchanged.
+  REQUIRE(!buffer.set_text_in_ranges({
+    {Range{{1, 0}, {1, 1}}, u"x"},
+    {Range{{0, 0}, {0, 1}}, u"y"},
+  }));
+  REQUIRE(!buffer.set_text_in_ranges({
+    {Range{{0, 0}, {0, 2}}, u"x"},
+    {Range{{0, 1}, {0, 3}}, u"y"},
+  }));
+  REQUIRE(buffer.text() == u"Abce12f\nghi!\n");
+
+  // Out-of-bounds positions are clipped before any of the edits are applied.
+  TextBuffer clipped_buffer{u"abc\ndef"};
+  REQUIRE(clipped_buffer.set_text_in_ranges({
+    {Range{{0, 2}, {0, 10}}, u""},
+    {Range{{0, 10}, {1, 1}}, u""},
+  }));
+  REQUIRE(clipped_buffer.text() == u"abef");
+}
+
 TEST_CASE("TextBuffer::line_length_for_row - basic") {
   TextBuffer buffer{u"a\n\nb\r\rc\r\n\r\n"};
   REQUIRE(*buffer.line_length_for_row(0) == 1);
@@ -50,6 +84,30 @@ TEST_CASE("TextBuffer::position_for_offset") {
   REQUIRE(buffer.position_for_offset(10) == Point(2, 0));
 }
 
+TEST_CASE("TextBuffer::position_for_offset - changes after the line index is built") {
+  TextBuffer buffer{u"ab\ncd\r\nef"};
+  REQUIRE(buffer.position_for_offset(5) == Point(1, 2));
+
+  // Joining a CR and an LF from either side of a change forms a line ending.
+  buffer.set_text_in_range({{0, 2}, {0, 2}}, u"\r");
+  REQUIRE(*buffer.line_length_for_row(0) == 2);
+  REQUIRE(buffer.position_for_offset(3) == Point(0, 2));
+  REQUIRE(buffer.clip_position({0, 3}).offset == 2);
+
+  auto snapshot = buffer.create_snapshot();
+  buffer.set_text_in_range({{1, 1}, {2, 1}}, u"X\nY\nZ");
+  REQUIRE(buffer.text() == u"ab\r\ncX\nY\nZf");
+  REQUIRE(buffer.extent() == Point(3, 2));
+  REQUIRE(buffer.position_for_offset(9) == Point(3, 0));
+  REQUIRE(buffer.position_for_offset(12) == Point(3, 2));
+  REQUIRE(buffer.clip_position({3, 5}).offset == 11);
+  delete snapshot;
+
+  buffer.set_text_in_range({{0, 0}, {3, 2}}, u"");
+  REQUIRE(buffer.extent() == Point(0, 0));
+  REQUIRE(buffer.position_for_offset(1) == Point(0, 0));
+}
+
 TEST_CASE("TextBuffer::create_snapshot") {
   TextBuffer buffer{u"ab\ndef"};
   buffer.set_text_in_range({{0, 2}, {0, 2}}, u"c");
@@ -97,6 +155,101 @@ TEST_CASE("TextBuffer::create_snapshot") {
   }
 }
 
+TEST_CASE("TextBuffer::create_snapshot - reading from several threads") {
+  u16string content;
+  for (uint32_t i = 0; i < 200; i++) {
+    content += u"line " + u16string(i % 10 + 1, 'a' + i % 26) + u"\n";
+  }
+  TextBuffer buffer{content};
+  for (uint32_t row = 0; row < 200; row += 7) {
+    buffer.set_text_in_range({{row, 2}, {row, 4}}, u"NE");
+  }
+
+  auto snapshot = buffer.create_snapshot();
+  Regex regex(u"[a-z]+", nullptr);
+
+  auto read_snapshot = [&snapshot, &regex]() {
+    u16string result;
+    for (uint32_t row = 0; row < 200; row++) {
+      for (TextSlice chunk : snapshot->chunks_in_range({{row, 0}, {row + 1, 0}})) {
+        result.append(chunk.data(), chunk.size());
+      }
+      result += snapshot->text_in_range({{row, 1}, {row, 5}});
+      result += u16string(snapshot->line_length_for_row(row), '.');
+    }
+    result += u16string(snapshot->find_all(regex).size(), '*');
+    return result;
+  };
+
+  u16string expected = read_snapshot();
+  vector<std::future<u16string>> results;
+  for (uint32_t i = 0; i < 4; i++) {
+    results.push_back(std::async(std::launch::async, read_snapshot));
+  }
+
+  // The buffer can still change while its snapshot is being read.
+  buffer.set_text_in_range({{0, 0}, {10, 0}}, u"xyz");
+
+  for (auto &result : results) {
+    REQUIRE(result.get() == expected);
+  }
+  delete snapshot;
+}
+
+TEST_CASE("TextBuffer::create_snapshot - releasing snapshots beneath ones that are being read") {
+  u16string content;
+  for (uint32_t i = 0; i < 200; i++) {
+    content += u"line " + u16string(i % 10 + 1, 'a' + i % 26) + u"\n";
+  }
+  TextBuffer buffer{content};
+
+  // Each snapshot keeps a layer, so the later snapshots read through the
+  // patches of the layers beneath them.
+  vector<TextBuffer::Snapshot *> snapshots;
+  for (uint32_t i = 0; i < 4; i++) {
+    for (uint32_t row = i; row < 200; row += 5) {
+      buffer.set_text_in_range({{row, 1}, {row, 3}}, u"IN");
+    }
+    snapshots.push_back(buffer.create_snapshot());
+  }
+  REQUIRE(buffer.layer_count() == 5);
+
+  auto snapshot = snapshots.back();
+  snapshots.pop_back();
+  Regex regex(u"[A-Z]+", nullptr);
+
+  auto read_snapshot = [&snapshot, &regex]() {
+    u16string result;
+    for (uint32_t iteration = 0; iteration < 20; iteration++) {
+      result.clear();
+      for (uint32_t row = 0; row < 200; row++) {
+        result += snapshot->text_in_range({{row, 0}, {row, 4}});
+        result += u16string(snapshot->line_length_for_row(row), '.');
+      }
+      result += u16string(snapshot->find_all(regex).size(), '*');
+    }
+    return result;
+  };
+
+  u16string expected = read_snapshot();
+  vector<std::future<u16string>> results;
+  for (uint32_t i = 0; i < 4; i++) {
+    results.push_back(std::async(std::launch::async, read_snapshot));
+  }
+
+  // Releasing the snapshots of the layers beneath leaves those layers in
+  // place, since the remaining snapshot still reads them.
+  for (auto released_snapshot : snapshots) {
+    delete released_snapshot;
+    buffer.set_text_in_range({{0, 0}, {0, 1}}, u"X");
+  }
+
+  for (auto &result : results) {
+    REQUIRE(result.get() == expected);
+  }
+  delete snapshot;
+}
+
 TEST_CASE("TextBuffer::chunks()") {
   TextBuffer buffer{u"abc"};
   buffer.set_text_in_range({{0, 2}, {0, 2}}, u"1");
@@ -232,6 +385,24 @@ TEST_CASE("TextBuffer::flush_changes") {
   REQUIRE(buffer.layer_count() == 1);
 }
 
+TEST_CASE("TextBuffer::flush_changes - many changes per layer") {
+  TextBuffer buffer{u"abc\ndef\r\nghi\njkl"};
+  buffer.set_text_in_range({{0, 1}, {0, 2}}, u"B\nB");
+  buffer.set_text_in_range({{2, 0}, {2, 1}}, u"");
+  buffer.set_text_in_range({{3, 1}, {4, 1}}, u"X\r\nY");
+  auto snapshot = buffer.create_snapshot();
+  buffer.set_text_in_range({{0, 0}, {0, 0}}, u"0");
+  buffer.set_text_in_range({{4, 3}, {4, 3}}, u"!");
+  REQUIRE(buffer.layer_count() == 3);
+
+  delete snapshot;
+  buffer.flush_changes();
+  REQUIRE(buffer.layer_count() == 1);
+  REQUIRE(buffer.base_text() == Text{u"0aB\nBc\nef\r\ngX\r\nYkl!"});
+  REQUIRE(buffer.base_text().extent() == Point(4, 4));
+  REQUIRE(buffer.text() == u"0aB\nBc\nef\r\ngX\r\nYkl!");
+}
+
 TEST_CASE("Snapshot::flush_preceding_changes") {
   TextBuffer buffer{u"abcdef"};
   REQUIRE(buffer.layer_count() == 1);
@@ -259,7 +430,7 @@ TEST_CASE("Snapshot::flush_preceding_changes") {
     REQUIRE(snapshot2->text() == u"aBCdef");
     REQUIRE(!buffer.is_modified());
 
-    TextBuffer copy_buffer{buffer.base_text().content};
+    TextBuffer copy_buffer{buffer.base_text().text().content};
     Serializer serializer(bytes);
     buffer.serialize_changes(serializer);
     Deserializer deserializer(bytes);
@@ -283,7 +454,7 @@ TEST_CASE("Snapshot::flush_preceding_changes") {
     REQUIRE(snapshot2->text() == u"aBCdef");
     REQUIRE(buffer.is_modified());
 
-    TextBuffer copy_buffer{buffer.base_text().content};
+    TextBuffer copy_buffer{buffer.base_text().text().content};
     Serializer serializer(bytes);
     buffer.serialize_changes(serializer);
     Deserializer deserializer(bytes);
@@ -299,6 +470,101 @@ TEST_CASE("Snapshot::flush_preceding_changes") {
   }
 }
 
+TEST_CASE("Snapshot::flush_preceding_changes - with a text built in advance") {
+  TextBuffer buffer{u"abcdef"};
+  buffer.set_text_in_range({{0, 1}, {0, 2}}, u"B");
+  auto snapshot = buffer.create_snapshot();
+  auto flushed_text = std::async(std::launch::async, [snapshot]() {
+    return snapshot->build_flushed_text();
+  }).get();
+  REQUIRE(*flushed_text == Text{u"aBcdef"});
+
+  buffer.set_text_in_range({{0, 2}, {0, 3}}, u"C");
+  snapshot->flush_preceding_changes(move(flushed_text));
+  REQUIRE(buffer.base_text() == Text{u"aBcdef"});
+  REQUIRE(buffer.text() == u"aBCdef");
+  delete snapshot;
+  REQUIRE(buffer.layer_count() == 2);
+
+  // Snapshots of an unchanged buffer share its base text.
+  buffer.flush_changes();
+  snapshot = buffer.create_snapshot();
+  REQUIRE(!snapshot->build_flushed_text());
+  delete snapshot;
+
+  // Nor do snapshots of a layer that another snapshot has already flushed.
+  buffer.set_text_in_range({{0, 3}, {0, 4}}, u"D");
+  auto snapshot1 = buffer.create_snapshot();
+  auto snapshot2 = buffer.create_snapshot();
+  snapshot1->flush_preceding_changes();
+  REQUIRE(!snapshot2->build_flushed_text());
+  snapshot2->flush_preceding_changes();
+  REQUIRE(buffer.base_text() == Text{u"aBCDef"});
+  delete snapshot1;
+  delete snapshot2;
+}
+
+TEST_CASE("TextBuffer::set_consolidation_policy") {
+  TextBuffer buffer{u"abcdef"};
+  buffer.set_consolidation_policy({3, 5, SIZE_MAX});
+
+  // Layers are only added when a buffer changes while a snapshot uses it.
+  auto snapshot = buffer.create_snapshot();
+  buffer.set_text_in_range({{0, 0}, {0, 1}}, u"A");
+  delete snapshot;
+  snapshot = buffer.create_snapshot();
+  buffer.set_text_in_range({{0, 1}, {0, 2}}, u"B");
+  delete snapshot;
+  REQUIRE(buffer.layer_count() == 3);
+  REQUIRE(buffer.text() == u"ABcdef");
+
+  // Releasing a snapshot consolidates the layers once there are too many...
+  snapshot = buffer.create_snapshot();
+  buffer.set_text_in_range({{0, 2}, {0, 3}}, u"C");
+  delete snapshot;
+  REQUIRE(buffer.layer_count() == 2);
+  REQUIRE(buffer.text() == u"ABCdef");
+
+  // ...or once they contain too many changes.
+  snapshot = buffer.create_snapshot();
+  for (uint32_t column = 0; column < 12; column += 2) {
+    buffer.set_text_in_range({{0, column}, {0, column}}, u"-");
+  }
+  REQUIRE(buffer.layer_count() == 3);
+  delete snapshot;
+  REQUIRE(buffer.layer_count() == 2);
+  REQUIRE(buffer.text() == u"-A-B-C-d-e-f");
+  REQUIRE(buffer.base_text() == Text{u"abcdef"});
+
+  buffer.set_consolidation_policy({3, SIZE_MAX, SIZE_MAX});
+  snapshot = buffer.create_snapshot();
+  buffer.set_text_in_range({{0, 0}, {0, 1}}, u"");
+  delete snapshot;
+  REQUIRE(buffer.layer_count() == 3);
+
+  buffer.set_consolidation_policy({1, 0, 0});
+  REQUIRE(buffer.layer_count() == 2);
+  REQUIRE(buffer.text() == u"A-B-C-d-e-f");
+
+  // ...or once the text they insert grows too large.
+  buffer.flush_changes();
+  buffer.set_consolidation_policy({SIZE_MAX, SIZE_MAX, 8 * sizeof(char16_t)});
+  snapshot = buffer.create_snapshot();
+  buffer.set_text_in_range({{0, 0}, {0, 0}}, u"1234");
+  delete snapshot;
+  snapshot = buffer.create_snapshot();
+  buffer.set_text_in_range({{0, 0}, {0, 0}}, u"5678");
+  delete snapshot;
+  REQUIRE(buffer.layer_count() == 3);
+
+  snapshot = buffer.create_snapshot();
+  buffer.set_text_in_range({{0, 0}, {0, 0}}, u"9");
+  REQUIRE(buffer.layer_count() == 4);
+  delete snapshot;
+  REQUIRE(buffer.layer_count() == 2);
+  REQUIRE(buffer.text() == u"956781234A-B-C-d-e-f");
+}
+
 TEST_CASE("TextBuffer::reset") {
   TextBuffer buffer{u"abcdef"};
   auto snapshot1 = buffer.create_snapshot();
@@ -331,6 +597,40 @@ TEST_CASE("TextBuffer::reset") {
   REQUIRE(buffer.text() == u"456");
 }
 
+TEST_CASE("TextBuffer::reset - with a lazily loaded text") {
+  uint32_t max_chunk_size = ChunkedText::MAX_CHUNK_SIZE;
+  ChunkedText::MAX_CHUNK_SIZE = 8;
+
+  std::string input;
+  for (uint32_t i = 0; i < 20; i++) input += "line \xce\xb3\r\n";
+  FILE *file = tmpfile();
+  fwrite(input.data(), 1, input.size(), file);
+  rewind(file);
+
+  TextBuffer buffer;
+  buffer.reset(std::move(*FileChunkSource::load(file, [](size_t) {})));
+  REQUIRE(!buffer.is_modified());
+  REQUIRE(buffer.extent() == Point(20, 0));
+  REQUIRE(buffer.position_for_offset(24) == Point(3, 0));
+  REQUIRE(buffer.line_for_row(10) == u16string(u"line γ"));
+
+  buffer.set_text_in_range({{1, 0}, {1, 4}}, u"LINE");
+  auto snapshot = buffer.create_snapshot();
+
+  // Overwriting the file's last line makes its chunk unreadable, which the
+  // snapshot reports once it has read it.
+  fseek(file, input.size() - 4, SEEK_SET);
+  fwrite("x", 1, 1, file);
+  fflush(file);
+  REQUIRE(!snapshot->has_read_error());
+  u16string text = snapshot->text();
+  REQUIRE(text.substr(0, 16) == u"line γ\r\nLINE γ\r\n");
+  REQUIRE(snapshot->has_read_error());
+  delete snapshot;
+
+  ChunkedText::MAX_CHUNK_SIZE = max_chunk_size;
+}
+
 TEST_CASE("TextBuffer::find") {
   TextBuffer buffer{u"abcd\nef"};
 
@@ -404,6 +704,77 @@ TEST_CASE("TextBuffer::find_all") {
   }));
 }
 
+TEST_CASE("TextBuffer::find_all - context preceding the search position") {
+  TextBuffer buffer{u"xfoo foo\nbar"};
+  REQUIRE(buffer.find_all(Regex(u"x|\\bfoo", nullptr)) == vector<Range>({
+    Range{Point{0, 0}, Point{0, 1}},
+    Range{Point{0, 5}, Point{0, 8}},
+  }));
+
+  REQUIRE(buffer.find_all(Regex(u"o|(?<=o)\\s", nullptr)) == vector<Range>({
+    Range{Point{0, 2}, Point{0, 3}},
+    Range{Point{0, 3}, Point{0, 4}},
+    Range{Point{0, 4}, Point{0, 5}},
+    Range{Point{0, 6}, Point{0, 7}},
+    Range{Point{0, 7}, Point{0, 8}},
+    Range{Point{0, 8}, Point{1, 0}},
+  }));
+}
+
+TEST_CASE("TextBuffer::find_all - context preceding a chunk") {
+  TextBuffer buffer{u"xx\nb c"};
+  buffer.set_text_in_range({{1, 0}, {1, 0}}, u"a");
+  buffer.set_text_in_range({{1, 3}, {1, 3}}, u"c");
+  REQUIRE(buffer.text() == u"xx\nab cc");
+
+  REQUIRE(buffer.find_all(Regex(u"\\Aa|(?<=b\\s)c", nullptr)) == vector<Range>({
+    Range{Point{1, 3}, Point{1, 4}},
+  }));
+}
+
+TEST_CASE("TextBuffer::find_all - literal patterns") {
+  TextBuffer buffer{u"a.b(c) A.B(C)\na.b(c) ab"};
+  buffer.set_text_in_range({{0, 3}, {0, 3}}, u"(c) a.b");
+  buffer.set_text_in_range({{1, 2}, {1, 2}}, u"b(c) a.");
+  REQUIRE(buffer.text() == u"a.b(c) a.b(c) A.B(C)\na.b(c) a.b(c) ab");
+
+  REQUIRE(buffer.find_all(Regex(u"a\\.b\\(c\\)", nullptr)) == vector<Range>({
+    Range{Point{0, 0}, Point{0, 6}},
+    Range{Point{0, 7}, Point{0, 13}},
+    Range{Point{1, 0}, Point{1, 6}},
+    Range{Point{1, 7}, Point{1, 13}},
+  }));
+
+  REQUIRE(buffer.find_all(Regex(u"A\\.b\\(C\\)", nullptr, true)) == vector<Range>({
+    Range{Point{0, 0}, Point{0, 6}},
+    Range{Point{0, 7}, Point{0, 13}},
+    Range{Point{0, 14}, Point{0, 20}},
+    Range{Point{1, 0}, Point{1, 6}},
+    Range{Point{1, 7}, Point{1, 13}},
+  }));
+
+  // Patterns beginning with literal characters
+  REQUIRE(buffer.find_all(Regex(u"a\\.b\\((c|x)\\) a", nullptr)) == vector<Range>({
+    Range{Point{0, 0}, Point{0, 8}},
+    Range{Point{1, 0}, Point{1, 8}},
+  }));
+  REQUIRE(buffer.find_all(Regex(u"a\\.B|ab", nullptr)) == vector<Range>({
+    Range{Point{1, 14}, Point{1, 16}},
+  }));
+  REQUIRE(buffer.find_all(Regex(u"a\\.b*\\(", nullptr)) == vector<Range>({
+    Range{Point{0, 0}, Point{0, 4}},
+    Range{Point{0, 7}, Point{0, 11}},
+    Range{Point{1, 0}, Point{1, 4}},
+    Range{Point{1, 7}, Point{1, 11}},
+  }));
+  REQUIRE(buffer.find_all(Regex(u"ab?", nullptr)).size() == 5);
+}
+
+TEST_CASE("TextBuffer::find - deeply nested patterns") {
+  TextBuffer buffer{u16string(20000, 'a') + u"c"};
+  REQUIRE(buffer.find(Regex(u"(a|b)*c", nullptr)) == (Range{Point{0, 0}, Point{0, 20001}}));
+}
+
 TEST_CASE("TextBuffer::find_all - empty matches") {
   TextBuffer buffer{u"aab\nab\nb\n"};
   REQUIRE(buffer.find_all(Regex(u"^a*", nullptr)) == vector<Range>({
@@ -427,6 +798,60 @@ TEST_CASE("TextBuffer::find_all - empty matches") {
   }));
 }
 
+TEST_CASE("TextBuffer::find_all - searching in parallel segments") {
+  TextBuffer buffer{u"abc\ndef\r\nghi\njkl\nmno\npqr\n"};
+  buffer.set_text_in_range({{2, 1}, {2, 2}}, u"H");
+  auto segment_size = TextBuffer::MIN_PARALLEL_SEARCH_SEGMENT_SIZE;
+  TextBuffer::MIN_PARALLEL_SEARCH_SEGMENT_SIZE = 4;
+
+  REQUIRE(buffer.find_all(Regex(u"\\w+", nullptr)) == vector<Range>({
+    Range{Point{0, 0}, Point{0, 3}},
+    Range{Point{1, 0}, Point{1, 3}},
+    Range{Point{2, 0}, Point{2, 3}},
+    Range{Point{3, 0}, Point{3, 3}},
+    Range{Point{4, 0}, Point{4, 3}},
+    Range{Point{5, 0}, Point{5, 3}},
+  }));
+
+  // Matches that span several rows cause the following segments to be
+  // searched again from the end of the match.
+  REQUIRE(buffer.find_all(Regex(u"c\\ndef\\r\\ngHi\\nj|k|o\\np", nullptr)) == vector<Range>({
+    Range{Point{0, 2}, Point{3, 1}},
+    Range{Point{3, 1}, Point{3, 2}},
+    Range{Point{4, 2}, Point{5, 1}},
+  }));
+
+  REQUIRE(buffer.find_all(Regex(u"^", nullptr), {{1, 1}, {6, 0}}) == vector<Range>({
+    Range{Point{2, 0}, Point{2, 0}},
+    Range{Point{3, 0}, Point{3, 0}},
+    Range{Point{4, 0}, Point{4, 0}},
+    Range{Point{5, 0}, Point{5, 0}},
+    Range{Point{6, 0}, Point{6, 0}},
+  }));
+
+  // Lookbehinds see the text preceding each segment, but not the text
+  // preceding the range.
+  REQUIRE(buffer.find_all(Regex(u"(?<=\\n)\\w", nullptr), {{3, 0}, {6, 0}}) == vector<Range>({
+    Range{Point{4, 0}, Point{4, 1}},
+    Range{Point{5, 0}, Point{5, 1}},
+  }));
+  REQUIRE(buffer.find_all(Regex(u"(?<![\\s\\S])\\w", nullptr), {{3, 0}, {6, 0}}) == vector<Range>({
+    Range{Point{3, 0}, Point{3, 1}},
+  }));
+  REQUIRE(buffer.find_all(Regex(u"\\A\\w", nullptr), {{3, 0}, {6, 0}}) == vector<Range>({
+    Range{Point{3, 0}, Point{3, 1}},
+  }));
+
+  MarkerIndex index;
+  REQUIRE(buffer.find_and_mark_all(index, 1, false, Regex(u"[aeiou]", nullptr)) == 4);
+  REQUIRE(index.get_range(1) == (Range{Point{0, 0}, Point{0, 1}}));
+  REQUIRE(index.get_range(2) == (Range{Point{1, 1}, Point{1, 2}}));
+  REQUIRE(index.get_range(3) == (Range{Point{2, 2}, Point{2, 3}}));
+  REQUIRE(index.get_range(4) == (Range{Point{4, 2}, Point{4, 3}}));
+
+  TextBuffer::MIN_PARALLEL_SEARCH_SEGMENT_SIZE = segment_size;
+}
+
 TEST_CASE("TextBuffer::find_words_with_subsequence_in_range") {
   {
     TextBuffer buffer{u"banana band bandana banana"};
@@ -471,7 +896,7 @@ TEST_CASE("TextBuffer::has_astral") {
 }
 
 struct SnapshotData {
-  Text base_text;
+  ChunkedText base_text;
   u16string text;
   Point extent;
   vector<Point> line_end_positions;
@@ -479,7 +904,7 @@ struct SnapshotData {
 
 struct SnapshotTask {
   TextBuffer::Snapshot *snapshot;
-  Text base_text;
+  ChunkedText base_text;
   Text mutated_text;
   std::future<vector<SnapshotData>> future;
 };
@@ -497,8 +922,26 @@ void query_random_ranges(TextBuffer &buffer, Generator &rand, Text &mutated_text
   }
 }
 
+// Once a position has been converted from an offset, the buffer answers these
+// queries from its line index. Compare them with the reference text, including
+// positions past the end of a line or inside a CRLF line ending.
+void query_random_offsets_and_positions(TextBuffer &buffer, Generator &rand, const Text &mutated_text) {
+  for (uint32_t k = 0; k < 10; k++) {
+    uint32_t offset = rand() % (mutated_text.size() + 3);
+    REQUIRE(buffer.position_for_offset(offset) == mutated_text.position_for_offset(offset));
+
+    Point position(rand() % (mutated_text.extent().row + 2), rand() % 12);
+    ClipResult expected = mutated_text.clip_position(position);
+    ClipResult actual = buffer.clip_position(position);
+    REQUIRE(actual.position == expected.position);
+    REQUIRE(actual.offset == expected.offset);
+  }
+}
+
 TEST_CASE("TextBuffer - random edits and queries") {
   TextBuffer::MAX_CHUNK_SIZE_TO_COPY = 2;
+  uint32_t max_chunk_size = ChunkedText::MAX_CHUNK_SIZE;
+  ChunkedText::MAX_CHUNK_SIZE = 8;
 
   auto t = time(nullptr);
   for (uint i = 0; i < 100; i++) {
@@ -561,6 +1004,7 @@ TEST_CASE("TextBuffer - random edits and queries") {
       // cout << "extent: " << mutated_text.extent() << "\ntext: " << mutated_text << "\n";
       REQUIRE(buffer.extent() == mutated_text.extent());
       REQUIRE(buffer.text() == mutated_text.content);
+      query_random_offsets_and_positions(buffer, rand, mutated_text);
 
       for (uint32_t row = 0; row < mutated_text.extent().row; row++) {
         REQUIRE(
@@ -590,6 +1034,29 @@ TEST_CASE("TextBuffer - random edits and queries") {
         } else {
           REQUIRE(search_result == optional<Range>());
         }
+
+        // Searching the buffer in several independent segments produces the
+        // same matches as searching it from start to end.
+        auto find_all_result = buffer.find_all(regex);
+        auto segment_size = TextBuffer::MIN_PARALLEL_SEARCH_SEGMENT_SIZE;
+        TextBuffer::MIN_PARALLEL_SEARCH_SEGMENT_SIZE = 1;
+        REQUIRE(buffer.find_all(regex) == find_all_result);
+        TextBuffer::MIN_PARALLEL_SEARCH_SEGMENT_SIZE = segment_size;
+
+        // The same holds for patterns that look at the text preceding a
+        // segment.
+        static const char16_t *CONTEXT_PATTERNS[] = {
+          u"(?<=\\s)\\w",
+          u"(?<=\\n)\\w",
+          u"(?<![\\s\\S])\\w",
+          u"(?<=\\w{3})\\w",
+          u"\\A\\w",
+        };
+        Regex context_regex(CONTEXT_PATTERNS[rand() % 5], nullptr);
+        find_all_result = buffer.find_all(context_regex);
+        TextBuffer::MIN_PARALLEL_SEARCH_SEGMENT_SIZE = 1;
+        REQUIRE(buffer.find_all(context_regex) == find_all_result);
+        TextBuffer::MIN_PARALLEL_SEARCH_SEGMENT_SIZE = segment_size;
       }
 
       query_random_ranges(buffer, rand, mutated_text);
@@ -604,6 +1071,7 @@ TEST_CASE("TextBuffer - random edits and queries") {
 
         if (rand() % 3) {
           snapshot_tasks[snapshot_index].snapshot->flush_preceding_changes();
+          query_random_offsets_and_positions(buffer, rand, Text{buffer.text()});
         }
 
         for (auto data : snapshot_tasks[snapshot_index].future.get()) {
@@ -618,6 +1086,7 @@ TEST_CASE("TextBuffer - random edits and queries") {
         // cout << "delete snapshot " << snapshot_index << "\n";
         delete snapshot_tasks[snapshot_index].snapshot;
         snapshot_tasks.erase(snapshot_tasks.begin() + snapshot_index);
+        query_random_offsets_and_positions(buffer, rand, Text{buffer.text()});
       }
     }
 
@@ -627,7 +1096,88 @@ TEST_CASE("TextBuffer - random edits and queries") {
     }
 
     REQUIRE(buffer.layer_count() <= 2);
+    Text final_text{buffer.text()};
     buffer.flush_changes();
     REQUIRE(buffer.layer_count() == 1);
+    REQUIRE(buffer.base_text() == final_text);
+    query_random_offsets_and_positions(buffer, rand, final_text);
+  }
+
+  ChunkedText::MAX_CHUNK_SIZE = max_chunk_size;
+}
+
+TEST_CASE("TextBuffer::set_text_in_ranges - random edits") {
+  auto t = time(nullptr);
+  for (uint i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    Text original_text = get_random_text(rand);
+    TextBuffer buffer{original_text.content};
+    Text expected_text{original_text};
+    vector<TextBuffer::Snapshot *> snapshots;
+
+    for (uint j = 0; j < 10; j++) {
+      if (rand() % 2) buffer.position_for_offset(0);
+      if (rand() % 3 == 0) snapshots.push_back(buffer.create_snapshot());
+
+      // The edits' endpoints are random, possibly unclipped, positions, sorted
+      // so that some of the edits are empty or touch each other.
+      vector<Point> endpoints;
+      uint32_t edit_count = rand() % 5;
+      for (uint32_t k = 0; k < edit_count; k++) {
+        Range range = get_random_range(rand, buffer);
+        endpoints.push_back(range.start);
+        endpoints.push_back(rand() % 4 ? range.end : range.start);
+      }
+      for (Point &endpoint : endpoints) {
+        if (rand() % 4 == 0) endpoint.column += rand() % 3;
+        endpoint = buffer.clip_position(endpoint).position;
+      }
+      std::sort(endpoints.begin(), endpoints.end());
+
+      vector<TextBuffer::Edit> edits;
+      for (uint32_t k = 0; k < edit_count; k++) {
+        edits.push_back({Range{endpoints[2 * k], endpoints[2 * k + 1]}, get_random_text(rand).content});
+      }
+
+      // The ranges all refer to the text before the edits, so the expected
+      // text is built from the offsets of their endpoints in that text.
+      // cout << "set_text_in_ranges(" << edits.size() << " edits)\n";
+      u16string new_text;
+      uint32_t previous_offset = 0;
+      for (const TextBuffer::Edit &edit : edits) {
+        uint32_t start_offset = expected_text.clip_position(edit.old_range.start).offset;
+        uint32_t end_offset = expected_text.clip_position(edit.old_range.end).offset;
+        new_text.append(expected_text.content, previous_offset, start_offset - previous_offset);
+        new_text.append(edit.new_text);
+        previous_offset = end_offset;
+      }
+      new_text.append(expected_text.content, previous_offset, u16string::npos);
+      expected_text = Text{move(new_text)};
+      REQUIRE(buffer.set_text_in_ranges(move(edits)));
+
+      REQUIRE(buffer.extent() == expected_text.extent());
+      REQUIRE(buffer.size() == expected_text.size());
+      REQUIRE(buffer.text() == expected_text.content);
+      query_random_offsets_and_positions(buffer, rand, expected_text);
+      for (uint32_t row = 0; row <= expected_text.extent().row; row++) {
+        REQUIRE(*buffer.line_length_for_row(row) == expected_text.line_length_for_row(row));
+      }
+
+      if (!snapshots.empty() && rand() % 3 == 0) {
+        uint32_t snapshot_index = rand() % snapshots.size();
+        if (rand() % 2) snapshots[snapshot_index]->flush_preceding_changes();
+        delete snapshots[snapshot_index];
+        snapshots.erase(snapshots.begin() + snapshot_index);
+        REQUIRE(buffer.text() == expected_text.content);
+        query_random_offsets_and_positions(buffer, rand, expected_text);
+      }
+    }
+
+    for (auto snapshot : snapshots) delete snapshot;
+    REQUIRE(buffer.text() == expected_text.content);
+    if (!buffer.is_modified()) REQUIRE(buffer.text() == buffer.base_text().text().content);
   }
 }
@@ -4,6 +4,7 @@
 #include "text-diff.h"
 
 using Change = Patch::Change;
+using std::u16string;
 using std::vector;
 
 TEST_CASE("text_diff - multiple lines") {
@@ -145,4 +146,58 @@ TEST_CASE("text_diff - randomized changes") {
 
     REQUIRE(old_text == new_text);
   }
-}
\ No newline at end of file
+}
+
+TEST_CASE("text_diff - many changes throughout a large text") {
+  u16string old_content, new_content;
+  for (uint32_t i = 0; i < 3000; i++) {
+    u16string line = u"line " + u16string(1, 'a' + i % 26) + u16string(i % 7, 'x') + u"\n";
+    old_content += line;
+    if (i % 5 == 0) {
+      line[0] = 'L';
+    }
+    new_content += line;
+  }
+
+  Text old_text{old_content};
+  Text new_text{new_content};
+  Patch patch = text_diff(old_text, new_text);
+
+  // Each changed line produces its own single-character change, rather than
+  // the whole text being replaced.
+  auto changes = patch.get_changes();
+  REQUIRE(changes.size() == 600);
+  for (const Change &change : changes) {
+    REQUIRE(*change.old_text == Text{u"l"});
+    REQUIRE(*change.new_text == Text{u"L"});
+  }
+
+  for (const Change &change : changes) {
+    old_text.splice(change.new_start, change.old_end.traversal(change.old_start), *change.new_text);
+  }
+  REQUIRE(old_text == new_text);
+}
+
+TEST_CASE("text_diff - texts large enough to be diffed in parallel segments") {
+  u16string old_content, new_content;
+  for (uint32_t i = 0; i < 50000; i++) {
+    std::string number = std::to_string(i);
+    u16string line = u"line " + u16string(number.begin(), number.end()) + u" of the text\n";
+    if (i % 100 != 50) old_content += line;
+    if (i % 10 == 0) line.replace(line.find(u"the"), 3, u"THE");
+    if (i % 100 != 75) new_content += line;
+  }
+
+  Text old_text{old_content};
+  Text new_text{new_content};
+  Patch patch = text_diff(old_text, new_text);
+
+  // One change per edited line, plus one per inserted or deleted line.
+  auto changes = patch.get_changes();
+  REQUIRE(changes.size() == 4500 + 500 + 500);
+
+  for (const Change &change : changes) {
+    old_text.splice(change.new_start, change.old_end.traversal(change.old_start), *change.new_text);
+  }
+  REQUIRE(old_text == new_text);
+}
@@ -1,6 +1,10 @@
 #include "test-helpers.h"
 #include "text.h"
 #include "text-slice.h"
+#include <future>
+
+using std::u16string;
+using std::vector;
 
 TEST_CASE("Text::split") {
   Text text {u"abc\ndef\r\nghi"};
@@ -76,6 +80,98 @@ TEST_CASE("Text::splice") {
   REQUIRE(text == Text {u"def\nghiabc\nduvwemno\npkl\nxyz\r\nabc"});
 }
 
+TEST_CASE("Text::Text - line offsets in long content") {
+  u16string content;
+  vector<uint32_t> expected_line_offsets {0};
+  for (uint32_t i = 0; i < 200; i++) {
+    content += u16string(u"abcdefghijklmnopqrstuvwxyz", i % 27);
+    content += (i % 5 == 0) ? u"\r\n" : u"\n";
+    expected_line_offsets.push_back(content.size());
+    if (i % 11 == 0) content += u"\r\xd83d\xde01\u010a";
+  }
+  content += u"xyz";
+
+  Text text {content};
+  REQUIRE(text.line_offsets == expected_line_offsets);
+  REQUIRE(text.extent() == Point(200, 3));
+  REQUIRE(Text::extent(content) == Point(200, 3));
+  REQUIRE(Text::extent(u"abc\r\ndef\n") == Point(2, 0));
+}
+
+TEST_CASE("Text - copying and moving line offsets") {
+  Text short_text{u"ab\ncd"};
+  Text long_text{u"a\nb\nc\nd\n"};
+
+  Text short_copy = short_text;
+  Text long_copy = long_text;
+  REQUIRE(short_copy.line_offsets == vector<uint32_t>({0, 3}));
+  REQUIRE(long_copy.line_offsets == vector<uint32_t>({0, 2, 4, 6, 8}));
+
+  Text short_moved = std::move(short_copy);
+  Text long_moved = std::move(long_copy);
+  REQUIRE(short_moved.line_offsets == vector<uint32_t>({0, 3}));
+  REQUIRE(long_moved.line_offsets == vector<uint32_t>({0, 2, 4, 6, 8}));
+
+  short_moved = std::move(long_moved);
+  REQUIRE(short_moved.line_offsets == vector<uint32_t>({0, 2, 4, 6, 8}));
+  short_moved.splice(Point{1, 0}, Point{3, 0}, TextSlice(short_text));
+  REQUIRE(short_moved == Text{u"a\nab\ncd"});
+  REQUIRE(short_moved.line_offsets == vector<uint32_t>({0, 2, 5}));
+}
+
+TEST_CASE("Text::digest - reusing checkpoints after changes") {
+  u16string content;
+  for (uint32_t i = 0; i < 5000; i++) {
+    content += u"line " + u16string(1, 'a' + i % 26) + u"\n";
+  }
+
+  Text text{content};
+  auto expected_digest = [](const Text &text) {
+    return Text{u16string(text.content)}.digest();
+  };
+  size_t digest = text.digest();
+  REQUIRE(digest == expected_digest(text));
+  REQUIRE(text.digest() == digest);
+
+  text.splice(Point{3000, 2}, Point{1, 0}, Text{u"XYZ\n\n"});
+  REQUIRE(text.digest() != digest);
+  REQUIRE(text.digest() == expected_digest(text));
+
+  text.append(Text{u"the end"});
+  REQUIRE(text.digest() == expected_digest(text));
+
+  Text prefix{TextSlice(text).prefix(Point{4000, 0})};
+  REQUIRE(prefix.digest() == expected_digest(prefix));
+
+  Text copy;
+  copy.append(TextSlice(text).prefix(Point{2000, 3}));
+  copy.append(TextSlice(text).suffix(Point{2000, 4}));
+  REQUIRE(copy.digest() == expected_digest(copy));
+
+  copy.assign(TextSlice(text).suffix(Point{1, 0}));
+  REQUIRE(copy.digest() == expected_digest(copy));
+
+  Text copied{text};
+  REQUIRE(copied.digest() == text.digest());
+  Text moved{std::move(copied)};
+  REQUIRE(moved.digest() == text.digest());
+  copy = moved;
+  copy.splice(Point{10, 0}, Point{}, Text{u"!"});
+  REQUIRE(copy.digest() == expected_digest(copy));
+  REQUIRE(moved.digest() == text.digest());
+
+  copy.clear();
+  REQUIRE(copy.digest() == Text{}.digest());
+
+  // The checkpoints are created by whichever digest computation comes first.
+  Text shared{content};
+  vector<std::future<size_t>> digests;
+  for (uint32_t i = 0; i < 4; i++) {
+    digests.push_back(std::async(std::launch::async, [&shared]() { return shared.digest(); }));
+  }
+  for (auto &future : digests) REQUIRE(future.get() == expected_digest(shared));
+}
+
 TEST_CASE("Text::offset_for_position - basic") {
   Text text {u"abc\ndefg\r\nhijkl"};
 
@@ -0,0 +1,50 @@
+#include "test-helpers.h"
+#include "thread-pool.h"
+#include <atomic>
+#include <thread>
+
+using std::vector;
+
+TEST_CASE("ThreadPool::parallel_for - calling the function once per index") {
+  for (unsigned worker_count : {0, 1, 3}) {
+    ThreadPool pool(worker_count);
+    REQUIRE(pool.concurrency() == worker_count + 1);
+
+    for (size_t count : {0, 1, 2, 100}) {
+      vector<std::atomic<unsigned>> calls(count);
+      for (auto &call_count : calls) call_count = 0;
+      pool.parallel_for(count, [&calls](size_t i) { calls[i]++; });
+      for (auto &call_count : calls) REQUIRE(call_count == 1);
+    }
+  }
+}
+
+TEST_CASE("ThreadPool::parallel_for - running loops from several threads at once") {
+  ThreadPool pool(2);
+  std::atomic<unsigned> busy_thread_count{0};
+  std::atomic<unsigned> max_busy_thread_count{0};
+  vector<std::atomic<unsigned>> calls(8 * 50);
+  for (auto &call_count : calls) call_count = 0;
+
+  vector<std::thread> callers;
+  for (unsigned caller = 0; caller < 8; caller++) {
+    callers.emplace_back([&, caller]() {
+      pool.parallel_for(50, [&, caller](size_t i) {
+        unsigned busy_count = ++busy_thread_count;
+        unsigned max_busy_count = max_busy_thread_count;
+        while (busy_count > max_busy_count &&
+               !max_busy_thread_count.compare_exchange_weak(max_busy_count, busy_count)) {}
+        calls[caller * 50 + i]++;
+        std::this_thread::yield();
+        busy_thread_count--;
+      });
+    });
+  }
+  for (auto &thread : callers) thread.join();
+
+  for (auto &call_count : calls) REQUIRE(call_count == 1);
+
+  // The callers share the pool's two workers rather than each starting
+  // their own threads.
+  REQUIRE(max_busy_thread_count <= 8 + 2);
+}